@@ -0,0 +1,105 @@
+/**
+ * 头文件：arena.h
+ * 语句级的内存池（arena）。
+ *
+ * 解析和执行一条语句时会产生大量只活到语句结束的临时容器：拆出来的子句、where子句绑定的序号、
+ * 匹配的行、计算表达式用的栈等等。它们从当前线程的StatementArena中顺序切出内存，释放时什么也不做，
+ * 等语句结束（ArenaScope析构）时把分配位置一次退回原处，不论分配过多少次都是O(1)。
+ * 已经申请的内存块留着给下一条语句用，所以稳定运行之后这些临时容器几乎不再向系统申请内存。
+ * 每个线程有自己的内存池，工作线程之间不会争用分配器。
+ *
+ * 内存池按std::pmr::memory_resource的接口实现，临时容器用std::pmr中对应的容器并传入getStatementArena()即可。
+ * 使用时必须遵守栈的次序：在某个ArenaScope之内分配的内存，不能在它析构之后继续使用，
+ * 因此语句结构体、查询结果这些要留到语句之后的东西不能放在这里。
+ */
+#ifndef __ARENA_MINIDB_H__
+#define __ARENA_MINIDB_H__
+
+#include "environment.h"
+
+namespace minidb {
+
+const size_t g_ArenaBlockSize = 64 * 1024;		// 每次向系统申请的内存块大小，更大的单次分配单独成块
+
+class StatementArena extends public std::pmr::memory_resource {
+	public:
+		struct Mark {							// 分配位置：第几个内存块、块内偏移
+			size_t block;
+			size_t offset;
+		};
+	private:
+		struct Block {
+			std::unique_ptr<char[]> data;
+			size_t size;
+		};
+		vector<Block> blocks;
+		size_t current;							// 正在使用的内存块
+		size_t offset;							// 当前块中已经分配出去的字节数
+	protected:
+		void* do_allocate(size_t, size_t) override;
+		void do_deallocate(void*, size_t, size_t) override {}	// 单独释放什么也不做，统一在rewind时退回
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+	public:
+		StatementArena():current(0),offset(0){}
+		StatementArena(const StatementArena&) = delete;
+		StatementArena& operator= (const StatementArena&) = delete;
+		Mark mark() const { return Mark{current, offset}; }
+		void rewind(const Mark);				// 退回到之前记下的位置，此后分配的内存全部作废
+};
+
+// 记下构造时的分配位置，析构时退回，可以嵌套
+class ArenaScope {
+	private:
+		StatementArena& arena;
+		StatementArena::Mark start;
+	public:
+		ArenaScope();
+		~ArenaScope() { arena.rewind(start); }
+		ArenaScope(const ArenaScope&) = delete;
+		ArenaScope& operator= (const ArenaScope&) = delete;
+};
+
+StatementArena& getStatementArena();			// 当前线程的内存池
+
+
+
+// 函数体定义全部写在下方
+
+void* StatementArena::do_allocate(size_t bytes, size_t alignment) {
+	// 内存块的起始地址按new的默认对齐，块内偏移对齐即地址对齐
+	while (true) {
+		if (current == blocks.size()) {
+			size_t size = std::max(g_ArenaBlockSize, bytes + alignment);
+			blocks.push_back(Block{std::unique_ptr<char[]>(new char[size]), size});
+		}
+		Block& block = blocks[current];
+		size_t begin = (offset + alignment - 1) & ~(alignment - 1);
+		if (begin + bytes <= block.size) {
+			offset = begin + bytes;
+			return block.data.get() + begin;
+		}
+		// 当前块放不下，换下一块（之前的语句留下的块可以直接复用）
+		++current;
+		offset = 0;
+	}
+}
+void StatementArena::rewind(const Mark m) {
+	current = m.block;
+	offset = m.offset;
+	if (current == 0 and offset == 0) {
+		// 整个内存池都空出来时，丢掉为个别特别大的分配单独申请的块，只留下常规大小的块
+		auto it = std::remove_if(blocks.begin(), blocks.end(), [](const Block& block) { return block.size != g_ArenaBlockSize; });
+		blocks.erase(it, blocks.end());
+	}
+}
+
+ArenaScope::ArenaScope():arena(getStatementArena()),start(getStatementArena().mark()) {}
+
+StatementArena& getStatementArena() {
+	static thread_local StatementArena arena;
+	return arena;
+}
+
+}
+
+#endif
\ No newline at end of file
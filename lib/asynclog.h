@@ -0,0 +1,197 @@
+/**
+ * 头文件：asynclog.h
+ * 分级的异步日志。
+ *
+ * 所有输出到控制台的信息（提示、警告、错误、调试信息）都经过这里：调用者只负责格式化出一条完整的日志，
+ * 放进一个无锁的环形缓冲区就返回，由后台线程依次写到控制台。执行语句的线程因此不会卡在控制台输出上。
+ * 日志按放入的顺序输出，同一线程先后写的日志不会颠倒。
+ *
+ * 日志分为error、warn、info、debug、trace五级，低于当前级别的日志直接丢弃，而且不做任何格式化（见logLazy）。
+ * 级别在运行时设置（见entry.h中的-log参数），默认值取决于是否定义了__DEBUG_ENVIRONMENT__。
+ * 逐行输出的trace日志只在定义了__ENABLE_TRACE__时才会被编译进程序。
+ */
+#ifndef __ASYNCLOG_MINIDB_H__
+#define __ASYNCLOG_MINIDB_H__
+
+#include "environment.h"
+
+#include <csignal>
+
+namespace minidb {
+
+enum class log_level {
+	error,
+	warn,
+	info,
+	debug,
+	trace
+};
+
+const size_t g_LogRingCapacity = 4096;			// 环形缓冲区的槽数，必须是2的幂
+
+// 多个生产者、一个消费者的有界环形缓冲区（每个槽带一个序号，生产者用CAS抢占槽位），消费者是后台写出线程
+class AsyncLogger {
+	private:
+		struct Slot {
+			atomic<size_t> sequence;				// 等于槽位编号时可写，等于槽位编号+1时可读
+			string text;
+		};
+		std::unique_ptr<Slot[]> ring;
+		atomic<size_t> head;						// 下一条日志的槽位编号
+		size_t tail;								// 下一条要写出的槽位编号，只有写出线程访问
+		atomic<size_t> written;						// 已经写出的日志条数
+		atomic<int> level;
+		atomic<bool> f_Sleeping;					// 写出线程是否正在（或即将）等待新日志
+		atomic<bool> f_Stop;
+		mutex wake_mutex;
+		condition_variable cv_wake;					// 唤醒写出线程
+		condition_variable cv_written;				// 通知等待写出完成的线程
+		ostream& os;
+		thread writer;
+		void run();
+		bool drain();								// 写出缓冲区中已有的日志，返回是否写出了至少一条
+		void wake();
+	public:
+		AsyncLogger(ostream&);
+		~AsyncLogger();								// 写完缓冲区中剩余的日志再退出
+		AsyncLogger(const AsyncLogger&) = delete;
+		AsyncLogger& operator= (const AsyncLogger&) = delete;
+		bool isEnabled(const log_level l) const { return static_cast<int>(l) <= level.load(std::memory_order_relaxed); }
+		void setLevel(const log_level l) { level.store(static_cast<int>(l)); }
+		void push(string&&);						// 缓冲区满时等待写出线程腾出位置，日志不会丢失
+		void flush();								// 等待此前放入的日志全部写出
+};
+
+AsyncLogger& getLogger();						// 第一次使用时创建，写到clog
+bool parseLogLevel(const string&, log_level&);	// 识别级别名（error、warn、info、debug、trace），不认识时返回false
+template <typename F> void logLazy(const log_level, F);	// 级别已打开时才调用F(ostream&)格式化日志，再整条放入缓冲区
+void logLine(const log_level, const string&);	// 输出一条单独成段的日志，前面空一行，与原先clog << endl << ... << endl的格式相同
+
+
+
+
+// 函数体定义全部写在下方
+
+AsyncLogger::AsyncLogger(ostream& o):ring(new Slot[g_LogRingCapacity]),head(0),tail(0),written(0),
+	f_Sleeping(false),f_Stop(false),os(o) {
+	#ifdef __DEBUG_ENVIRONMENT__
+		level.store(static_cast<int>(log_level::debug));
+	#else
+		level.store(static_cast<int>(log_level::info));
+	#endif
+	for (size_t i = 0; i < g_LogRingCapacity; ++i) {
+		ring[i].sequence.store(i);
+	}
+	// 写出线程不处理信号：服务器模式下SIGINT/SIGTERM必须交给主线程，才能打断accept（见server.h）
+	sigset_t blocked, old_mask;
+	sigemptyset(&blocked);
+	sigaddset(&blocked, SIGINT);
+	sigaddset(&blocked, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &blocked, &old_mask);
+	writer = thread(&AsyncLogger::run, this);
+	pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+}
+AsyncLogger::~AsyncLogger() {
+	f_Stop.store(true);
+	wake();
+	writer.join();
+}
+void AsyncLogger::push(string&& text) {
+	size_t pos = head.load(std::memory_order_relaxed);
+	Slot* slot;
+	while (true) {
+		slot = &ring[pos & (g_LogRingCapacity - 1)];
+		size_t seq = slot->sequence.load(std::memory_order_acquire);
+		if (seq == pos) {
+			if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+		}
+		else if (seq < pos) {
+			// 缓冲区已满，等写出线程腾出位置
+			wake();
+			std::this_thread::yield();
+			pos = head.load(std::memory_order_relaxed);
+		}
+		else pos = head.load(std::memory_order_relaxed);
+	}
+	slot->text = std::move(text);
+	slot->sequence.store(pos + 1);
+	// 与写出线程的“先置f_Sleeping、再检查缓冲区”配对：两边都用顺序一致的原子操作，不会双方都错过对方
+	if (f_Sleeping.load()) wake();
+}
+void AsyncLogger::wake() {
+	lock_guard<mutex> lock(wake_mutex);
+	cv_wake.notify_one();
+}
+bool AsyncLogger::drain() {
+	bool f_hasWritten = false;
+	while (true) {
+		Slot& slot = ring[tail & (g_LogRingCapacity - 1)];
+		if (slot.sequence.load() != tail + 1) break;
+		os.write(slot.text.data(), slot.text.size());
+		slot.text.clear();
+		slot.sequence.store(tail + g_LogRingCapacity, std::memory_order_release);
+		++tail;
+		f_hasWritten = true;
+	}
+	if (f_hasWritten) {
+		os.flush();
+		lock_guard<mutex> lock(wake_mutex);
+		written.store(tail);
+		cv_written.notify_all();
+	}
+	return f_hasWritten;
+}
+void AsyncLogger::run() {
+	while (true) {
+		if (drain()) continue;
+		if (f_Stop.load()) {
+			drain();
+			return;
+		}
+		unique_lock<mutex> lock(wake_mutex);
+		f_Sleeping.store(true);
+		// 置位之后再看一次，避免在置位之前放入的日志无人写出
+		if (ring[tail & (g_LogRingCapacity - 1)].sequence.load() != tail + 1 and !f_Stop.load()) {
+			cv_wake.wait_for(lock, std::chrono::milliseconds(50));
+		}
+		f_Sleeping.store(false);
+	}
+}
+void AsyncLogger::flush() {
+	size_t target = head.load();
+	unique_lock<mutex> lock(wake_mutex);
+	cv_wake.notify_one();
+	cv_written.wait(lock, [this, target]() { return written.load() >= target; });
+}
+
+AsyncLogger& getLogger() {
+	static AsyncLogger logger(clog);
+	return logger;
+}
+bool parseLogLevel(const string& name, log_level& res) {
+	const vector<pair<string, log_level>> names = {
+		{"error", log_level::error},	{"warn", log_level::warn},		{"info", log_level::info},
+		{"debug", log_level::debug},	{"trace", log_level::trace}
+	};
+	for (const auto& p_name : names) {
+		if (p_name.first == name) {
+			res = p_name.second;
+			return true;
+		}
+	}
+	return false;
+}
+template <typename F> void logLazy(const log_level l, F format) {
+	AsyncLogger& logger = getLogger();
+	if (!logger.isEnabled(l)) return;
+	std::ostringstream ss;
+	format(ss);
+	logger.push(ss.str());
+}
+void logLine(const log_level l, const string& text) {
+	logLazy(l, [&text](ostream& os) { os << '\n' << text << '\n'; });
+}
+
+}
+
+#endif
\ No newline at end of file
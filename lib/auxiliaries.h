@@ -28,10 +28,60 @@ class TokenCounter {
 		string where(int);										// 返回行号文本
 		string where() { return where(tokens()); }
 		void newl() { lnpos.push_back(tokens()); }				// 向lnpos中添加新行的位置
+		void rewind(int n) { count = n; }						// 退回到token总数为n的位置，已记录的换行位置保留
 
-} g_LnCounter;											// 只声明这一个对象就足够用了
+};
 
-void standardizeInputFile(ifstream&);
+// 会话上下文：一个客户端连接（或一次文件模式的运行）独有的状态
+// 每个线程默认使用自己的会话，因此服务器同时处理多个连接时，各连接的当前数据库、行号互不干扰。
+class Transaction;
+class SessionContext {
+	public:
+		TokenCounter ln_counter;				// 解析位置（行号计数器）
+		string database_name;					// 当前使用的数据库
+		bool f_SilentLoggers;					// 设置为true以让loggers闭嘴
+		bool f_isFirstOutput;					// 是否还未输出过查询结果
+		Transaction* p_Transaction;				// 正在进行的显式事务，由commands.h中的begin/commit/rollback创建和释放
+		SessionContext():database_name(""),f_SilentLoggers(false),f_isFirstOutput(true),p_Transaction(nullptr){}
+		void reset() { ln_counter.clearAll(); database_name = ""; f_SilentLoggers = false; f_isFirstOutput = true; }
+};
+
+thread_local SessionContext g_ThreadSession;
+thread_local SessionContext* g_Session = &g_ThreadSession;	// 当前线程正在服务的会话
+
+// 有界阻塞队列，一个线程放入、另一个线程按顺序取出
+// 队列满时push等待，队列空时pop等待。close之后push一律失败，pop取完剩余的元素后失败。
+template <typename T>
+class BoundedQueue {
+	private:
+		std::deque<T> items;
+		size_t capacity;
+		bool f_Closed;
+		mutex queue_mutex;
+		condition_variable cv_notFull;
+		condition_variable cv_notEmpty;
+	public:
+		BoundedQueue(const size_t cap):capacity(cap),f_Closed(false){}
+		BoundedQueue(const BoundedQueue&) = delete;
+		BoundedQueue& operator= (const BoundedQueue&) = delete;
+		bool push(T&&);
+		bool pop(T&);
+		void close();
+};
+
+// Bloom过滤器：只能插入、不能删除的集合，查询结果是“一定不在”或“可能在”。键由调用者先算好64位哈希值
+const size_t g_BloomBitsPerKey = 10;			// 每个键占的位数，3个哈希函数时误判率约为1.7%
+const int g_BloomHashes = 3;
+class BloomFilter {
+	private:
+		vector<uint64_t> words;
+		uint64_t mask;							// 总位数减1，总位数是2的幂
+	public:
+		BloomFilter(const size_t);				// 参数为预计插入的键数
+		void insert(const uint64_t);
+		bool mayContain(const uint64_t) const;
+};
+uint64_t mixHash(uint64_t);						// 打散哈希值的各位（splitmix64的最后一步），std::hash对整数可能就是原值
 
 namespace symbols {								
 	const string newl = "\\newl";				// 换行标志
@@ -63,109 +113,161 @@ namespace symbols {
 	};
 }
 
-int stringToInt(const string);
-double stringToDouble(const string);
+/**
+ * 字面量的分类与数值解析
+ * 都基于from_chars，不构造stringstream，也从不抛异常，但规则与最初基于stod和stringstream的写法保持一致：
+ * 		以单引号开头的是字符串；
+ * 		开头能解析出一个数（与stod相同，可带正负号，也接受inf、nan的拼写）的是数，其中含有小数点的是浮点数，否则是整数；
+ * 		其余视为变量名。
+ * 因此"12abc"、"info"、"nan"都是整数，"1e5"也是整数。
+ * 取值时与stringstream相同，只解析开头的部分：整数取开头的整数部分（"1e5"得1，"info"得0），浮点数取开头的十进制数。
+ * 整数一律按64位处理，超出范围的整数字面量和整数运算结果都会报错（见Term::setValue和Term的四则运算）。
+ */
+enum class value_class {
+	integer,
+	floating,
+	text,
+	variable
+};
+value_class classifyValue(const string_view);
+bool parseInt64(const string_view, int64_t&);			// 取开头的整数部分，没有时得0；超出范围时取最接近的边界值并返回false
+bool parseDouble(const string_view, double&);			// 取开头的十进制数，没有时得0并返回false，不接受inf、nan
+int64_t stringToInt(const string&);						// 开头的整数部分，没有时返回0
+double stringToDouble(const string&);					// 开头的十进制数，没有时返回0
 
 
 // 函数体定义大部分写在下方
 
 
-int stringToInt (const string s) {
-	stringstream ss(s);
-	int i;
-	ss >> i;
+bool parseInt64(const string_view str, int64_t& result) {
+	const char* first = str.data();
+	const char* last = first + str.size();
+	result = 0;
+	// 至多一个正负号，之后必须是数字
+	const char* digits = (first != last and (*first == '+' or *first == '-')) ? first + 1 : first;
+	if (digits == last or !isDigit(*digits)) return true;
+	if (*first == '+') ++first;							// from_chars不接受正号
+	auto res = std::from_chars(first, last, result);
+	if (res.ec == std::errc::result_out_of_range) {
+		result = (*first == '-') ? INT64_MIN : INT64_MAX;
+		return false;
+	}
+	if (res.ec != std::errc()) result = 0;
+	return true;
+}
+bool parseDouble(const string_view str, double& result) {
+	const char* first = str.data();
+	const char* last = first + str.size();
+	result = 0;
+	// 符号之后必须是数字或小数点，这样就排除了inf、nan等拼写
+	const char* digits = (first != last and (*first == '+' or *first == '-')) ? first + 1 : first;
+	if (digits == last or !(isDigit(*digits) or *digits == '.')) return false;
+	if (*first == '+') ++first;
+	auto res = std::from_chars(first, last, result, std::chars_format::general);
+	if (res.ec == std::errc::result_out_of_range) {
+		result = (*first == '-') ? -HUGE_VAL : HUGE_VAL;
+	}
+	else if (res.ec != std::errc()) return false;
+	return true;
+}
+value_class classifyValue(const string_view str) {
+	if (str.empty()) return value_class::variable;
+	if (str.front() == '\'') return value_class::text;
+	// 与stod一样只看开头：符号之后能解析出数（包括inf、nan）就算数
+	const char* first = str.data();
+	const char* last = first + str.size();
+	if (*first == '+' or *first == '-') ++first;
+	if (first == last or *first == '+' or *first == '-') return value_class::variable;
+	double temp;
+	auto res = std::from_chars(first, last, temp, std::chars_format::general);
+	if (res.ec != std::errc() and res.ec != std::errc::result_out_of_range) return value_class::variable;
+	if (str.find('.') != string_view::npos) return value_class::floating;
+	return value_class::integer;
+}
+int64_t stringToInt(const string& s) {
+	int64_t i = 0;
+	parseInt64(s, i);
 	return i;
 }
-
-double stringToDouble (const string s) {
-	stringstream ss(s);
-	double d;
-	ss >> d;
+double stringToDouble(const string& s) {
+	double d = 0;
+	parseDouble(s, d);
 	return d;
 }
 
+template <typename T>
+bool BoundedQueue<T>::push(T&& item) {
+	unique_lock<mutex> lock(queue_mutex);
+	cv_notFull.wait(lock, [this]() { return f_Closed or items.size() < capacity; });
+	if (f_Closed) return false;
+	items.push_back(std::move(item));
+	cv_notEmpty.notify_one();
+	return true;
+}
+template <typename T>
+bool BoundedQueue<T>::pop(T& item) {
+	unique_lock<mutex> lock(queue_mutex);
+	cv_notEmpty.wait(lock, [this]() { return f_Closed or !items.empty(); });
+	if (items.empty()) return false;
+	item = std::move(items.front());
+	items.pop_front();
+	cv_notFull.notify_one();
+	return true;
+}
+template <typename T>
+void BoundedQueue<T>::close() {
+	lock_guard<mutex> lock(queue_mutex);
+	f_Closed = true;
+	cv_notFull.notify_all();
+	cv_notEmpty.notify_all();
+}
+
+BloomFilter::BloomFilter(const size_t keys) {
+	size_t bits = 64;
+	while (bits < keys * g_BloomBitsPerKey) bits <<= 1;
+	words.assign(bits / 64, 0);
+	mask = bits - 1;
+}
+void BloomFilter::insert(const uint64_t hash) {
+	// 两个哈希值线性组合出g_BloomHashes个位置（Kirsch-Mitzenmacher）
+	uint64_t h1 = mixHash(hash), h2 = (h1 >> 32) | 1;
+	for (int i = 0; i < g_BloomHashes; ++i) {
+		uint64_t bit = (h1 + i * h2) & mask;
+		words[bit / 64] |= uint64_t(1) << (bit % 64);
+	}
+}
+bool BloomFilter::mayContain(const uint64_t hash) const {
+	uint64_t h1 = mixHash(hash), h2 = (h1 >> 32) | 1;
+	for (int i = 0; i < g_BloomHashes; ++i) {
+		uint64_t bit = (h1 + i * h2) & mask;
+		if ((words[bit / 64] & (uint64_t(1) << (bit % 64))) == 0) return false;
+	}
+	return true;
+}
+uint64_t mixHash(uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
 // 输出行号
 string TokenCounter::where(int n) {
 	int size = lnpos.size();
 	stringstream ss;
-	if (size == 0) ss << i18n::parseKey("notinfile");
+	if (size == 0) ss << i18n::parseKey(msg_id::notinfile);
 	else {
 		size_t ln = 1;
 		while (ln < lnpos.size() and n > lnpos.at(ln)) {
 			++ln;
 		}
-		ss << i18n::parseKey("lnno",{itos(ln)});
+		ss << i18n::parseKey(msg_id::lnno,{itos(ln)});
 	}
 	return ss.str();
 }
 
-// 标准化输入文件
-// 实际上就是在符号的两侧添加一个空格，利用空格来进行token拆分
-void standardizeInputFile(ifstream& ifile) {
-	g_LnCounter.clearAll();
-	ofstream ofile;
-	ofile.open(g_TempFileName.c_str(), ios::out);
-	if (!ofile.is_open()) {
-		throw FailedFileOperation(i18n::parseKey("opentmpf",{g_TempFileName}));
-	}
-	bool f_isInStr = false;		// 对字符串做特判
-	bool f_isNeq = false;		// Project要求的唯一非单字符符号是“!=”，对其做特判
-	while (true) {
-		char ch;
-		ifile >> noskipws >> ch;	// noskipws保证读入空白字符，否则没法分割token也没法计算行号
-		if (ifile.eof()) break;
-		if (f_isInStr) {
-			if (ch == '\'') {
-				f_isInStr = false;
-			}
-			else if (ch == '\n') {
-				// 字符串内换行说明字符串不闭合
-				throw InvalidArgument(i18n::parseKey("incmpltstr"));
-			}
-			ofile << ch;
-			continue;
-		}
-		if (f_isNeq) {
-			f_isNeq = false;
-			if (ch == '=') {
-				ofile << ' ' << symbols::neq << ' ';
-				continue;
-			}
-			else {
-				ofile << " ! ";
-			}
-		}
-		switch (ch) {
-			case '\n':
-				ofile << " " << symbols::newl << " ";
-				g_LnCounter.newl();
-				break;
-			case '\'':
-				ofile << '\'';
-				f_isInStr = true;
-				break;
-			case '!':
-				f_isNeq = true;
-				break;
-			default:
-				do {	// 套do-while (false); 的目的是在switch-case块内部声明变量
-					auto it = symbols::grmsymbols.find(ch);
-					if (it != symbols::grmsymbols.end()) {
-						ofile << ' ' << it->second << ' ';
-					}
-					else ofile << ch;
-				} while (false);
-		}
-	}
-	ifile.close();
-	ofile.close();
-	ifile.open(g_TempFileName, ios::in);		// 原本ifile打开的是指定的输入文件，但从这里开始，打开的是规整化后的临时文件
-	if (!ifile.is_open()) {
-		throw FailedFileOperation(i18n::parseKey("opentmpf",{g_TempFileName}));
-	}
-	g_LnCounter.clearAll();
-}
-
 
 }
 #endif
\ No newline at end of file
@@ -5,127 +5,80 @@
 #ifndef __CALCULATOR_MINIDB_H__
 #define __CALCULATOR_MINIDB_H__
 
-#include "objects.h"
+#include "statements.h"
+#include "arena.h"
 
 
 
 namespace minidb {
 
-void applyAsgnExpr(Row&, const string);
-vstring convert2Postfix(const string);
-Term calculatePostfix(const vstring, Row);
-bool isExprOps(const string);
-int getOpPriority(const string);
-vstring g_exprOps = {
-	symbols::plus,	symbols::minus,		symbols::times,		symbols::divides,
-	symbols::mods,	symbols::lparen,	symbols::rparen
+// 后缀表达式中的一项：运算符、列或常量
+struct PostfixItem {
+	bool f_isOperator;
+	bool f_isColumn;
+	string token;					// 运算符，或者列名（报错用）
+	size_t ordinal;					// 列的序号，不存在的列为g_NoSuchColumn，等到真正取值时才报错
+	Term literal;					// 常量
+};
+// 编译好的赋值表达式：左值、右值中的列名都已换成序号，右值已转为后缀表达式
+struct CompiledAssignment {
+	size_t target;
+	vector<PostfixItem> postfix;
 };
 
-void applyAsgnExpr(Row& row, const string asgn_expr) {
-	auto pos = asgn_expr.find('=');
-	if (pos == string::npos) throw InvalidArgument(i18n::parseKey("exptsthgotothers", {i18n::parseKey("p_asgn").str(), "\"" + asgn_expr + "\""}));
-	string lvalue = trim(asgn_expr.substr(0,pos));
-	string rvalue = trim(asgn_expr.substr(pos+1));
-	if (!isValidVarName(lvalue)) throw InvalidArgument(i18n::parseKey("invalidlval", {lvalue}));
-	Term& term = row.findTerm(lvalue);
-	Term res = calculatePostfix(convert2Postfix(rvalue), row);
-	if (term.isCompatibleWith(res)) term = res;
-	else throw InvalidArgument(i18n::parseKey("incmpttypes", {term.getType(), res.getType()}));
-}
-// 这里的expr是右值表达式
-vstring convert2Postfix(const string expr) {
-	stack<string> ops;
-	vstring res;
+CompiledAssignment bindAssignment(const Assignment&, const Schema&);	// 解析时记下的错误在这里抛出
+void applyAsgnExpr(Row&, const CompiledAssignment&);
+Term calculatePostfix(const vector<PostfixItem>&, const Row&);
 
-	for (string token : splitByDelimiters(expr, ' ')) {
-		if (token == "") continue;
-		if (isExprOps(token)) {
-			if (token == symbols::lparen) {
-				ops.push(token);
-			}
-			else if (token == symbols::rparen) {
-				string top;
-				do {
-					if (ops.empty()) throw SyntaxError(i18n::parseKey("mismparen"));
-					top = ops.top();
-					ops.pop();
-					if (top != symbols::lparen) res.push_back(top);
-					else break;
-				} while (true);
-			}
-			else {
-				if (ops.empty()) {
-					ops.push(token);
-					continue;
-				}
-				string top;
-				do {
-					if (ops.empty()) break;
-					top = ops.top();
-					if (getOpPriority(top) < getOpPriority(token)) break;
-					else {
-						ops.pop();
-						res.push_back(top);
-					}
-				} while (true);
-				ops.push(token);
-			}
-			continue;
-		}
-		else res.push_back(token);
+CompiledAssignment bindAssignment(const Assignment& asgn, const Schema& schema) {
+	// 左值合法时先检查列是否存在，再抛出右值的错误，与原先逐行解析的顺序一致
+	CompiledAssignment res;
+	if (!asgn.target.empty()) {
+		res.target = schema.ordinalOf(asgn.target);
+		if (res.target == g_NoSuchColumn) throw InvalidArgument(i18n::parseKey(msg_id::nosuchterm, {asgn.target}));
 	}
-	while (!ops.empty()) {
-		string op = ops.top();
-		res.push_back(op);
-		ops.pop();
+	if (asgn.error) std::rethrow_exception(asgn.error);
+	for (const ExprItem& expr : asgn.postfix) {
+		PostfixItem item{expr.f_isOperator, !expr.f_isOperator and expr.operand.f_isColumn,
+			expr.f_isOperator ? expr.op : expr.operand.name, g_NoSuchColumn, expr.operand.literal};
+		if (item.f_isColumn) item.ordinal = schema.ordinalOf(item.token);
+		res.postfix.push_back(item);
 	}
 	return res;
 }
-Term calculatePostfix(const vstring params, Row row) {
-	stack<Term> operands;
-	for (string token : params) {
-		if (isExprOps(token)) {
-			Term second = operands.top();
-			operands.pop();
-			Term first = operands.top();
-			operands.pop();
+void applyAsgnExpr(Row& row, const CompiledAssignment& asgn) {
+	Term& term = row.at(asgn.target);
+	Term res = calculatePostfix(asgn.postfix, row);
+	if (term.isCompatibleWith(res)) term = res;
+	else throw InvalidArgument(i18n::parseKey(msg_id::incmpttypes, {term.getType(), res.getType()}));
+}
+Term calculatePostfix(const vector<PostfixItem>& params, const Row& row) {
+	// 每一行都要算一遍，操作数栈放在内存池中，算完即退回
+	ArenaScope scope;
+	std::pmr::vector<Term> operands(&getStatementArena());
+	for (const PostfixItem& item : params) {
+		const string& token = item.token;
+		if (item.f_isOperator) {
+			Term second = std::move(operands.back());
+			operands.pop_back();
+			Term first = std::move(operands.back());
+			operands.pop_back();
 			Term res;
 			if (token == symbols::plus)			res = first + second;
 			else if (token == symbols::minus)	res = first - second;
 			else if (token == symbols::times)	res = first * second;
 			else if (token == symbols::divides)	res = first / second;
 			else if (token == symbols::mods)	res = first % second;
-			else if (token == symbols::lparen)	throw SyntaxError(i18n::parseKey("mismparen"));
-			else throw SyntaxError(i18n::parseKey("unexptstr", {token}));
-			operands.push(res);
-		}
-		else {
-			Term term;
-			string type = parseValueType(token);
-			if (type == keywords::variable) {
-				term = row.findTerm(token);
-			}
-			else {
-				term.setType(type).setValue(token);
-			}
-			operands.push(term);
+			else if (token == symbols::lparen)	throw SyntaxError(i18n::parseKey(msg_id::mismparen));
+			else throw SyntaxError(i18n::parseKey(msg_id::unexptstr, {token}));
+			operands.push_back(std::move(res));
 		}
+		else if (!item.f_isColumn) operands.push_back(item.literal);
+		else if (item.ordinal != g_NoSuchColumn) operands.push_back(row.at(item.ordinal));
+		else throw InvalidArgument(i18n::parseKey(msg_id::nosuchterm, {token}));
 	}
-	return operands.top();
-}
-int getOpPriority(const string op) {
-	if (op == symbols::plus or op == symbols::minus) return 1;
-	else if (op == symbols::times or op == symbols::divides or op == symbols::mods) return 2;
-	else if (op == symbols::lparen) return 0;
-	else return -1;
+	return std::move(operands.back());
 }
-bool isExprOps(const string op) {
-	for (string str : g_exprOps) {
-		if (op == str) return true;
-	}
-	return false;
-}
-
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,81 @@
+/**
+ * 头文件：collector.h
+ * 旧版本回收。
+ * 
+ * update、delete不会真正移除旧的行，只是让它们对新的快照不可见（见objects.h中的MVCC部分）。
+ * 回收线程定期检查各表，当一张表积累的失效版本足够多、并且暂时没有写者时，把对所有活跃快照都不可见的版本清理掉。
+ */
+#ifndef __COLLECTOR_MINIDB_H__
+#define __COLLECTOR_MINIDB_H__
+
+#include "objects.h"
+
+namespace minidb {
+
+const size_t g_CollectThreshold = 1024;				// 失效版本数达到此值时才回收该表
+const int g_CollectIntervalMs = 200;				// 两次检查之间的间隔（毫秒）
+
+class VersionCollector {
+	private:
+		thread worker;
+		mutex wait_mutex;
+		condition_variable wait_cv;
+		bool f_StopRequested;
+		void run();
+	public:
+		VersionCollector():f_StopRequested(false){}
+		~VersionCollector() { stop(); }
+		void start();
+		void stop();
+		size_t collectOnce();						// 检查所有表一遍，返回回收的版本数
+};
+
+VersionCollector g_VersionCollector;
+
+
+
+// 函数体定义全部写在下方
+
+void VersionCollector::start() {
+	if (worker.joinable()) return;
+	f_StopRequested = false;
+	worker = thread(&VersionCollector::run, this);
+}
+void VersionCollector::stop() {
+	if (!worker.joinable()) return;
+	{
+		lock_guard<mutex> lock(wait_mutex);
+		f_StopRequested = true;
+	}
+	wait_cv.notify_all();
+	worker.join();
+}
+void VersionCollector::run() {
+	unique_lock<mutex> lock(wait_mutex);
+	while (!f_StopRequested) {
+		wait_cv.wait_for(lock, std::chrono::milliseconds(g_CollectIntervalMs));
+		if (f_StopRequested) break;
+		lock.unlock();
+		collectOnce();
+		lock.lock();
+	}
+}
+size_t VersionCollector::collectOnce() {
+	size_t removed = 0;
+	// 持有目录的共享锁，回收期间表不会被删除
+	shared_lock<shared_mutex> catalog_lock(g_CatalogMutex);
+	for (auto& p_database : g_Databases) {
+		p_database.second.forEachTable([&removed](const string&, Table& table) {
+			if (table.getDeadVersions() < g_CollectThreshold) return;
+			// 有写者正在使用的表这次先跳过，不和写语句抢锁
+			unique_lock<TableLatch> table_lock(table.getLatch(), std::try_to_lock);
+			if (!table_lock.owns_lock()) return;
+			removed += table.collectGarbage(getOldestActiveVersion());
+		});
+	}
+	return removed;
+}
+
+}
+
+#endif
\ No newline at end of file
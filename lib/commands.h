@@ -6,21 +6,102 @@
 #define __COMMANDS_MINIDB_H__
 
 #include "paramsanlys.h"
+#include "lexer.h"
 #include "operations.h"
-
-#ifdef __DEBUG_ENVIRONMENT__
-	#include "loggers.h"
-#endif
+#include "workpool.h"
+#include "loggers.h"
 
 namespace minidb {
 
-// 设置为true以让loggers闭嘴
-bool gf_SilentLoggers = false;
+/**
+ * 解析与执行流水线：
+ * 解析线程逐条读入、解析语句，放进有界队列；调用runCommands的线程按顺序取出并执行。
+ * 这样执行一条耗时的查询时，后面的语句已经在解析了。
+ * 队列中的语句始终按脚本顺序执行，因此结果、出错时停止的位置都和逐条解析执行时相同。
+ * 语句攒成一批再交接，避免大量短语句（如逐条insert）时两个线程每条语句都要互相唤醒一次。
+ */
+const size_t g_PipelineBatch = 32;				// 每批交接的语句数
+const size_t g_PipelineDepth = 4;				// 队列中最多积压的批数
+
+struct ParsedCommand {
+	Statement st;
+	vtoken raw_params;							// 解析前的参数列表，用于调试输出和持久化日志，不需要时为空
+	int tokens = 0;								// 解析完这条语句时的token总数，执行出错时据此恢复行号计数器
+	std::exception_ptr error;					// 解析出错时非空，它之后不再有语句
+};
+typedef vector<ParsedCommand> command_batch;
+
+/**
+ * 语句调度：
+ * 脚本中前后相邻的语句常常操作互不相干的表，没必要一条条排队。调度器按脚本顺序收下语句，
+ * 根据每条语句读写了哪些表建立依赖：读或写某张表的语句，要等此前最后一条写这张表的语句提交之后才能开始。
+ * 没有依赖的语句交给线程池同时执行。
+ * 执行完的语句仍按脚本顺序逐条“收尾”：输出查询结果、提交事务、写持久化日志，
+ * 因此输出内容和顺序、出错时停止的位置都与逐条执行时相同；出错语句之后已经执行的语句不会提交，随事务析构回滚。
+ * 读语句不阻塞其后的写语句：写语句要到读语句收尾之后才提交，读语句的快照看不到它。
+ * 依赖前面写语句的写语句（如连续insert同一张表）不交给线程池，而是等前驱收尾之后直接在调度器所在的线程上执行，
+ * 免得每条语句都在线程池和调度器之间往返一次。
+ * 线程池中的语句拿不到写者锁（被其他会话的事务占用）时不等待，放弃已做的改动后重新排进线程池；
+ * 轮到它收尾时若仍拿不到，改由调度器所在的线程带超时地等待并执行。
+ * 增删数据库或表、切换数据库、导出、事务控制语句以及显式事务中的语句作为屏障，等此前的语句全部收尾之后再单独执行。
+ */
+const size_t g_ScheduleWindow = 64;				// 已收下但尚未收尾的语句最多有多少条
+
+struct ScheduledCommand {
+	ParsedCommand cmd;
+	std::unique_ptr<Transaction> txn;			// 语句自己的事务，收尾时提交
+	string output;								// 查询结果，收尾时才写入输出流
+	std::exception_ptr error;
+	bool f_Launched = false;
+	bool f_Done = false;						// 在done_mutex下访问
+	bool f_NoRequeue = false;					// 调度器正在等它（或已取消），拿不到写者锁时不再重新排队，在done_mutex下访问
+	bool f_Blocked = false;						// 因拿不到写者锁而未执行，由调度器所在的线程重新执行，在done_mutex下访问
+	int pending_deps = 0;						// 尚未提交的前驱语句数
+	vector<ScheduledCommand*> dependents;		// 等待这条语句提交的后继语句
+};
+
+class StatementScheduler {
+	private:
+		ostream& os;
+		SessionContext* session;
+		size_t window_limit;
+		std::deque<std::unique_ptr<ScheduledCommand>> window;	// 按脚本顺序排列
+		map<string, ScheduledCommand*> last_writers;			// 每张表最后一条尚未提交的写语句
+		mutex done_mutex;
+		condition_variable cv_done;
+		int failed_tokens;
+		void launch(ScheduledCommand&);
+		void execute(ScheduledCommand&);
+		void retireHead();
+		void runBarrier(ParsedCommand&);
+	public:
+		StatementScheduler(ostream&);
+		~StatementScheduler() { cancel(); }
+		StatementScheduler(const StatementScheduler&) = delete;
+		StatementScheduler& operator= (const StatementScheduler&) = delete;
+		void submit(ParsedCommand&&);
+		void drain();							// 等待所有已收下的语句收尾
+		void cancel();							// 出错时调用：等待正在执行的语句结束，丢弃所有未收尾的语句
+		int getFailedTokens() const { return failed_tokens; }	// 出错语句解析完时的token总数，没有出错时为-1
+};
+
+cmd_type judgeCmdType(vtoken&, Statement&);		// 判别参数列表指定了什么类型的命令，同时将其解析为语句结构体
+void produceCommands(StatementLexer&, BoundedQueue<command_batch>&, const bool);	// 解析线程：逐条解析语句放入队列，第三个参数表示是否保留原始参数列表
+void callCommand(ParsedCommand&, ostream&);		// 执行一条已解析的语句
+bool isCatalogModifier(const cmd_type);			// 判断语句是否会增删数据库或表
+bool isJournaled(const cmd_type);				// 判断语句是否改动数据，需要写入持久化日志
+bool collectResources(const Statement&, vstring&, vstring&);	// 列出语句读、写的表，不能与其他语句同时执行时返回false
+void logCommand(const Statement&);				// 输出已执行语句的调试信息（debug级别）
+void logRawCommand(const ParsedCommand&);		// 输出语句解析前的参数列表（debug级别）
 
-cmd_type judgeCmdType(vstring&);					// 判别参数列表指定了什么类型的命令，同时处理参数列表
-void callCommand(vstring, ostream&);			// 根据参数列表调用对应的函数
+void beginTransaction();						// 开启显式事务
+void commitTransaction();						// 提交当前会话的显式事务
+void rollbackTransaction();						// 回滚当前会话的显式事务
+bool abandonTransaction();						// 脚本结束或出错时回滚未提交的事务，返回是否确实有这样的事务
 
-void parseCommand (ifstream&, ofstream&);		// 解析命令的主要逻辑流程
+void parseCommand(const MappedFile&, ostream&);	// 解析命令的主要逻辑流程，输入为文件
+void parseCommand(const string&, ostream&);		// 同上，输入为内存中的脚本（如服务器模式下收到的脚本）
+void runCommands(const string_view, ostream&);	// 逐条解析并执行脚本中的命令，脚本在执行完之前不能释放
 
 #ifndef __STORE_LEGACY__
 	const string legacy_tmp_file_name = "";
@@ -31,6 +112,8 @@ void parseCommand (ifstream&, ofstream&);		// 解析命令的主要逻辑流程
 
 	void storeLegacyDatabases();
 	void readLegacyDatabases();
+	void openLegacyJournal();					// 读取历史数据之后调用，此后每次提交都追加到历史数据文件
+	void closeLegacyJournal();					// 写回历史数据之前调用
 	/**
 	 * 存储的思路简单粗暴：既然都写过parser了，那自然是反复利用最简单。
 	 * 所以存储的时候直接以SQL语句输出至新文件，读取的时候直接过parser就行。
@@ -39,130 +122,467 @@ void parseCommand (ifstream&, ofstream&);		// 解析命令的主要逻辑流程
 
 // 函数体定义在下方
 
-void parseCommand(ifstream& ifile, ofstream& ofile) {
-	string line;
-	standardizeInputFile(ifile);
-	g_LnCounter.clearAll();
-	g_LnCounter.newl();
-	while (getsUntil(ifile, line, symbols::cmdend)) {
-		vstring params;
-		params = splitByDelimiters(line, ' ');
-		
-		#ifdef __DEBUG_ENVIRONMENT__
-			if (!gf_SilentLoggers) {
-				clog << endl << i18n::parseKey("h_debug_rawcmd");
-				for (string str : params) {
-					clog << str << ' ';
-				}
-				clog << endl;
+void parseCommand(const MappedFile& ifile, ostream& ofile) {
+	runCommands(ifile.view(), ofile);
+}
+
+void parseCommand(const string& script, ostream& os) {
+	runCommands(script, os);
+}
+
+void runCommands(const string_view script, ostream& ofile) {
+	g_Session->ln_counter.clearAll();
+	g_Session->ln_counter.newl();
+
+	bool f_keepRaw = g_Journal.is_open() or (!g_Session->f_SilentLoggers and getLogger().isEnabled(log_level::debug));
+
+	BoundedQueue<command_batch> queue(g_PipelineDepth);
+	SessionContext* session = g_Session;
+	// 解析线程只改动会话的行号计数器，执行线程在解析线程结束之前不读取它
+	StatementLexer lexer(script);
+	thread producer([&lexer, &queue, session, f_keepRaw]() {
+		g_Session = session;
+		produceCommands(lexer, queue, f_keepRaw);
+	});
+
+	StatementScheduler scheduler(ofile);
+	try {
+		command_batch batch;
+		while (queue.pop(batch)) {
+			for (ParsedCommand& cmd : batch) {
+				scheduler.submit(std::move(cmd));
 			}
-		#endif
+		}
+		scheduler.drain();
+	}
+	catch (...) {
+		scheduler.cancel();
+		queue.close();
+		producer.join();
+		// 解析线程可能已经读到了后面的语句，行号要退回到出错的这一条
+		if (scheduler.getFailedTokens() != -1) g_Session->ln_counter.rewind(scheduler.getFailedTokens());
+		// 出错时脚本不再继续执行，未提交的事务必须在写回历史数据之前回滚
+		abandonTransaction();
+		// 出错之前已经自动提交的语句照常写入日志；写入失败时仍然报告原先的错误
+		try {
+			flushJournal();
+		}
+		catch (MiniDBExceptionBase&) {}
+		throw;
+	}
+	producer.join();
+	if (abandonTransaction() and !g_Session->f_SilentLoggers) {
+		logLine(log_level::warn, i18n::parseKey(msg_id::w_txnrollback).str());
+	}
+	flushJournal();					// 一个脚本中自动提交的语句在这里一次写入
+}
 
-		callCommand(params,ofile);
+StatementScheduler::StatementScheduler(ostream& o):os(o),session(g_Session),failed_tokens(-1) {
+	// 没有工作线程时语句只能逐条执行，窗口里至多一条
+	window_limit = (getStatementPool().size() == 0 ? 1 : g_ScheduleWindow);
+}
+void StatementScheduler::submit(ParsedCommand&& cmd) {
+	if (cmd.error) {
+		drain();
+		if (!g_Session->f_SilentLoggers) logRawCommand(cmd);
+		std::rethrow_exception(cmd.error);
 	}
-	ifile.close();
+
+	vstring reads, writes;
+	// 显式事务中的语句共用会话的事务，只能依次执行
+	if (window_limit == 1 or g_Session->p_Transaction != nullptr or !collectResources(cmd.st, reads, writes)) {
+		runBarrier(cmd);
+		return;
+	}
+
+	std::set<ScheduledCommand*> deps;
+	for (const vstring* p_list : {&reads, &writes}) {
+		for (const string& table : *p_list) {
+			auto it = last_writers.find(table);
+			if (it != last_writers.end()) deps.insert(it->second);
+		}
+	}
+	// 写语句依赖前面的写语句时，先让前驱收尾，再在本线程上直接执行
+	bool f_inline = !writes.empty() and !deps.empty();
+	if (f_inline) {
+		while (!deps.empty()) {
+			deps.erase(window.front().get());
+			retireHead();
+		}
+	}
+	while (window.size() >= window_limit) retireHead();
+
+	window.emplace_back(new ScheduledCommand);
+	ScheduledCommand& sc = *window.back();
+	sc.cmd = std::move(cmd);
+	sc.txn.reset(new Transaction);
+
+	for (ScheduledCommand* p_dep : deps) {
+		p_dep->dependents.push_back(&sc);
+		++sc.pending_deps;
+	}
+	for (const string& table : writes) {
+		last_writers[table] = &sc;
+	}
+	if (f_inline) {
+		sc.f_Launched = true;
+		execute(sc);
+	}
+	else if (sc.pending_deps == 0) launch(sc);
 }
+void StatementScheduler::runBarrier(ParsedCommand& cmd) {
+	drain();
+	if (!g_Session->f_SilentLoggers) logRawCommand(cmd);
+	failed_tokens = cmd.tokens;
+	callCommand(cmd, os);
+	failed_tokens = -1;
+}
+void StatementScheduler::launch(ScheduledCommand& sc) {
+	sc.f_Launched = true;
+	sc.txn->setNoWait(true);
+	getStatementPool().submit([this, &sc]() { execute(sc); });
+}
+void StatementScheduler::execute(ScheduledCommand& sc) {
+	// 在工作线程上执行，借用发起者的会话：数据库名等在屏障语句之外不会改变
+	SessionContext* previous = g_Session;
+	g_Session = session;
+	ArenaScope scope;							// 执行用的临时容器在这条语句执行完后一并退回
+	try {
+		const Statement& st = sc.cmd.st;
+		shared_lock<shared_mutex> catalog_rlock(g_CatalogMutex);
+		switch (st.type) {
+			case cmd_type::insertion:	runStInsertion(std::get<InsertionSt>(st.body), *sc.txn);		break;
+			case cmd_type::update:		runStUpdate(std::get<UpdateSt>(st.body), *sc.txn);				break;
+			case cmd_type::delfrom:		runStDeleteFrom(std::get<DeleteFromSt>(st.body), *sc.txn);		break;
+			case cmd_type::selection:
+				do {
+					stringstream ss;
+					evalSelection(std::get<SelectionSt>(st.body)).print(ss);
+					sc.output = ss.str();
+				} while (false);
+				break;
+			case cmd_type::innerjoin:
+				do {
+					stringstream ss;
+					evalInnerJoin(std::get<InnerJoinSt>(st.body)).print(ss);
+					sc.output = ss.str();
+				} while (false);
+				break;
+			default:					break;
+		}
+	}
+	catch (...) {
+		sc.error = std::current_exception();
+	}
+	g_Session = previous;
+	// 写者锁被占用：回滚已做的改动，重新排进线程池，或者交给正在等它的调度器
+	bool f_latchBusy = sc.error and sc.txn->isLatchBusy();
+	if (f_latchBusy) {
+		sc.error = nullptr;
+		sc.txn.reset(new Transaction);
+	}
+	// 持锁通知：发起者一看到f_Done就可能销毁调度器，通知不能晚于解锁
+	unique_lock<mutex> lock(done_mutex);
+	if (f_latchBusy and !sc.f_NoRequeue) {
+		lock.unlock();
+		std::this_thread::yield();
+		launch(sc);
+		return;
+	}
+	sc.f_Blocked = f_latchBusy;
+	sc.f_Done = true;
+	cv_done.notify_all();
+}
+void StatementScheduler::retireHead() {
+	ScheduledCommand& sc = *window.front();
+	bool f_blocked = false;
+	do {
+		unique_lock<mutex> lock(done_mutex);
+		sc.f_NoRequeue = true;
+		cv_done.wait(lock, [&sc]() { return sc.f_Done; });
+		f_blocked = sc.f_Blocked;
+	} while (false);
+	if (f_blocked) {
+		// 前面的语句都已提交，在本线程上带超时地等待写者锁
+		sc.f_Blocked = false;
+		sc.f_Done = false;
+		execute(sc);
+	}
 
-cmd_type judgeCmdType(vstring& params) {
+	const Statement& st = sc.cmd.st;
+	if (!g_Session->f_SilentLoggers) logRawCommand(sc.cmd);
+	if (sc.error) {
+		failed_tokens = sc.cmd.tokens;
+		std::rethrow_exception(sc.error);
+	}
+	if (st.type == cmd_type::selection or st.type == cmd_type::innerjoin) {
+		os << sc.output;
+		printSelectionSeparator(os);
+	}
+	if (!g_Session->f_SilentLoggers) logCommand(st);
+	if (isJournaled(st.type)) sc.txn->recordStatement(g_Session->database_name, joinStatement(sc.cmd.raw_params));
+	failed_tokens = sc.cmd.tokens;
+	sc.txn->commit();
+	failed_tokens = -1;
+
+	// 提交之后，后继语句才能看到这条语句写入的内容
+	for (ScheduledCommand* p_next : sc.dependents) {
+		if (--p_next->pending_deps == 0) launch(*p_next);
+	}
+	for (auto it = last_writers.begin(); it != last_writers.end(); ) {
+		if (it->second == &sc) it = last_writers.erase(it);
+		else ++it;
+	}
+	window.pop_front();
+}
+void StatementScheduler::drain() {
+	while (!window.empty()) retireHead();
+}
+void StatementScheduler::cancel() {
+	// 工作线程还在使用窗口中的语句，等它们都结束才能丢弃；未提交的事务析构时回滚
+	unique_lock<mutex> lock(done_mutex);
+	for (const auto& p_sc : window) {
+		ScheduledCommand& sc = *p_sc;
+		sc.f_NoRequeue = true;
+		if (sc.f_Launched) cv_done.wait(lock, [&sc]() { return sc.f_Done; });
+	}
+	lock.unlock();
+	window.clear();
+	last_writers.clear();
+}
+
+void produceCommands(StatementLexer& lexer, BoundedQueue<command_batch>& queue, const bool f_keepRaw) {
+	command_batch batch;
+	vtoken params;
+	while (true) {
+		ParsedCommand cmd;
+		ArenaScope scope;						// 解析用的临时参数列表在这条语句解析完后一并退回
+		try {
+			bool f_hasNext;
+			try {
+				f_hasNext = lexer.next(params);
+			}
+			catch (...) {
+				// 词法错误时这条语句还没有解析，行号计数器还停在上一条语句末尾。
+				// 先按已经切出的词法单元推进，再算上出错的字符串本身，报出的就是字符串所在的行
+				for (const Token& token : params) {
+					if (token.keyword() == keyword_index::newline) g_Session->ln_counter.newl();
+					else g_Session->ln_counter.increment();
+				}
+				g_Session->ln_counter.increment();
+				throw;
+			}
+			if (!f_hasNext) break;
+			if (f_keepRaw) cmd.raw_params = params;
+			if (params.size() != 0) cmd.st.type = judgeCmdType(params, cmd.st);
+			cmd.tokens = g_Session->ln_counter.tokens();
+		}
+		catch (...) {
+			// 解析错误交给执行线程，在它前面的语句都执行完之后再抛出；行号计数器就停在出错的位置
+			cmd.error = std::current_exception();
+			batch.push_back(std::move(cmd));
+			break;
+		}
+		batch.push_back(std::move(cmd));
+		if (batch.size() < g_PipelineBatch) continue;
+		if (!queue.push(std::move(batch))) break;		// 执行线程已经因出错而停止
+		batch = command_batch();
+	}
+	if (!batch.empty()) queue.push(std::move(batch));
+	queue.close();
+}
+
+cmd_type judgeCmdType(vtoken& params, Statement& st) {
 	eraseNewlFront(params);
 	if (params.size() == 0) return cmd_type::null;
-	g_LnCounter.increment();
+	g_Session->ln_counter.increment();
 	switch(getKeywordIndex(params.at(0))) {
 		case keyword_index::create:
 			params.erase(params.begin());		// 删去开头的"create"
-			return parseCreateStParams(params);
+			return parseCreateStParams(params, st);
 		case keyword_index::use:
 			params.erase(params.begin());		// 删去开头的"delete"
-			return parseUseStParams(params);
+			return parseUseStParams(params, st);
 		case keyword_index::drop:
 			params.erase(params.begin());		// 删去开头的"drop"
-			return parseDropStParams(params);
+			return parseDropStParams(params, st);
 		case keyword_index::insert:
 			params.erase(params.begin());		// 删去开头的"insert"
-			return parseInsertStParams(params);
+			return parseInsertStParams(params, st);
 		case keyword_index::select:
 			params.erase(params.begin());		// 删去开头的"select"
-			return parseSelectStParams(params);
+			return parseSelectStParams(params, st);
 		case keyword_index::update:
 			params.erase(params.begin());		// 删去开头的"update"
-			return parseUpdateParams(params);
+			return parseUpdateParams(params, st);
 		case keyword_index::_delete:
 			params.erase(params.begin());		// 删去开头的"delete"
-			return parseDeletionStParams(params);
+			return parseDeletionStParams(params, st);
+		case keyword_index::_export:
+			params.erase(params.begin());		// 删去开头的"export"
+			return parseExportStParams(params, st);
+		case keyword_index::begin:
+			params.erase(params.begin());		// 删去开头的"begin"
+			return parseTransactionStParams(params, cmd_type::txnbegin);
+		case keyword_index::commit:
+			params.erase(params.begin());		// 删去开头的"commit"
+			return parseTransactionStParams(params, cmd_type::txncommit);
+		case keyword_index::rollback:
+			params.erase(params.begin());		// 删去开头的"rollback"
+			return parseTransactionStParams(params, cmd_type::txnrollback);
+		case keyword_index::vacuum:
+			params.erase(params.begin());		// 删去开头的"vacuum"
+			return parseVacuumStParams(params, st);
 		default:
-			throw SyntaxError(i18n::parseKey("unexptstr",{params.at(0)}));
+			throw SyntaxError(i18n::parseKey(msg_id::unexptstr,{params.at(0)}));
 	}
 
 }
 
-void callCommand(vstring params, ostream& os) {
-	int size = params.size();
-	cmd_type cmd_type;
-	if (size == 0) {
-		cmd_type = cmd_type::null;
-	}
-	else cmd_type = judgeCmdType(params);
+void callCommand(ParsedCommand& cmd, ostream& os) {
+	ArenaScope scope;							// 同StatementScheduler::execute
+	Statement& st = cmd.st;
+	const cmd_type cmd_type = st.type;
+
+	// 事务控制语句不涉及任何表，无需加锁
 	switch (cmd_type) {
-		case cmd_type::createdb:
-			runStCreateDatabase(params);
-			#ifdef __DEBUG_ENVIRONMENT__
-				if (!gf_SilentLoggers) logCreateDatabase(params);
-			#endif
-			break;
-		case cmd_type::createtab:
-			runStCreateTable(params);
-			#ifdef __DEBUG_ENVIRONMENT__
-				if (!gf_SilentLoggers) logCreateTable(params);
-			#endif
-			break;
-		case cmd_type::usedb:
-			runStUseDatabase(params);
-			#ifdef __DEBUG_ENVIRONMENT__
-				if (!gf_SilentLoggers) logUseDatabase(params);
-			#endif
-			break;
-		case cmd_type::droptab:
-			runStDropTable(params);
-			#ifdef __DEBUG_ENVIRONMENT__
-				if (!gf_SilentLoggers) logDropTable(params);
-			#endif
-			break;
-		case cmd_type::insertion:
-			runStInsertion(params);
-			#ifdef __DEBUG_ENVIRONMENT__
-				if (!gf_SilentLoggers) logInsertion(params);
-			#endif
-			break;
-		case cmd_type::selection:		// 仅select ... (where)
-			runStSelection(params, os);
-			#ifdef __DEBUG_ENVIRONMENT__
-				if (!gf_SilentLoggers) logSelection(params);
-			#endif
-			break;
-		case cmd_type::innerjoin:		// 仅select ... inner join ...
-			runStInnerJoin(params, os);
-			#ifdef __DEBUG_ENVIRONMENT__
-				if (!gf_SilentLoggers) logInnerJoin(params);
-			#endif
-			break;
-		case cmd_type::update:
-			runStUpdate(params);
-			#ifdef __DEBUG_ENVIRONMENT__
-				if (!gf_SilentLoggers) logUpdate(params);
-			#endif
-			break;
-		case cmd_type::delfrom:
-			runStDeleteFrom(params);
-			#ifdef __DEBUG_ENVIRONMENT__
-				if (!gf_SilentLoggers) logDeleteFrom(params);
-			#endif
-			break;
-		case cmd_type::null:
-			#ifdef __DEBUG_ENVIRONMENT__
-				if (!gf_SilentLoggers) logNullStm();
-			#endif
+		case cmd_type::txnbegin:
+			beginTransaction();
+			if (!g_Session->f_SilentLoggers) logLazy(log_level::debug, logBegin);
+			return;
+		case cmd_type::txncommit:
+			commitTransaction();
+			if (!g_Session->f_SilentLoggers) logLazy(log_level::debug, logCommit);
+			return;
+		case cmd_type::txnrollback:
+			rollbackTransaction();
+			if (!g_Session->f_SilentLoggers) logLazy(log_level::debug, logRollback);
+			return;
+		default:
 			break;
 	}
+
+	// vacuum要重建表的行块，而事务的撤销日志指向原有的版本，因此不能在显式事务中执行
+	if (cmd_type == cmd_type::vacuum and g_Session->p_Transaction != nullptr) {
+		throw TransactionError(i18n::parseKey(msg_id::txnvacuum));
+	}
+	// 增删数据库或表的语句不能在事务中回滚，执行前先隐式提交正在进行的事务（同时释放它持有的写者锁）
+	if (isCatalogModifier(cmd_type) and g_Session->p_Transaction != nullptr) {
+		commitTransaction();
+	}
+	// 不在显式事务中时，语句自成一个事务，执行完毕立即提交；出错时autocommit析构，撤销已写入的内容
+	Transaction autocommit;
+	Transaction& txn = (g_Session->p_Transaction != nullptr ? *g_Session->p_Transaction : autocommit);
+
+	// 改动目录的语句独占目录锁，其余语句共享目录锁，再由各语句自行锁定所涉及的表。
+	// vacuum要重建表的字典，也独占目录锁，这样就没有其他语句正持有旧字典中的编码
+	// drop table、vacuum要等其他事务释放这张表，不能在独占目录锁时等待，否则该事务的下一条语句拿不到目录锁，双方互相等待
+	unique_lock<shared_mutex> catalog_wlock(g_CatalogMutex, std::defer_lock);
+	shared_lock<shared_mutex> catalog_rlock(g_CatalogMutex, std::defer_lock);
+	table_wlock table_lock;
+	if (cmd_type == cmd_type::droptab) table_lock = lockCatalogAndTable(catalog_wlock, std::get<DropTableSt>(st.body).table);
+	else if (cmd_type == cmd_type::vacuum) table_lock = lockCatalogAndTable(catalog_wlock, std::get<VacuumSt>(st.body).table);
+	else if (isCatalogModifier(cmd_type)) catalog_wlock.lock();
+	else catalog_rlock.lock();
+
+	switch (cmd_type) {
+		case cmd_type::createdb:	runStCreateDatabase(std::get<CreateDatabaseSt>(st.body));		break;
+		case cmd_type::createtab:	runStCreateTable(std::get<CreateTableSt>(st.body));			break;
+		case cmd_type::usedb:		runStUseDatabase(std::get<UseDatabaseSt>(st.body));			break;
+		case cmd_type::droptab:		runStDropTable(std::get<DropTableSt>(st.body), table_lock);	break;
+		case cmd_type::insertion:	runStInsertion(std::get<InsertionSt>(st.body), txn);		break;
+		case cmd_type::selection:	runStSelection(std::get<SelectionSt>(st.body), os);		break;	// 仅select ... (where)
+		case cmd_type::innerjoin:	runStInnerJoin(std::get<InnerJoinSt>(st.body), os);		break;	// 仅select ... inner join ...
+		case cmd_type::update:		runStUpdate(std::get<UpdateSt>(st.body), txn);				break;
+		case cmd_type::delfrom:		runStDeleteFrom(std::get<DeleteFromSt>(st.body), txn);		break;
+		case cmd_type::exportion:	runStExport(std::get<ExportSt>(st.body));					break;
+		case cmd_type::vacuum:		runStVacuum(std::get<VacuumSt>(st.body));					break;
+		default:					break;
+	}
+	if (!g_Session->f_SilentLoggers) logCommand(st);
+
+	if (isJournaled(cmd_type)) txn.recordStatement(g_Session->database_name, joinStatement(cmd.raw_params));
+	if (&txn == &autocommit) autocommit.commit();
+}
+
+void logCommand(const Statement& st) {
+	// 级别没有打开时logLazy直接返回，语句不会被格式化
+	logLazy(log_level::debug, [&st](ostream& os) {
+		switch (st.type) {
+			case cmd_type::createdb:	logCreateDatabase(std::get<CreateDatabaseSt>(st.body), os);	break;
+			case cmd_type::createtab:	logCreateTable(std::get<CreateTableSt>(st.body), os);		break;
+			case cmd_type::usedb:		logUseDatabase(std::get<UseDatabaseSt>(st.body), os);		break;
+			case cmd_type::droptab:		logDropTable(std::get<DropTableSt>(st.body), os);			break;
+			case cmd_type::insertion:	logInsertion(std::get<InsertionSt>(st.body), os);			break;
+			case cmd_type::selection:	logSelection(std::get<SelectionSt>(st.body), os);			break;
+			case cmd_type::innerjoin:	logInnerJoin(std::get<InnerJoinSt>(st.body), os);			break;
+			case cmd_type::update:		logUpdate(std::get<UpdateSt>(st.body), os);					break;
+			case cmd_type::delfrom:		logDeleteFrom(std::get<DeleteFromSt>(st.body), os);			break;
+			case cmd_type::exportion:	logExport(std::get<ExportSt>(st.body), os);					break;
+			case cmd_type::vacuum:		logVacuum(std::get<VacuumSt>(st.body), os);					break;
+			case cmd_type::null:		logNullStm(os);												break;
+			default:					break;
+		}
+	});
+}
+void logRawCommand(const ParsedCommand& cmd) {
+	logLazy(log_level::debug, [&cmd](ostream& os) {
+		os << endl << i18n::parseKey(msg_id::h_debug_rawcmd);
+		for (const Token& str : cmd.raw_params) {
+			os << str << ' ';
+		}
+		os << endl;
+	});
+}
+
+bool isCatalogModifier(const cmd_type type) {
+	return (	type == cmd_type::createdb
+			or	type == cmd_type::createtab
+			or	type == cmd_type::droptab
+			);
+}
+bool collectResources(const Statement& st, vstring& reads, vstring& writes) {
+	switch (st.type) {
+		case cmd_type::insertion:	writes.push_back(std::get<InsertionSt>(st.body).table);		return true;
+		case cmd_type::update:		writes.push_back(std::get<UpdateSt>(st.body).table);		return true;
+		case cmd_type::delfrom:		writes.push_back(std::get<DeleteFromSt>(st.body).table);	return true;
+		case cmd_type::selection:	reads.push_back(std::get<SelectionSt>(st.body).table);		return true;
+		case cmd_type::innerjoin:
+			reads.push_back(std::get<InnerJoinSt>(st.body).table_first);
+			reads.push_back(std::get<InnerJoinSt>(st.body).table_second);
+			return true;
+		case cmd_type::null:		return true;
+		default:					return false;
+	}
+}
+bool isJournaled(const cmd_type type) {
+	return (	isCatalogModifier(type)
+			or	type == cmd_type::insertion
+			or	type == cmd_type::update
+			or	type == cmd_type::delfrom
+			);
+}
+
+void beginTransaction() {
+	if (g_Session->p_Transaction != nullptr) throw TransactionError(i18n::parseKey(msg_id::txnnested));
+	g_Session->p_Transaction = new Transaction(true);
+}
+void commitTransaction() {
+	if (g_Session->p_Transaction == nullptr) throw TransactionError(i18n::parseKey(msg_id::notxn));
+	// 先从会话上摘下来，提交失败时事务随txn析构而回滚
+	std::unique_ptr<Transaction> txn(g_Session->p_Transaction);
+	g_Session->p_Transaction = nullptr;
+	txn->commit();
+}
+void rollbackTransaction() {
+	if (g_Session->p_Transaction == nullptr) throw TransactionError(i18n::parseKey(msg_id::notxn));
+	abandonTransaction();
+}
+bool abandonTransaction() {
+	if (g_Session->p_Transaction == nullptr) return false;
+	delete g_Session->p_Transaction;			// 析构时回滚
+	g_Session->p_Transaction = nullptr;
+	return true;
 }
 
 // 以下内容仅在定义了宏__STORE_MINIDB_H__时生效
@@ -172,17 +592,19 @@ void storeLegacyDatabases() {
 	ofstream ofile;
 	ofile.open(legacy_file_name, ios::out);
 	if (!ofile.is_open()) {
-		throw FailedFileOperation(i18n::parseKey("openlegfilef", {legacy_file_name}));
+		throw FailedFileOperation(i18n::parseKey(msg_id::openlegfilef, {legacy_file_name}));
 	}
-	for (pair<string, Database> p_database : g_Databases) {
-		ofile << "create database " << p_database.first << ';' << endl;
-		ofile << "use database " << p_database.first << ';' << endl;
-		for (pstable p_table : p_database.second.getRaw()) {
-			ofile << "create table " << p_table.first << " ( ";
+	// 所有表使用同一个快照，保存的是某一时刻一致的内容
+	SnapshotGuard guard;
+	forEachDatabase([&](const string& database_name, Database& database) {
+		ofile << "create database " << database_name << ';' << endl;
+		ofile << "use database " << database_name << ';' << endl;
+		database.forEachTable([&](const string& table_name, const Table& table) {
+			ofile << "create table " << table_name << " ( ";
 
 			// 处理标题行
 			bool f_isFirst = true;
-			for (psterm title : p_table.second.getTitle().getRaw()) {
+			for (const psterm& title : table.getTitle().getRaw()) {
 				if (f_isFirst) f_isFirst = false;
 				else ofile << " , ";
 				ofile << title.first << ' ' << title.second.getType();
@@ -190,18 +612,30 @@ void storeLegacyDatabases() {
 			ofile << " );" << endl;
 
 			// 处理其他行
-			for (Row r : p_table.second.getRaw()) {
-				ofile << "insert into " << p_table.first << " values ( ";
+			table.scan(guard.get(), [&](const Row& r) {
+				ofile << "insert into " << table_name << " values ( ";
 				bool f_isFirst = true;
-				for (psterm p_term : r.getRaw()) {
+				for (const psterm& p_term : r.getRaw()) {
 					if (f_isFirst) f_isFirst = false;
 					else ofile << " , ";
 					p_term.second.print(ofile);
 				}
 				ofile << " );" << endl;
-			}
-		}
+			});
+		});
+	});
+}
+
+void openLegacyJournal() {
+	g_Journal.rdbuf()->pubsetbuf(g_JournalBuffer, g_JournalBufferSize);	// 必须在打开文件之前设置
+	g_Journal.open(legacy_file_name, ios::out | ios::app);
+	if (!g_Journal.is_open()) {
+		throw FailedFileOperation(i18n::parseKey(msg_id::openlegfilef, {legacy_file_name}));
 	}
+	g_JournalDatabase = "";
+}
+void closeLegacyJournal() {
+	if (g_Journal.is_open()) g_Journal.close();
 }
 
 void readLegacyDatabases() {
@@ -212,33 +646,34 @@ void readLegacyDatabases() {
 		ofstream otemp;
 		otemp.open(legacy_file_name, ios::trunc);		// 这是为了创建一个空文件
 		if (!otemp.is_open()) {					// 文件都创建不了再报错
-			throw FailedFileOperation(i18n::parseKey("openlegfilef", {legacy_file_name}));
+			throw FailedFileOperation(i18n::parseKey(msg_id::openlegfilef, {legacy_file_name}));
 		}
 		otemp.close();
 		ifile.open(legacy_file_name, ios::in);
 		if (!ifile.is_open()) {
-			throw FailedFileOperation(i18n::parseKey("openlegfilef", {legacy_file_name}));
+			throw FailedFileOperation(i18n::parseKey(msg_id::openlegfilef, {legacy_file_name}));
 		}
 	}
+	ifile.close();
+	MappedFile legacy(legacy_file_name);
 
 	// 生成的历史查询记录不人为修改一定无误，这里懒得做try-catch了，直接读就完事了
 	ofstream ofile;
 	ofile.open(legacy_tmp_file_name, ios::out);
 	if (!ofile.is_open()) {
-		throw FailedFileOperation(i18n::parseKey("opentmpf", {legacy_tmp_file_name}));
+		throw FailedFileOperation(i18n::parseKey(msg_id::opentmpf, {legacy_tmp_file_name}));
 	}
 
-	gf_SilentLoggers = true;			// 让loggers闭嘴
-	parseCommand(ifile, ofile);		// 复用parser加载历史内容
-	gf_SilentLoggers = false;			// 让loggers恢复正常
+	g_Session->f_SilentLoggers = true;			// 让loggers闭嘴
+	parseCommand(legacy, ofile);		// 复用parser加载历史内容
+	g_Session->f_SilentLoggers = false;			// 让loggers恢复正常
 
-	ifile.close();
 	ofile.close();
 
 	// 最后还要清除计数器，因为这个计数器是全局的，在上一步的加载中已经产生了内容，不清理掉会影响本次解析行号的正确性。
-	g_LnCounter.clearAll();
+	g_Session->ln_counter.clearAll();
 	// 还有当前使用的database也要清除
-	g_CurrentDatabaseName = "";
+	g_Session->database_name = "";
 }
 
 // 其实我想给legacy.sql上一层带校验的加密，这样可以使其被人为变更时不一定能解出合理的内容。
@@ -6,6 +6,7 @@
 #define __ENTRY_MINIDB_H__
 
 #include "commands.h"
+#include "server.h"
 
 namespace minidb {
 
@@ -14,7 +15,7 @@ void deleteTempFiles();							// 清除程序中使用的临时文件。
 return_status __Entry(int argc, char**& argv) {
 
 	return_status status = return_status::success;
-	ifstream ifile;
+	std::unique_ptr<MappedFile> ifile;
 	ofstream ofile;
 	bool f_UnacceptableCmdl = false;
 	bool f_hasParsedCommand = false;
@@ -25,75 +26,101 @@ return_status __Entry(int argc, char**& argv) {
 	
 	try {
 
+		// -log总是位于命令行的最后（在-lang之后），设置控制台日志的级别
+		if (argc >= 3 and argv[argc-2] == string("-log")) {
+			log_level level;
+			if (parseLogLevel(argv[argc-1], level)) getLogger().setLevel(level);
+			else f_UnacceptableCmdl = true;
+			argc -= 2;
+		}
+
+		// -sortmem位于-log之前，设置排序（如排序合并连接）的内存预算，单位MiB，超出预算的部分溢出到临时文件（见extsort.h）
+		if (argc >= 3 and argv[argc-2] == string("-sortmem")) {
+			if (!parseSortMemory(argv[argc-1], g_SortMemoryBudget)) f_UnacceptableCmdl = true;
+			argc -= 2;
+		}
+
 		#ifdef __ENABLE_I18N__
-			if (argc == 5) {
-				if (argv[3] == string("-lang")) {
-					g_LangCode = argv[4];
-					argc = 3;
-				}
-				else {
-					f_UnacceptableCmdl = true;
-				}
+			// -lang位于-sortmem和-log之前，即命令行结尾的顺序为“ [-lang x] [-sortmem N] [-log L] ”
+			if (argc >= 3 and argv[argc-2] == string("-lang")) {
+				g_LangCode = argv[argc-1];
+				argc -= 2;
+			}
+			else if (argc == 5 and string(argv[1]) != "-client") {
+				f_UnacceptableCmdl = true;
 			}
 		#endif
 
 		i18n::readKvPairs();
 
-		if (argc != 3) {
-			f_UnacceptableCmdl = true;
+		logLine(log_level::info, i18n::parseKey(msg_id::welcome, {i18n::parseKey(msg_id::authn).str()}).str());
+
+		// 结尾参数的取值不合法时，无论哪种模式都不予执行
+		if (f_UnacceptableCmdl) {
+			throw ArgumentCountError(2,argc-1,i18n::parseKey(msg_id::unacptcmdl));
 		}
 
-		clog << endl << i18n::parseKey("welcome", {i18n::parseKey("authn").str()}) << endl;
+		// 服务器、客户端模式另行处理
+		if (argc >= 2 and (argv[1] == string("-server") or argv[1] == string("-client") or argv[1] == string("-stop"))) {
+			status = runSocketMode(argc, argv);
+			if (argv[1] == string("-server")) deleteTempFiles();
+			logLine(log_level::info, i18n::parseKey(msg_id::exitstatus, {itos(static_cast<int>(status))}).str());
+			return status;
+		}
 
-		if (f_UnacceptableCmdl) {
-			throw ArgumentCountError(2,argc-1,i18n::parseKey("unacptcmdl"));
+		if (argc != 3) {
+			throw ArgumentCountError(2,argc-1,i18n::parseKey(msg_id::unacptcmdl));
 		}
 
 		#ifdef __STORE_LEGACY__
 			readLegacyDatabases();
-			clog << endl << i18n::parseKey("readlegfsuc") << endl;
+			openLegacyJournal();
+			logLine(log_level::info, i18n::parseKey(msg_id::readlegfsuc).str());
 		#endif
 		
-		ifile.open(argv[1], ios::in);
 		ofile.open(argv[2], ios::out);
+		ifile.reset(new MappedFile(argv[1]));		// 打不开时抛出异常
 
-		if (!ifile.is_open()) {
-			throw FailedFileOperation(i18n::parseKey("openifilef",{argv[1]}));
-		}
 		if (!ofile.is_open()) {
-			throw FailedFileOperation(i18n::parseKey("openofilef",{argv[2]}));
+			throw FailedFileOperation(i18n::parseKey(msg_id::openofilef,{argv[2]}));
 		}
 
 		f_hasParsedCommand = true;
-		parseCommand(ifile, ofile);
+		g_VersionCollector.start();
+		parseCommand(*ifile, ofile);
+		g_VersionCollector.stop();
 
-		clog << endl << i18n::parseKey("atc") << endl;
+		logLine(log_level::info, i18n::parseKey(msg_id::atc).str());
 	}
 	catch (MiniDBExceptionBase& e) {
-		cerr << endl << e.what() << g_LnCounter.where() << endl;
+		logLine(log_level::error, e.what() + g_Session->ln_counter.where());
 		status = e.status();
 	} catch (exception& e) {
-		cerr << endl << i18n::parseKey("unexpectederr", {e.what()}) << g_LnCounter.where() << endl;
+		logLine(log_level::error, i18n::parseKey(msg_id::unexpectederr, {e.what()}).str() + g_Session->ln_counter.where());
 		status = return_status::unexpt;
 	}
-	ifile.close();
+	ifile.reset();
 	ofile.close();
 
+	g_VersionCollector.stop();
+
 	if (f_hasParsedCommand) {
 
-		#ifdef __DEBUG_ENVIRONMENT__
-			clog << endl << i18n::parseKey("h_dataexh") << endl;
-			for (pair<string, Database> p_database : g_Databases) {
-				clog << endl << "Database \"" << p_database.first << "\":" << endl;
-				for (pstable p_table : p_database.second.getRaw()) {
-					clog << endl << "Table \"" << p_table.first << "\" details:" << endl;
-					p_table.second.print(clog);
-				}
-			}
-			clog << endl << i18n::parseKey("h_dataexhend") << endl;
-		#endif
+		// 退出前输出所有数据，作为一条debug级别的日志
+		logLazy(log_level::debug, [](ostream& os) {
+			os << endl << i18n::parseKey(msg_id::h_dataexh) << endl;
+			forEachDatabase([&os](const string& database_name, Database& database) {
+				os << endl << "Database \"" << database_name << "\":" << endl;
+				database.forEachTable([&os](const string& table_name, const Table& table) {
+					os << endl << "Table \"" << table_name << "\" details:" << endl;
+					table.print(os);
+				});
+			});
+			os << endl << i18n::parseKey(msg_id::h_dataexhend) << endl;
+		});
 
 		#ifdef __STORE_LEGACY__
+			closeLegacyJournal();
 			storeLegacyDatabases();
 		#endif
 
@@ -101,25 +128,22 @@ return_status __Entry(int argc, char**& argv) {
 
 	}
 
-	clog << endl << i18n::parseKey("exitstatus", {itos(static_cast<int>(status))}) << endl;
+	logLine(log_level::info, i18n::parseKey(msg_id::exitstatus, {itos(static_cast<int>(status))}).str());
 
 	return status;
 }
 
 
 // 删除临时文件
-// 这个文件是在standardizeInputFile时被创建的，在程序结束时应被删除。
+// 一个是在读取历史数据时被创建的，另外还有排序时溢出到磁盘、尚未删除的文件及其所在的临时目录，在程序结束时都应被删除。
 void deleteTempFiles() {
-	vstring file_names = {g_TempFileName, legacy_tmp_file_name};
+	vstring file_names = {legacy_tmp_file_name};
+	for (const string& str : g_SpillRegistry.takeAll()) file_names.push_back(str);
 	for (string str : file_names) {
 		if (str == "") continue;
 		auto delete_status = remove(str.c_str());
-		#ifdef __DEBUG_ENVIRONMENT__
-			if (delete_status != 0) {
-				clog << endl << i18n::parseKey("gcrmtmpf",{str}) << endl;
-			}
-			else clog << endl << i18n::parseKey("gcrmtmps",{str}) << endl;
-		#endif
+		if (delete_status != 0) logLine(log_level::debug, i18n::parseKey(msg_id::gcrmtmpf,{str}).str());
+		else logLine(log_level::debug, i18n::parseKey(msg_id::gcrmtmps,{str}).str());
 	}
 }
 
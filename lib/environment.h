@@ -6,16 +6,37 @@
 #define __ENVIRONMENT_MINIDB_H__
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <queue>
 #include <stack>
 #include <map>
+#include <unordered_map>
+#include <set>
+#include <deque>
+#include <algorithm>
+#include <variant>
 #include <fstream>
 #include <exception>
 #include <iostream>
 #include <iomanip>
 #include <sstream>
 #include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+
+// 需要C++17。服务器模式用到了多线程，编译时请加上-pthread。
 
 // 个人偏好，从Java借鉴了以extends表示继承的写法。我觉得这样一个有意义的单词更容易看懂一些。
 #define extends :
@@ -27,6 +48,7 @@ using std::queue;
 using std::stack;
 using std::string;		// 话说这个算容器吗……？
 using std::map;
+using std::unordered_map;
 using std::pair;
 
 // 异常
@@ -52,6 +74,19 @@ using std::endl;
 using std::noskipws;
 using std::to_string;
 using std::fmod;
+using std::to_chars;
+
+// 并发
+using std::shared_mutex;
+using std::string_view;
+using std::shared_lock;
+using std::unique_lock;
+using std::lock_guard;
+using std::mutex;
+using std::thread;
+using std::atomic;
+using std::condition_variable;
+using std::function;
 
 // 整个Project大量使用了字符串数组，因此特别将这个过分长的类型名typedef成比较短的形式
 typedef vector<string> vstring;
@@ -64,7 +99,9 @@ const double g_DoubleEqCritDelta = 1e-6;
  * 
  * 1. __DEBUG_ENVIRONMENT__ 
  * 		控制程序是否处在调试环境下。发布时默认关闭。
- * 		调试环境下额外会打开控制台log。不过，任何情况下都会将警告和错误信息输出到控制台。
+ * 		调试环境下控制台日志的默认级别为debug，会输出每条语句的调试信息；否则默认为info。
+ * 		级别也可以在运行时用命令行结尾的“ -log xxx ”指定，xxx为error、warn、info、debug、trace之一（见asynclog.h）。
+ * 		不过，除非指定为error，任何情况下都会将警告和错误信息输出到控制台。
  * 
  * 2. __ENABLE_I18N__
  * 		控制程序是否允许国际化功能。发布时默认关闭。
@@ -83,11 +120,16 @@ const double g_DoubleEqCritDelta = 1e-6;
  * 4. __PRINT_FINAL_SEPARATOR__
  * 		控制程序在最后一个select语句后是否要加分隔用的横线。
  * 		默认不加，因为加了实在是看着很蠢。但是输出样例要求要加，那我只好顺从他。
+ * 
+ * 5. __ENABLE_TRACE__
+ * 		控制是否编译逐行输出的trace日志（如每一行是否满足where子句）。默认关闭。
+ * 		关闭时这些日志连同级别判断一起不会出现在程序中；打开后还需要用“ -log trace ”才会真正输出。
  */
 
-#define __DEBUG_ENVIRONMENT__
+// #define __DEBUG_ENVIRONMENT__
 // #define __ENABLE_I18N__
 #define __STORE_LEGACY__
 #define __PRINT_FINAL_SEPARATOR__
+// #define __ENABLE_TRACE__
 
 #endif
\ No newline at end of file
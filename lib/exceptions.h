@@ -9,8 +9,6 @@
 
 namespace minidb {
 
-const string g_TempFileName = "std.temp";
-
 const int g_ArgCntMax = INT32_MAX;	// 仅仅是一个形式上的作用。实际上懒得限制最大参数个数。
 
 class ArgumentCountError extends public MiniDBExceptionBase {
@@ -21,9 +19,9 @@ class ArgumentCountError extends public MiniDBExceptionBase {
 		ArgumentCountError(const int e, const int r, const i18nstring s = ""):expt(e),recv(r) { msg = s; };
 		virtual const string what() const override {
 			stringstream ss;
-			ss << i18n::parseKey("argscerr",{msg.str(),(expt<recv?i18n::parseKey("much").str():i18n::parseKey("less").str()),itos(expt)});
-			if (recv != g_ArgCntMax) ss << i18n::parseKey("argscerr_r",{itos(recv)});
-			ss << i18n::parseKey("argscerr_e");
+			ss << i18n::parseKey(msg_id::argscerr,{msg.str(),(expt<recv?i18n::parseKey(msg_id::much).str():i18n::parseKey(msg_id::less).str()),itos(expt)});
+			if (recv != g_ArgCntMax) ss << i18n::parseKey(msg_id::argscerr_r,{itos(recv)});
+			ss << i18n::parseKey(msg_id::argscerr_e);
 			return ss.str().c_str();
 		}
 		virtual return_status status() const override { return return_status::argscerr; }
@@ -31,22 +29,28 @@ class ArgumentCountError extends public MiniDBExceptionBase {
 class InvalidArgument extends public MiniDBExceptionBase {
 	public:
 		InvalidArgument(const i18nstring s = "") { msg = s; };
-		virtual const string what() const override { return i18n::parseKey("invalidarg",{msg.str()}).str().c_str(); }
+		virtual const string what() const override { return i18n::parseKey(msg_id::invalidarg,{msg.str()}).str().c_str(); }
 		virtual return_status status() const override { return return_status::invarg; }
 };
 class SyntaxError extends public MiniDBExceptionBase {
 	public:
 		SyntaxError(const i18nstring s = "") { msg = s; };
-		virtual const string what() const override { return i18n::parseKey("syntaxerr",{msg.str()}).str().c_str(); } 
+		virtual const string what() const override { return i18n::parseKey(msg_id::syntaxerr,{msg.str()}).str().c_str(); } 
 		virtual return_status status() const override { return return_status::syntaxerr; }
 
 };
 class FailedFileOperation extends public MiniDBExceptionBase {
 	public:
 		FailedFileOperation(const i18nstring s = "") { msg = s; };
-		virtual const string what() const override { return i18n::parseKey("ferr",{msg.str()}).str().c_str(); }
+		virtual const string what() const override { return i18n::parseKey(msg_id::ferr,{msg.str()}).str().c_str(); }
 		virtual return_status status() const override { return return_status::ferr; }
 };
+class TransactionError extends public MiniDBExceptionBase {
+	public:
+		TransactionError(const i18nstring s = "") { msg = s; };
+		virtual const string what() const override { return i18n::parseKey(msg_id::txnerr,{msg.str()}).str().c_str(); }
+		virtual return_status status() const override { return return_status::txnerr; }
+};
 
 ostream& operator<< (ostream& os, return_status rs) {
 	return os << static_cast<int>(rs);
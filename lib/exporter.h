@@ -0,0 +1,251 @@
+/**
+ * 头文件：exporter.h
+ * 将表导出为CSV文件或二进制文件。
+ * 导出不经过ostream：所有内容先写入一块较大的缓冲区，攒满一块再整块写入文件，数字用to_chars格式化。
+ */
+#ifndef __EXPORTER_MINIDB_H__
+#define __EXPORTER_MINIDB_H__
+
+#include "objects.h"
+
+namespace minidb {
+
+const size_t g_ExportBlockSize = 1 << 20;		// 导出缓冲块大小，1 MiB
+
+/**
+ * 二进制导出格式（所有整数均为小端序）：
+ * 		文件头		8字节魔数"MDBEXP01"
+ * 		列数		u32
+ * 		每列		u8类型（0 integer，1 float，2 text） + u32列名长度 + 列名
+ * 		行数		u64
+ * 		每行每列	integer为i64，float为IEEE 754的f64，text为u32长度 + 内容（不含单引号）
+ */
+const char g_BinaryExportMagic[8] = {'M', 'D', 'B', 'E', 'X', 'P', '0', '1'};
+
+enum class export_format {
+	csv,
+	binary
+};
+
+// 块缓冲写入器
+// 自己管理缓冲区，绕开stdio的缓冲（setvbuf为_IONBF），每次只向文件整块写入。
+class BlockWriter {
+	private:
+		std::FILE* file;
+		string path;
+		vector<char> buffer;
+		size_t used;
+		void reserve(const size_t);
+	public:
+		BlockWriter(const string, const size_t = g_ExportBlockSize);
+		~BlockWriter();
+		BlockWriter(const BlockWriter&) = delete;
+		BlockWriter& operator= (const BlockWriter&) = delete;
+		void put(const char);
+		void put(const char*, const size_t);
+		void put(const string& s) { put(s.data(), s.size()); }
+		void putInt(const long long);
+		void putFixed(const double, const int);
+		void putLE(const uint64_t, const int);
+		void flush();
+		void close();
+};
+
+export_format parseExportFormat(const string);					// 将格式名转换为export_format
+void exportTable(const Table&, const string, const export_format, const version_t);	// 将表导出至指定路径
+void writeCsvTable(const Table&, const Snapshot&, BlockWriter&);
+void writeBinaryTable(const Table&, const Snapshot&, BlockWriter&);
+uint8_t getBinaryTypeTag(const Term&);
+
+
+
+// 函数体定义全部写在下方
+
+BlockWriter::BlockWriter(const string p, const size_t block_size):path(p),buffer(block_size),used(0) {
+	file = std::fopen(path.c_str(), "wb");
+	if (file == nullptr) {
+		throw FailedFileOperation(i18n::parseKey(msg_id::openexpfilef, {path}));
+	}
+	std::setvbuf(file, nullptr, _IONBF, 0);
+}
+BlockWriter::~BlockWriter() {
+	// 析构时不能再抛异常，写入失败只能作罢。正常流程应当显式调用close()。
+	if (file == nullptr) return;
+	if (used != 0) std::fwrite(buffer.data(), 1, used, file);
+	std::fclose(file);
+}
+void BlockWriter::reserve(const size_t n) {
+	if (used + n > buffer.size()) flush();
+}
+void BlockWriter::put(const char ch) {
+	reserve(1);
+	buffer[used++] = ch;
+}
+void BlockWriter::put(const char* s, const size_t n) {
+	if (n >= buffer.size()) {
+		// 比整块还大的内容直接写出，不再经过缓冲区
+		flush();
+		if (std::fwrite(s, 1, n, file) != n) {
+			throw FailedFileOperation(i18n::parseKey(msg_id::writeexpfilef, {path}));
+		}
+		return;
+	}
+	reserve(n);
+	std::memcpy(buffer.data() + used, s, n);
+	used += n;
+}
+void BlockWriter::putInt(const long long i) {
+	reserve(24);
+	auto res = to_chars(buffer.data() + used, buffer.data() + buffer.size(), i);
+	used = res.ptr - buffer.data();
+}
+void BlockWriter::putFixed(const double d, const int precision) {
+	// 定点格式的长度取决于数值大小，先在栈上格式化
+	char temp[512];
+	auto res = to_chars(temp, temp + sizeof(temp), d, std::chars_format::fixed, precision);
+	put(temp, res.ptr - temp);
+}
+void BlockWriter::putLE(const uint64_t value, const int bytes) {
+	reserve(bytes);
+	for (int i = 0; i < bytes; ++i) {
+		buffer[used++] = static_cast<char>((value >> (8 * i)) & 0xFF);
+	}
+}
+void BlockWriter::flush() {
+	if (used == 0) return;
+	if (std::fwrite(buffer.data(), 1, used, file) != used) {
+		throw FailedFileOperation(i18n::parseKey(msg_id::writeexpfilef, {path}));
+	}
+	used = 0;
+}
+void BlockWriter::close() {
+	flush();
+	std::FILE* f = file;
+	file = nullptr;
+	if (std::fclose(f) != 0) {
+		throw FailedFileOperation(i18n::parseKey(msg_id::writeexpfilef, {path}));
+	}
+}
+
+export_format parseExportFormat(const string str) {
+	if (keywords::csv == str) return export_format::csv;
+	if (keywords::binary == str) return export_format::binary;
+	throw InvalidArgument(i18n::parseKey(msg_id::unacptfmt, {str}));
+}
+
+void exportTable(const Table& table, const string path, const export_format format, const version_t owner = 0) {
+	// 整个导出过程使用同一个快照，导出期间的写入不会混进来，也不需要锁表
+	SnapshotGuard guard(owner);
+	BlockWriter writer(path);
+	switch (format) {
+		case export_format::csv:		writeCsvTable(table, guard.get(), writer);		break;
+		case export_format::binary:		writeBinaryTable(table, guard.get(), writer);	break;
+	}
+	writer.close();
+}
+
+// CSV遵循RFC 4180：文本中出现逗号、双引号或换行时整体加双引号，内部双引号写两次。
+void writeCsvTable(const Table& table, const Snapshot& snap, BlockWriter& writer) {
+	bool f_isFirst = true;
+	for (const psterm& p_term : table.getTitle().getRaw()) {
+		if (f_isFirst) f_isFirst = false;
+		else writer.put(',');
+		writer.put(p_term.first);
+	}
+	writer.put('\n');
+
+	table.scan(snap, [&writer](const Row& row) {
+		bool f_isFirst = true;
+		for (const psterm& p_term : row.getRaw()) {
+			if (f_isFirst) f_isFirst = false;
+			else writer.put(',');
+
+			const Term& term = p_term.second;
+			const string& value = term.getValue();
+			const string& type = term.getType();
+			if (type == keywords::integer) {
+				writer.putInt(stringToInt(value));
+			}
+			else if (type == keywords::_float) {
+				writer.putFixed(stringToDouble(value), 2);
+			}
+			else {
+				// 直接在原字符串上取去掉单引号后的区间，不构造子串
+				const char* begin = value.data();
+				size_t len = value.size();
+				if (len >= 2) {
+					++begin;
+					len -= 2;
+				}
+				bool f_needsQuote = false;
+				for (size_t i = 0; i < len; ++i) {
+					if (begin[i] == ',' or begin[i] == '"' or begin[i] == '\n') {
+						f_needsQuote = true;
+						break;
+					}
+				}
+				if (!f_needsQuote) {
+					writer.put(begin, len);
+					continue;
+				}
+				writer.put('"');
+				for (size_t i = 0; i < len; ++i) {
+					if (begin[i] == '"') writer.put('"');
+					writer.put(begin[i]);
+				}
+				writer.put('"');
+			}
+		}
+		writer.put('\n');
+	});
+}
+
+void writeBinaryTable(const Table& table, const Snapshot& snap, BlockWriter& writer) {
+	const vector<psterm>& title = table.getTitle().getRaw();
+	writer.put(g_BinaryExportMagic, sizeof(g_BinaryExportMagic));
+	writer.putLE(title.size(), 4);
+	for (const psterm& p_term : title) {
+		writer.putLE(getBinaryTypeTag(p_term.second), 1);
+		writer.putLE(p_term.first.size(), 4);
+		writer.put(p_term.first);
+	}
+
+	// 行数写在行数据之前，先按同一快照数一遍
+	writer.putLE(table.countRows(snap), 8);
+	table.scan(snap, [&writer](const Row& row) {
+		for (const psterm& p_term : row.getRaw()) {
+			const Term& term = p_term.second;
+			const string& value = term.getValue();
+			switch (getBinaryTypeTag(term)) {
+				case 0:
+					writer.putLE(static_cast<uint64_t>(static_cast<int64_t>(stringToInt(value))), 8);
+					break;
+				case 1:
+					do {
+						double d = stringToDouble(value);
+						uint64_t bits;
+						std::memcpy(&bits, &d, sizeof(bits));
+						writer.putLE(bits, 8);
+					} while (false);
+					break;
+				default:
+					do {
+						size_t len = value.size() >= 2 ? value.size() - 2 : 0;
+						writer.putLE(len, 4);
+						writer.put(value.data() + (len == 0 ? 0 : 1), len);
+					} while (false);
+					break;
+			}
+		}
+	});
+}
+
+uint8_t getBinaryTypeTag(const Term& term) {
+	if (term.getType() == keywords::integer) return 0;
+	if (term.getType() == keywords::_float) return 1;
+	return 2;
+}
+
+}
+
+#endif
\ No newline at end of file
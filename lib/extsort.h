@@ -0,0 +1,320 @@
+/**
+ * 头文件：extsort.h
+ * 外部归并排序。
+ *
+ * 要排序的记录先攒在内存里，攒满内存预算就排好序，作为一个“顺串”整块写进临时文件（溢出），然后清空接着攒；
+ * 全部放入之后，用败者树对所有顺串做k路归并，按顺序逐条取出。顺串多于g_SortMaxFanIn个时先分几趟归并成较少的顺串，
+ * 这样同时打开的文件数、每个顺串的读缓冲都有上限，整个排序占用的内存始终在预算之内。
+ * 记录总量不超过预算时不写任何文件，就是一次内存中的排序；放入的顺序本来就有序时连这次排序也省掉。
+ *
+ * 记录按字节原样写入文件，必须是可以平凡复制的类型。记录中可以保存指针（例如指向钉住的行），因为文件只在这一次排序之内有效。
+ * 溢出文件放在本进程的临时目录中（$TMPDIR或/tmp下的minidb-<进程号>，第一次溢出时建立），排序器析构时删除；
+ * 来不及删除的（例如程序被异常打断），以及临时目录本身，在程序退出时由deleteTempFiles统一清理。
+ * 内存预算由命令行参数-sortmem设置（单位MiB，见entry.h），每个排序器分别计算。
+ */
+#ifndef __EXTSORT_MINIDB_H__
+#define __EXTSORT_MINIDB_H__
+
+#include "auxiliaries.h"
+
+#include <type_traits>
+#include <cstdlib>
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace minidb {
+
+const size_t g_DefaultSortMemoryMiB = 64;		// 默认的内存预算
+const size_t g_SortMaxFanIn = 64;				// 一趟归并最多合并的顺串数
+
+size_t g_SortMemoryBudget = g_DefaultSortMemoryMiB << 20;	// 每个排序器的内存预算（字节），启动时设置一次
+
+// 溢出文件的登记表：记下本进程建立的临时目录和其中尚未删除的文件
+class SpillRegistry {
+	private:
+		mutex registry_mutex;
+		string directory;						// 还没有建立时为空
+		size_t counter;
+		std::set<string> files;
+	public:
+		SpillRegistry():counter(0){}
+		string create();						// 登记一个新的溢出文件名（必要时先建立临时目录）
+		void release(const string&);			// 删除并注销
+		vstring takeAll();						// 取出所有尚未删除的文件，最后是临时目录本身，登记表随之清空
+};
+
+SpillRegistry g_SpillRegistry;
+
+// 一个已经写出的顺串
+struct SortedRun {
+	string path;
+	size_t count;								// 记录条数
+};
+
+// 顺串的顺序读取器，每次从文件读入一批记录
+template <typename T> class RunReader {
+	private:
+		std::ifstream file;
+		string path;
+		vector<T> buffer;
+		size_t position;						// 下一条记录在缓冲中的位置
+		size_t remaining;						// 文件中尚未读入的记录数
+		void refill();
+	public:
+		RunReader(const SortedRun&, const size_t);	// 第二个参数为每批读入的记录数
+		bool isExhausted() const { return position == buffer.size() and remaining == 0; }
+		const T& head() const { return buffer[position]; }
+		void pop();
+};
+
+// 败者树：k个有序输入，每取出一条记录只需沿一条路径比较log k次
+// 叶结点k..2k-1对应各输入，内部结点1..k-1记下在该结点比输的输入，tree[0]是总的胜者；已经读完的输入比任何输入都大
+template <typename T, typename Less> class LoserTree {
+	private:
+		vector<std::unique_ptr<RunReader<T>>> inputs;
+		vector<size_t> tree;
+		Less less;
+		bool beats(const size_t, const size_t) const;	// 前者是否排在后者之前，相等时序号小的在前
+		size_t build(const size_t);				// 建立以某结点为根的子树，返回其中的胜者
+	public:
+		LoserTree(const vector<SortedRun>&, const size_t, const Less&);	// 第二个参数为每个输入每批读入的记录数
+		bool next(T&);							// 取出最小的记录，全部读完时返回false
+};
+
+// 外部排序器：push放入全部记录，finish之后用next按顺序逐条取出
+template <typename T, typename Less> class ExternalSorter {
+	static_assert(std::is_trivially_copyable<T>::value, "ExternalSorter writes records to disk byte by byte.");
+	private:
+		Less less;
+		size_t budget;
+		size_t capacity;						// 内存中最多攒的记录数
+		vector<T> buffer;
+		bool f_isSorted;						// 缓冲中的记录是否已经按顺序放入
+		vector<SortedRun> runs;					// 已经写出的顺串
+		size_t cursor;							// 没有溢出时，下一条要取出的记录在缓冲中的位置
+		std::unique_ptr<LoserTree<T, Less>> merger;
+		void spill();							// 把缓冲排好序写成一个顺串
+		SortedRun writeRun(const T*, const size_t);
+		void mergePass();						// 每g_SortMaxFanIn个顺串归并成一个
+		size_t readBatch(const size_t) const;	// 同时读取若干个顺串时，每个顺串每批读入的记录数
+	public:
+		ExternalSorter(const Less& l = Less(), const size_t b = g_SortMemoryBudget);
+		~ExternalSorter();						// 删除尚未删除的顺串文件
+		ExternalSorter(const ExternalSorter&) = delete;
+		ExternalSorter& operator= (const ExternalSorter&) = delete;
+		void push(const T&);
+		void finish();							// 放入完毕，此后不能再放入
+		bool next(T&);							// 按顺序取出下一条记录，取完时返回false
+		size_t spilledRuns() const { return runs.size(); }
+};
+
+bool parseSortMemory(const string&, size_t&);	// 识别-sortmem的参数（正整数，单位MiB），返回字节数
+
+
+
+// 函数体定义全部写在下方
+
+string SpillRegistry::create() {
+	lock_guard<mutex> lock(registry_mutex);
+	if (directory == "") {
+		const char* base = getenv("TMPDIR");
+		string path = string(base != nullptr and *base != '\0' ? base : "/tmp") + "/minidb-" + std::to_string(getpid());
+		// 上次同一进程号的程序异常退出时目录可能已经存在，直接沿用
+		if (mkdir(path.c_str(), 0700) != 0 and errno != EEXIST) {
+			throw FailedFileOperation(i18n::parseKey(msg_id::opentmpf, {path}));
+		}
+		directory = path;
+	}
+	string path = directory + "/run-" + std::to_string(counter++) + ".tmp";
+	files.insert(path);
+	return path;
+}
+void SpillRegistry::release(const string& path) {
+	remove(path.c_str());
+	lock_guard<mutex> lock(registry_mutex);
+	files.erase(path);
+}
+vstring SpillRegistry::takeAll() {
+	lock_guard<mutex> lock(registry_mutex);
+	vstring res(files.begin(), files.end());
+	if (directory != "") res.push_back(directory);	// 目录要在其中的文件删除之后才能删除
+	files.clear();
+	directory = "";
+	return res;
+}
+
+template <typename T> RunReader<T>::RunReader(const SortedRun& run, const size_t batch):path(run.path),position(0),remaining(run.count) {
+	file.open(path, ios::in | ios::binary);
+	if (!file.is_open()) throw FailedFileOperation(i18n::parseKey(msg_id::opentmpf, {path}));
+	buffer.reserve(std::min(batch, remaining));
+	refill();
+}
+template <typename T> void RunReader<T>::refill() {
+	size_t count = std::min(buffer.capacity(), remaining);
+	buffer.resize(count);
+	position = 0;
+	if (count == 0) return;
+	file.read(reinterpret_cast<char*>(buffer.data()), count * sizeof(T));
+	if (static_cast<size_t>(file.gcount()) != count * sizeof(T)) {
+		throw FailedFileOperation(i18n::parseKey(msg_id::readtmpf, {path}));
+	}
+	remaining -= count;
+}
+template <typename T> void RunReader<T>::pop() {
+	if (++position == buffer.size() and remaining != 0) refill();
+}
+
+template <typename T, typename Less> LoserTree<T, Less>::LoserTree(const vector<SortedRun>& runs, const size_t batch, const Less& l)
+	:tree(std::max<size_t>(runs.size(), 1)),less(l) {
+	for (const SortedRun& run : runs) {
+		inputs.emplace_back(new RunReader<T>(run, batch));
+	}
+	if (!inputs.empty()) tree[0] = build(1);
+}
+template <typename T, typename Less> bool LoserTree<T, Less>::beats(const size_t a, const size_t b) const {
+	if (inputs[a]->isExhausted()) return false;
+	if (inputs[b]->isExhausted()) return true;
+	if (less(inputs[a]->head(), inputs[b]->head())) return true;
+	if (less(inputs[b]->head(), inputs[a]->head())) return false;
+	return a < b;
+}
+template <typename T, typename Less> size_t LoserTree<T, Less>::build(const size_t node) {
+	size_t k = inputs.size();
+	if (node >= k) return node - k;
+	size_t left = build(2 * node), right = build(2 * node + 1);
+	if (beats(left, right)) {
+		tree[node] = right;
+		return left;
+	}
+	tree[node] = left;
+	return right;
+}
+template <typename T, typename Less> bool LoserTree<T, Less>::next(T& res) {
+	if (inputs.empty()) return false;
+	size_t winner = tree[0];
+	if (inputs[winner]->isExhausted()) return false;
+	res = inputs[winner]->head();
+	inputs[winner]->pop();
+	// 胜者换上它的下一条记录，沿着到根的路径与各结点的败者重赛
+	for (size_t node = (winner + inputs.size()) / 2; node >= 1; node /= 2) {
+		if (beats(tree[node], winner)) std::swap(tree[node], winner);
+	}
+	tree[0] = winner;
+	return true;
+}
+
+template <typename T, typename Less> ExternalSorter<T, Less>::ExternalSorter(const Less& l, const size_t b)
+	:less(l),budget(b),capacity(std::max<size_t>(b / sizeof(T), 1)),f_isSorted(true),cursor(0) {}
+template <typename T, typename Less> ExternalSorter<T, Less>::~ExternalSorter() {
+	merger.reset();						// 先关闭文件再删除
+	for (const SortedRun& run : runs) {
+		g_SpillRegistry.release(run.path);
+	}
+}
+template <typename T, typename Less> void ExternalSorter<T, Less>::push(const T& record) {
+	if (buffer.size() == capacity) spill();
+	if (f_isSorted and !buffer.empty() and less(record, buffer.back())) f_isSorted = false;
+	buffer.push_back(record);
+}
+template <typename T, typename Less> void ExternalSorter<T, Less>::spill() {
+	if (!f_isSorted) std::sort(buffer.begin(), buffer.end(), less);
+	runs.push_back(writeRun(buffer.data(), buffer.size()));
+	buffer.clear();
+	f_isSorted = true;
+}
+template <typename T, typename Less> SortedRun ExternalSorter<T, Less>::writeRun(const T* records, const size_t count) {
+	SortedRun run{g_SpillRegistry.create(), count};
+	std::ofstream file(run.path, ios::out | ios::binary | ios::trunc);
+	if (!file.is_open()) {
+		g_SpillRegistry.release(run.path);
+		throw FailedFileOperation(i18n::parseKey(msg_id::opentmpf, {run.path}));
+	}
+	file.write(reinterpret_cast<const char*>(records), count * sizeof(T));
+	file.close();
+	if (!file) {						// 磁盘写满等
+		g_SpillRegistry.release(run.path);
+		throw FailedFileOperation(i18n::parseKey(msg_id::writetmpf, {run.path}));
+	}
+	return run;
+}
+template <typename T, typename Less> size_t ExternalSorter<T, Less>::readBatch(const size_t inputs) const {
+	// 预算平分给各个输入，归并一趟时还要留一份给输出
+	return std::max<size_t>(capacity / (inputs + 1), 1);
+}
+template <typename T, typename Less> void ExternalSorter<T, Less>::mergePass() {
+	vector<SortedRun> merged;
+	for (size_t begin = 0; begin < runs.size(); begin += g_SortMaxFanIn) {
+		size_t end = std::min(begin + g_SortMaxFanIn, runs.size());
+		if (end - begin == 1) {
+			merged.push_back(runs[begin]);
+			continue;
+		}
+		vector<SortedRun> group(runs.begin() + begin, runs.begin() + end);
+		size_t batch = readBatch(group.size());
+		SortedRun output{g_SpillRegistry.create(), 0};
+		do {
+			std::ofstream file(output.path, ios::out | ios::binary | ios::trunc);
+			if (!file.is_open()) {
+				g_SpillRegistry.release(output.path);
+				throw FailedFileOperation(i18n::parseKey(msg_id::opentmpf, {output.path}));
+			}
+			LoserTree<T, Less> tree(group, batch, less);
+			vector<T> chunk;
+			chunk.reserve(batch);
+			T record;
+			bool f_hasMore = true;
+			while (f_hasMore) {
+				f_hasMore = tree.next(record);
+				if (f_hasMore) chunk.push_back(record);
+				if (chunk.size() == batch or (!f_hasMore and !chunk.empty())) {
+					file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size() * sizeof(T));
+					output.count += chunk.size();
+					chunk.clear();
+				}
+			}
+			file.close();
+			if (!file) {
+				g_SpillRegistry.release(output.path);
+				throw FailedFileOperation(i18n::parseKey(msg_id::writetmpf, {output.path}));
+			}
+		} while (false);
+		merged.push_back(output);
+		for (const SortedRun& run : group) {
+			g_SpillRegistry.release(run.path);
+		}
+	}
+	runs.swap(merged);
+}
+template <typename T, typename Less> void ExternalSorter<T, Less>::finish() {
+	if (runs.empty()) {
+		// 没有溢出：就地排序，不碰磁盘
+		if (!f_isSorted) std::sort(buffer.begin(), buffer.end(), less);
+		return;
+	}
+	if (!buffer.empty()) spill();
+	vector<T>().swap(buffer);			// 归并时缓冲的内存让给各顺串的读缓冲
+	while (runs.size() > g_SortMaxFanIn) mergePass();
+	logLazy(log_level::debug, [this](ostream& os) {
+		os << '\n' << i18n::parseKey(msg_id::sortspill, {std::to_string(runs.size()), std::to_string(budget >> 10)}) << '\n';
+	});
+	merger.reset(new LoserTree<T, Less>(runs, readBatch(runs.size()), less));
+}
+template <typename T, typename Less> bool ExternalSorter<T, Less>::next(T& res) {
+	if (merger != nullptr) return merger->next(res);
+	if (cursor == buffer.size()) return false;
+	res = buffer[cursor++];
+	return true;
+}
+
+bool parseSortMemory(const string& text, size_t& res) {
+	size_t mib = 0;
+	auto result = std::from_chars(text.data(), text.data() + text.size(), mib);
+	if (result.ec != std::errc() or result.ptr != text.data() + text.size() or mib == 0 or mib > (SIZE_MAX >> 20)) return false;
+	res = mib << 20;
+	return true;
+}
+
+}
+
+#endif
\ No newline at end of file
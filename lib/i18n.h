@@ -2,16 +2,23 @@
  * 头文件：i18n.h
  * 顾名思义，此头文件的内容是MiniDB国际化文本相关处理。
  * 写不出主要功能（指表达式计算）然后怒而搓了个I18n玩玩。
+ *
+ * 所有国际化字符串都列在__MINIDB_I18N_MESSAGES__中，每项在编译时生成一个msg_id，调用处直接用编号取字符串，
+ * 不再每次按名字查map、再把整个模板连同参数复制一遍。
+ * 模板在启动时预先切分好（见CompiledPattern）：原样输出的文本段与参数段交替，输出时按段拼接，不必再逐字符找"%n"。
+ * i18n::parseKey只记下模板和参数，直到真正输出（str()或<<）时才拼接；不会输出的日志由logLazy在格式化之前就丢弃。
+ * 定义了宏__ENABLE_I18N__时，语言文件中的字符串按名字覆盖对应的默认（英文）字符串，不认识的名字被忽略。
  */
 #ifndef __I18N_MINIDB_H__
 #define __I18N_MINIDB_H__
 
-#include "environment.h"
+#include "asynclog.h"
 
 namespace minidb{
 
-string toLowercase(const string);
-bool equalIgnoringCase(const string, const string);
+constexpr char asciiLower(const char);					// 只转换ASCII大写字母，不查表、不分配内存
+string toLowercase(const string&);
+bool equalIgnoringCase(const string_view, const string_view);
 
 string g_LangCode = "en";
 
@@ -21,6 +28,7 @@ enum class return_status {
 	invarg,
 	ferr,
 	syntaxerr,
+	txnerr,
 	unexpt = -1,
 	i18nwk = -2,
 	exbase = -3
@@ -29,29 +37,199 @@ enum class return_status {
 class kwstring {
 	private:
 		string s;
+		int id;				// 对应的保留关键字编号（keyword_index），-1表示不是保留关键字
 	public:
-		kwstring(const string& str = ""):s(str){}
-		kwstring(const char* str):s(str){}
-		operator string() { return s; }
-		bool operator== (const string str) const { return equalIgnoringCase(str, s); }
-		bool operator!= (const string str) const  { return !(*this == str); }
+		kwstring(const string& str = ""):s(str),id(-1){}
+		kwstring(const char* str):s(str),id(-1){}
+		template <typename E> kwstring(const char* str, const E e):s(str),id(static_cast<int>(e)){}
+		operator string() const { return s; }
+		bool operator== (const string_view str) const { return equalIgnoringCase(str, s); }
+		bool operator!= (const string_view str) const  { return !(*this == str); }
 		string str() const { return s; }
+		int getId() const { return id; }
 };
+
+// 所有可能的国际化字符串及其默认（英文）文本，至尊打表之力
+// authn由author()在读取国际化字符串时填入
+#define __MINIDB_I18N_MESSAGES__(X) \
+	X(i18nwrongkey,         "MiniDB> [Lang File Error] No such key named \"%1\" was found in en.ini language file.") \
+	X(welcome,              "MiniDB> Welcome to MiniDB. Developed by %1 completely independently.\n--------------------") \
+	X(exitstatus,           "--------------------\nMiniDB> MiniDB exits with status %1.") \
+	X(unacptcmdl,           "Unacceptable command line.") \
+	X(unacptvt,             "Unacceptable value type \"%1\".") \
+	X(unacptvarn,           "Unacceptable variable name \"%1\".") \
+	X(unacptfmt,            "Unacceptable export format \"%1\".") \
+	X(openlegfilef,         "MiniDB> Failed to open legacy data file \"%1\".") \
+	X(readlegfsuc,          "MiniDB> Succeeded in reading legacy data.") \
+	X(srvlisten,            "MiniDB> [Server] Listening on \"%1\".") \
+	X(srvstop,              "MiniDB> [Server] Shutting down.") \
+	X(openifilef,           "Failed to open input file \"%1\".") \
+	X(openofilef,           "Failed to open output file \"%1\".") \
+	X(atc,                  "MiniDB> All tasks accomplished.") \
+	X(opentmpf,             "Failed to open temporary file \"%1\".") \
+	X(readtmpf,             "Failed to read temporary file \"%1\".") \
+	X(writetmpf,            "Failed to write temporary file \"%1\".") \
+	X(sockerr,              "Socket operation \"%1\" failed: %2.") \
+	X(sockpathlen,          "Invalid socket path \"%1\" (at most %2 bytes).") \
+	X(openexpfilef,         "Failed to open export file \"%1\".") \
+	X(writeexpfilef,        "Failed to write export file \"%1\".") \
+	X(writelegfilef,        "Failed to write legacy data file.") \
+	X(txnnested,            "A transaction is already in progress.") \
+	X(notxn,                "No transaction in progress.") \
+	X(locktimeout,          "Timed out waiting for table \"%1\", which is being written by another transaction.") \
+	X(txnvacuum,            "\"vacuum\" cannot be used inside a transaction.") \
+	X(incmpltstr,           "Incomplete string.") \
+	X(incmpltparamlist,     "Incomplete parameter list.") \
+	X(unexptstr,            "Unexpected string \"%1\".") \
+	X(unexptkw,             "Unexpected keyword \"%1\".") \
+	X(invalidmathop,        "Invalid math operator \"%1\".") \
+	X(invalidcmpop,         "Invalid comparison operator \"%1\".") \
+	X(invalidlgop,          "Invalid logical operator \"%1\".") \
+	X(invalidlval,          "Invalid lvalue expression: %1") \
+	X(nosuchdb,             "No such database named \"%1\".") \
+	X(nosuchtab,            "No such table named \"%1\".") \
+	X(nosuchterm,           "No such term named \"%1\".") \
+	X(noavaldb,             "No database is currently using.") \
+	X(duplicatedb,          "Duplicate database name \"%1\".") \
+	X(duplicatetab,         "Duplicate table name \"%1\".") \
+	X(duplicateterm,        "Duplicate term name \"%1\".") \
+	X(incmpttypes,          "Incompatible value types: (%1) and (%2).") \
+	X(divzero,              "Divzero.") \
+	X(intoverflow,          "Integer overflow: %1 is out of the 64-bit range.") \
+	X(vnfitt,               "Value (%1) does not match the given type \"%2\".") \
+	X(upp,                  "Unmatched parameter pattern.") \
+	X(redundant,            "Redundant ',' after given parameters.") \
+	X(mismparen,            "Mismatched parenthesis.") \
+	X(strunexptsufx,        "Unexpected suffix \"%1\" found after string constant \"%2\".") \
+	X(strunexptprfx,        "Unexpected prefix \"%1\" found before string constant \"%2\".") \
+	X(strunexptsquote,      "Unexpected single quote mark found in string \"%2\" at Pos.%1.") \
+	X(nmemspec,             "No member specified despite table name given \"%1\".") \
+	X(dupclunre,            "Duplicate check in table \"%1\", leaving table \"%2\" unrelated.") \
+	X(invdupc,              "Invalid duplicate check in table \"%1\".") \
+	X(dupselwildc,          "Duplicate selection. (Applying wildcard '*' and other selectors simultaneously.)") \
+	X(dupselterm,           "Duplicate selection. (Found duplicate term \"%1\".)") \
+	X(outofbound,           "Requested index [%1] is out of bound.") \
+	X(exptsthgotnil,        "Expected %1 but got nil.") \
+	X(exptsthgotothers,     "Expected %1 but got %2.") \
+	X(exptkwgotnil,         "Expected keyword \"%1\" but got nil.") \
+	X(exptkwgotothers,      "Expected keyword \"%1\" but got \"%2\".") \
+	X(exptparamsgotnil,     "Expected parameter list (name type, ...) but got nil.") \
+	X(exptparamsgotothers,  "Expected parameter list (name type, ...) but got \"%1...\".") \
+	X(exptwheregotnil,      "Expected keyword \"where\" but got nil. If you want to delete all data in the table, please use \"drop table\" statement.") \
+	X(gcrmtmpf,             "MiniDB> [GC][Warning] Failed to remove temporary file \"%1\".") \
+	X(gcrmtmps,             "MiniDB> [GC] Deleted temporary file \"%1\".") \
+	X(sortspill,            "MiniDB> [Sort] Spilled to %1 sorted run(s) on disk (memory budget %2 KiB).") \
+	X(unexpectederr,        "MiniDB> [Unexpected Error] An unexpected error occurred. e.what() says \"%1\". ") \
+	X(argscerr,             "MiniDB> [Argument Count Error] %1 (Too %2 argument(s): %3 arg(s) expected") \
+	X(argscerr_r,           ", %1 received") \
+	X(argscerr_e,           ")") \
+	X(invalidarg,           "MiniDB> [Invalid Argument(s)] %1") \
+	X(ferr,                 "MiniDB> [File Error] %1") \
+	X(syntaxerr,            "MiniDB> [Syntax Error] %1") \
+	X(txnerr,               "MiniDB> [Transaction Error] %1") \
+	X(h_dataexh,            "MiniDB> [Data Show]") \
+	X(h_dataexhend,         "MiniDB> [Data Show][End]") \
+	X(h_debug_rawcmd,       "MiniDB> [Debug] Raw command: ") \
+	X(t_whererow,           "MiniDB> [Trace] Where clause is %1 for row: %2") \
+	X(much,                 "many") \
+	X(less,                 "few") \
+	X(w_nullstm,            "MiniDB> [Warning] Received null statement.") \
+	X(w_txnrollback,        "MiniDB> [Warning] Transaction was not committed and has been rolled back.") \
+	X(l_createdb,           "MiniDB> [Command] Database \"%1\" created.") \
+	X(l_createtab,          "MiniDB> [Command] Table \"%1\" created.") \
+	X(l_createtabparam,     "MiniDB> [Command][Parameter] name = \"%1\", type = \"%2\"") \
+	X(l_usedb,              "MiniDB> [Command] Now using database \"%1\".") \
+	X(l_droptab,            "MiniDB> [Command] Table \"%1\" dropped.") \
+	X(l_insertion,          "MiniDB> [Command] Inserting data into table \"%1\".") \
+	X(l_insertionval,       "MiniDB> [Command][Parameter] value = %1") \
+	X(l_selection,          "MiniDB> [Command] Selecting columns.") \
+	X(l_selectioncol,       "MiniDB> [Command][Parameter] col_name = %1") \
+	X(l_intab,              "MiniDB> [Command][Parameter] in table \"%1\"") \
+	X(l_where,              "MiniDB> [Command] Conditions:") \
+	X(l_logicexpr,          "MiniDB> [Command][Parameter] logic_expr | %1 %2 %3") \
+	X(l_update,             "MiniDB> [Command] Updating data.") \
+	X(l_assignment,         "MiniDB> [Command][Parameter] assignment | %1") \
+	X(l_innerjoin,          "MiniDB> [Command][Parameter] inner join logic_expr | %1 = %2") \
+	X(l_deletefrom,         "MiniDB> [Command] Deleting data from table \"%1\".") \
+	X(l_export,             "MiniDB> [Command] Exporting %1 to \"%2\" in %3 format.") \
+	X(l_begin,              "MiniDB> [Command] Transaction started.") \
+	X(l_commit,             "MiniDB> [Command] Transaction committed.") \
+	X(l_rollback,           "MiniDB> [Command] Transaction rolled back.") \
+	X(l_vacuum,             "MiniDB> [Command] Reclaiming dead rows of table \"%1\".") \
+	X(p_tablename,          "table name") \
+	X(p_termname,           "term name") \
+	X(p_termtype,           "term type") \
+	X(p_termvalue,          "term value") \
+	X(p_asgn,               "assignment") \
+	X(p_exppath,            "export path") \
+	X(def_w_langf,          "MiniDB> [Warning] Failed to open language file \"%1.ini\", now using default language file.") \
+	X(openlangf,            "MiniDB> [Language File Error] Failed to open language file en.ini.") \
+	X(authn,                "") \
+	X(notinfile,            " (not in files)") \
+	X(lnno,                 " (at Line %1)")
+
+enum class msg_id {
+	#define __MINIDB_I18N_ID__(key, text) key,
+	__MINIDB_I18N_MESSAGES__(__MINIDB_I18N_ID__)
+	#undef __MINIDB_I18N_ID__
+	count
+};
+
+const size_t g_I18nCount = static_cast<size_t>(msg_id::count);
+constexpr const char* g_I18nKeys[] = {			// 按msg_id排列的名字，语言文件据此找到要覆盖的字符串
+	#define __MINIDB_I18N_KEY__(key, text) #key,
+	__MINIDB_I18N_MESSAGES__(__MINIDB_I18N_KEY__)
+	#undef __MINIDB_I18N_KEY__
+};
+constexpr const char* g_I18nDefaults[] = {		// 按msg_id排列的默认文本
+	#define __MINIDB_I18N_DEFAULT__(key, text) text,
+	__MINIDB_I18N_MESSAGES__(__MINIDB_I18N_DEFAULT__)
+	#undef __MINIDB_I18N_DEFAULT__
+};
+
+// 预先切分好的模板："%n"变为第n个参数，"%%"变为'%'
+class CompiledPattern {
+	private:
+		struct Segment {
+			size_t begin;			// 文本段在text中的位置
+			size_t length;
+			int param;				// 参数编号（从0开始），-1表示文本段
+		};
+		string text;				// 去掉"%n"和转义之后剩下的全部文本
+		vector<Segment> segments;
+		template <typename F> void render(const vstring&, F) const;	// 依次把每一段交给F(const char*, size_t)
+	public:
+		CompiledPattern(const string& = "");
+		void appendTo(string&, const vstring&) const;
+		void writeTo(ostream&, const vstring&) const;
+};
+
+// 按msg_id排列的全部模板，启动时编译，此后只读
+class MessageCatalog {
+	private:
+		vector<CompiledPattern> patterns;
+	public:
+		MessageCatalog();									// 编译全部默认文本
+		const CompiledPattern& at(const msg_id id) const { return patterns[static_cast<size_t>(id)]; }
+		void set(const msg_id, const string&);
+		bool set(const string&, const string&);			// 按名字覆盖，不认识的名字返回false
+};
+
+MessageCatalog g_I18nCatalog;
+
 class i18nstring {
 	private:
-		string pattern;
+		const CompiledPattern* pattern;	// 为nullptr时不是国际化字符串，直接输出text
+		string text;
 		vstring params;
 	public:
-		i18nstring(const char* s) { pattern = s; }
-		i18nstring(const string s = "", const vstring v = {}):pattern(s),params(v){}
-		void setPattern(const string s) { pattern = s;}
-		void setParams(const vstring v) { params = v; }
+		i18nstring(const char* s):pattern(nullptr),text(s){}
+		i18nstring(const string s = ""):pattern(nullptr),text(s){}
+		i18nstring(const CompiledPattern& p, vstring&& v):pattern(&p),params(std::move(v)){}
 		string str() const;
+		void writeTo(ostream&) const;
 };
 
-// 所有可能的国际化字符串
-map<string, i18nstring> g_I18nStrDict;
-
 class MiniDBExceptionBase {
 	protected:
 		i18nstring msg;
@@ -63,56 +241,104 @@ class MiniDBExceptionBase {
 		virtual return_status status() const { return return_status::exbase; }
 };
 
-ostream& operator<< (ostream& os, const i18nstring s);
+ostream& operator<< (ostream& os, const i18nstring& s);
 bool isDigit(char);
 string itos(int);
 i18nstring author();
 namespace i18n{
 	void readKvPairs();
-	i18nstring parseKey(const string, vector<kwstring> = {});
+	i18nstring parseKey(const msg_id, vstring = {});
 	void initialize_hardcoded();
 }
 
 
+
 // 函数体定义多在下方
 
 
-// 解析国际化字符串的参数并返回解析后字符串
-string i18nstring::str() const {
-	string p = pattern;
-	string res = "";
-	int index = 0;
-	bool nflag = false;
-	for (char ch : pattern) {
-		if (nflag) {
-			if (ch == '%') {
-				nflag = false;
-				res.push_back('%');
-			}
-			else if (isDigit(ch)) {
-				index *= 10;
-				index += (ch - '0');
-			}
-			else {
-				nflag = false;
-				res = res + params.at(index-1) + ch;
-				index = 0;
-			}
+CompiledPattern::CompiledPattern(const string& pattern) {
+	size_t literal = 0;			// 当前文本段的起点
+	auto closeLiteral = [this, &literal]() {
+		if (text.size() > literal) segments.push_back({literal, text.size() - literal, -1});
+		literal = text.size();
+	};
+	for (size_t i = 0; i < pattern.size(); ++i) {
+		if (pattern[i] != '%' or i + 1 == pattern.size()) {
+			text.push_back(pattern[i]);
+			continue;
+		}
+		if (pattern[i+1] == '%') {
+			text.push_back('%');
+			++i;
+			continue;
+		}
+		int index = 0;
+		size_t j = i + 1;
+		while (j < pattern.size() and isDigit(pattern[j])) {
+			index = index * 10 + (pattern[j] - '0');
+			++j;
+		}
+		if (j == i + 1) {			// '%'之后既不是数字也不是'%'，原样保留
+			text.push_back('%');
+			continue;
 		}
+		closeLiteral();
+		segments.push_back({0, 0, index - 1});
+		i = j - 1;
+	}
+	closeLiteral();
+}
+template <typename F> void CompiledPattern::render(const vstring& params, F emit) const {
+	for (const Segment& seg : segments) {
+		if (seg.param < 0) emit(text.data() + seg.begin, seg.length);
 		else {
-			if (ch == '%') {
-				nflag = true;
-			}
-			else res.push_back(ch);
+			const string& param = params.at(seg.param);
+			emit(param.data(), param.size());
 		}
 	}
-	if (nflag) res = res + params.at(index-1);
+}
+void CompiledPattern::appendTo(string& res, const vstring& params) const {
+	render(params, [&res](const char* p, size_t n) { res.append(p, n); });
+}
+void CompiledPattern::writeTo(ostream& os, const vstring& params) const {
+	render(params, [&os](const char* p, size_t n) { os.write(p, n); });
+}
+
+MessageCatalog::MessageCatalog() {
+	patterns.reserve(g_I18nCount);
+	for (size_t i = 0; i < g_I18nCount; ++i) {
+		patterns.emplace_back(g_I18nDefaults[i]);
+	}
+}
+void MessageCatalog::set(const msg_id id, const string& pattern) {
+	patterns[static_cast<size_t>(id)] = CompiledPattern(pattern);
+}
+bool MessageCatalog::set(const string& key, const string& pattern) {
+	for (size_t i = 0; i < g_I18nCount; ++i) {
+		if (key == g_I18nKeys[i]) {
+			patterns[i] = CompiledPattern(pattern);
+			return true;
+		}
+	}
+	return false;
+}
+
+// 解析国际化字符串的参数并返回解析后字符串
+string i18nstring::str() const {
+	if (pattern == nullptr) return text;
+	string res;
+	pattern->appendTo(res, params);
 	return res;
 }
+void i18nstring::writeTo(ostream& os) const {
+	if (pattern == nullptr) os << text;
+	else pattern->writeTo(os, params);
+}
 
-// 重载ostream的左移运算符以更方便地输出国际化字符串
-ostream& operator<< (ostream& os, const i18nstring s) {
-	return os << s.str();
+// 重载ostream的左移运算符以更方便地输出国际化字符串，直接按段写出，不先拼成一个字符串
+ostream& operator<< (ostream& os, const i18nstring& s) {
+	s.writeTo(os);
+	return os;
 }
 
 bool isDigit(char ch) {
@@ -124,6 +350,7 @@ namespace i18n {
 
 	// 读取国际化字符串
 	void readKvPairs() {
+		g_I18nCatalog.set(msg_id::authn, author().str());
 		#ifdef __ENABLE_I18N__
 			initialize_hardcoded();
 			ifstream langf;
@@ -132,9 +359,9 @@ namespace i18n {
 				langf.open("i18n/zh_cn.ini", ios::in);
 				if (!langf.is_open()) {
 					g_LangCode = "zh_cn";
-					throw MiniDBExceptionBase(i18n::parseKey("openlangf"));
+					throw MiniDBExceptionBase(i18n::parseKey(msg_id::openlangf));
 				}
-				else clog << i18n::parseKey("def_w_langf", {g_LangCode});
+				else logLazy(log_level::warn, [](ostream& os) { os << i18n::parseKey(msg_id::def_w_langf, {g_LangCode}); });
 			}
 			string line;
 			while (getline(langf, line)) {
@@ -162,141 +389,24 @@ namespace i18n {
 					else if (ch == '\\') trflag = true;
 					else rval.push_back(ch);
 				}
-				g_I18nStrDict.insert(pair<string, i18nstring>(id, i18nstring(rval)));
+				g_I18nCatalog.set(id, rval);		// 不认识的名字直接忽略
 			}
 			langf.close();
 		#endif
-		#ifndef __ENABLE_I18N__
-			// 至尊打表之力
-			g_I18nStrDict = {
-				{"i18nwrongkey", "MiniDB> [Lang File Error] No such key named \"%1\" was found in en.ini language file."},
-				{"welcome", "MiniDB> Welcome to MiniDB. Developed by %1 completely independently.\n--------------------"},
-				{"exitstatus", "--------------------\nMiniDB> MiniDB exits with status %1."},
-				{"unacptcmdl", "Unacceptable command line."},
-				{"unacptvt", "Unacceptable value type \"%1\"."},
-				{"unacptvarn", "Unacceptable variable name \"%1\"."},
-				{"openlegfilef", "MiniDB> Failed to open legacy data file \"%1\"."},
-				{"readlegfsuc", "MiniDB> Succeeded in reading legacy data."},
-				{"openifilef", "Failed to open input file \"%1\"."},
-				{"openofilef", "Failed to open output file \"%1\"."},
-				{"atc", "MiniDB> All tasks accomplished."},
-				{"opentmpf", "Failed to open temporary file \"%1\"."},
-				{"incmpltstr", "Incomplete string."},
-				{"incmpltparamlist", "Incomplete parameter list."},
-				{"unexptstr", "Unexpected string \"%1\"."},
-				{"unexptkw", "Unexpected keyword \"%1\"."},
-				{"invalidmathop", "Invalid math operator \"%1\"."},
-				{"invalidcmpop", "Invalid comparison operator \"%1\"."},
-				{"invalidlgop", "Invalid logical operator \"%1\"."},
-				{"invalidlval", "Invalid lvalue expression: %1"},
-				{"nosuchdb", "No such database named \"%1\"."},
-				{"nosuchtab", "No such table named \"%1\"."},
-				{"nosuchterm", "No such term named \"%1\"."},
-				{"noavaldb", "No database is currently using."},
-				{"duplicatedb", "Duplicate database name \"%1\"."},
-				{"duplicatetab", "Duplicate table name \"%1\"."},
-				{"duplicateterm", "Duplicate term name \"%1\"."},
-				{"incmpttypes", "Incompatible value types: (%1) and (%2)."},
-				{"divzero", "Divzero."},
-				{"vnfitt", "Value (%1) does not match the given type \"%2\"."},
-				{"upp", "Unmatched parameter pattern."},
-				{"redundant", "Redundant ',' after given parameters."},
-				{"mismparen", "Mismatched parenthesis."},
-				{"strunexptsufx", "Unexpected suffix \"%1\" found after string constant \"%2\"."},
-				{"strunexptprfx", "Unexpected prefix \"%1\" found before string constant \"%2\"."},
-				{"strunexptsquote", "Unexpected single quote mark found in string \"%2\" at Pos.%1."},
-				{"nmemspec", "No member specified despite table name given \"%1\"."},
-				{"dupclunre", "Duplicate check in table \"%1\", leaving table \"%2\" unrelated."},
-				{"invdupc", "Invalid duplicate check in table \"%1\"."},
-				{"dupselwildc", "Duplicate selection. (Applying wildcard '*' and other selectors simultaneously.)"},
-				{"dupselterm", "Duplicate selection. (Found duplicate term \"%1\".)"},
-				{"outofbound", "Requested index [%1] is out of bound."},
-				{"exptsthgotnil", "Expected %1 but got nil."},
-				{"exptsthgotothers", "Expected %1 but got %2."},
-				{"exptkwgotnil", "Expected keyword \"%1\" but got nil."},
-				{"exptkwgotothers", "Expected keyword \"%1\" but got \"%2\"."},
-				{"exptparamsgotnil", "Expected parameter list (name type, ...) but got nil."},
-				{"exptparamsgotothers", "Expected parameter list (name type, ...) but got \"%1...\"."},
-				{"exptwheregotnil", "Expected keyword \"where\" but got nil. If you want to delete all data in the table, please use \"drop table\" statement."},
-				{"gcrmtmpf", "MiniDB> [GC][Warning] Failed to remove temporary file \"%1\"."},
-				{"gcrmtmps", "MiniDB> [GC] Deleted temporary file \"%1\"."},
-				{"unexpectederr", "MiniDB> [Unexpected Error] An unexpected error occurred. e.what() says \"%1\". "},
-				{"argscerr", "MiniDB> [Argument Count Error] %1 (Too %2 argument(s): %3 arg(s) expected"},
-				{"argscerr_r", ", %1 received"},
-				{"argscerr_e", ")"},
-				{"invalidarg", "MiniDB> [Invalid Argument(s)] %1"},
-				{"ferr", "MiniDB> [File Error] %1"},
-				{"syntaxerr", "MiniDB> [Syntax Error] %1"},
-				{"h_dataexh", "MiniDB> [Data Show]"},
-				{"h_dataexhend", "MiniDB> [Data Show][End]"},
-				{"h_debug_rawcmd", "MiniDB> [Debug] Raw command: "},
-				{"much", "many"},
-				{"less", "few"},
-				{"w_nullstm", "MiniDB> [Warning] Received null statement."},
-				{"l_createdb", "MiniDB> [Command] Database \"%1\" created."},
-				{"l_createtab", "MiniDB> [Command] Table \"%1\" created."},
-				{"l_createtabparam", "MiniDB> [Command][Parameter] name = \"%1\", type = \"%2\""},
-				{"l_usedb", "MiniDB> [Command] Now using database \"%1\"."},
-				{"l_droptab", "MiniDB> [Command] Table \"%1\" dropped."},
-				{"l_insertion", "MiniDB> [Command] Inserting data into table \"%1\"."},
-				{"l_insertionval", "MiniDB> [Command][Parameter] value = %1"},
-				{"l_selection", "MiniDB> [Command] Selecting columns."},
-				{"l_selectioncol", "MiniDB> [Command][Parameter] col_name = %1"},
-				{"l_intab", "MiniDB> [Command][Parameter] in table \"%1\""},
-				{"l_where", "MiniDB> [Command] Conditions:"},
-				{"l_logicexpr", "MiniDB> [Command][Parameter] logic_expr | %1 %2 %3"},
-				{"l_update", "MiniDB> [Command] Updating data."},
-				{"l_assignment", "MiniDB> [Command][Parameter] assignment | %1"},
-				{"l_innerjoin", "MiniDB> [Command][Parameter] inner join logic_expr | %1 = %2"},
-				{"l_deletefrom", "MiniDB> [Command] Deleting data from table \"%1\"."},
-				{"p_tablename", "table name"},
-				{"p_termname", "term name"},
-				{"p_termvalue", "term value"},
-				{"p_asgn", "assignment"},
-				{"dupselwildc", "Duplicate selection. (Applying wildcard '*' and other selectors simultaneously.)"},
-				{"dupselterm", "Duplicate selection. (Found duplicate term \"%1\".)"},
-				{"def_w_langf", "MiniDB> [Warning] Failed to open language file \"%1.ini\", now using default language file."},
-				{"openlangf", "MiniDB> [Language File Error] Failed to open language file en.ini."},
-				{"authn", author()},
-				{"notinfile", " (not in files)"},
-				{"lnno", " (at Line %1)"}
-			};
-		#endif
 	}
 
-	// 这个函数实际上不进行parse，只是插入参数，但这样起名会让正文行文看起来好懂一些。
-	i18nstring parseKey(const string id, vector<kwstring> params_kw) {
-		auto p = g_I18nStrDict.find(id);
-		if (p == g_I18nStrDict.end()) return i18nstring(i18n::parseKey("i18nwrongkey", {id}));
-
-		i18nstring ins = p->second;
-		vstring params;
-		for (kwstring kws : params_kw) {
-			params.push_back(kws.str());
-		}
-		ins.setParams(params);
-		return ins;
+	// 这个函数实际上不进行parse，只是记下参数，等到输出时才插入，但这样起名会让正文行文看起来好懂一些。
+	i18nstring parseKey(const msg_id id, vstring params) {
+		return i18nstring(g_I18nCatalog.at(id), std::move(params));
 	}
 
 	// 部分国际化字符串可能在读取语言文件前被调用，因而不得不进行硬编码。
 	// 仅在定义了宏__ENABLE_I18N__时被调用。
 	void initialize_hardcoded() {
 			if (g_LangCode == "zh_cn") {
-				g_I18nStrDict = {
-					{"openlangf", "MiniDB>【语言文件错误】未能成功打开语言文件zh_cn.ini。"},
-					{"authn", author()},
-					{"notinfile", "（不在输入文件内）"},
-					{"lnno", "（位于第 %1 行）"}
-				};
-			}
-			else if (g_LangCode == "en") {
-				g_I18nStrDict = {
-					{"def_w_langf", "MiniDB> [Warning] Failed to open language file \"%1.ini\", now using default language file."},
-					{"openlangf", "MiniDB> [Language File Error] Failed to open language file en.ini."},
-					{"authn", author()},
-					{"notinfile", " (not in files)"},
-					{"lnno", " (at Line %1)"}
-				};
+				g_I18nCatalog.set(msg_id::openlangf, "MiniDB>【语言文件错误】未能成功打开语言文件zh_cn.ini。");
+				g_I18nCatalog.set(msg_id::notinfile, "（不在输入文件内）");
+				g_I18nCatalog.set(msg_id::lnno, "（位于第 %1 行）");
 			}
 	}
 
@@ -324,19 +434,20 @@ i18nstring author() {
 	if (g_LangCode == "zh_cn") return string("陈必珅");
 	else return string("Bishen CHEN");
 }
-string toLowercase(const string str) {
-	string res = "";
-	const string latin_lowercase = "abcdefghijklmnopqrstuvwxyz";
-	const string latin_uppercase = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-	for (char ch : str) {
-		auto pos = latin_uppercase.find(ch);
-		if (pos == string::npos) res.push_back(ch);
-		else res.push_back(latin_lowercase.at(pos));
-	}
+constexpr char asciiLower(const char ch) {
+	return (ch >= 'A' and ch <= 'Z') ? static_cast<char>(ch - 'A' + 'a') : ch;
+}
+string toLowercase(const string& str) {
+	string res(str);
+	for (char& ch : res) ch = asciiLower(ch);
 	return res;
 }
-bool equalIgnoringCase(const string a, const string b) {
-	return toLowercase(a) == toLowercase(b);
+bool equalIgnoringCase(const string_view a, const string_view b) {
+	if (a.size() != b.size()) return false;
+	for (size_t i = 0; i < a.size(); ++i) {
+		if (asciiLower(a[i]) != asciiLower(b[i])) return false;
+	}
+	return true;
 }
 
 }
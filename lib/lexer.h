@@ -0,0 +1,247 @@
+/**
+ * 头文件：lexer.h
+ * 输入脚本的读取与词法切分。
+ *
+ * 输入文件用mmap映射进内存，词法分析直接在映射的内容上进行，不再先把整个文件规整化到临时文件、再逐字符读回。
+ * 切出的词法单元只记录自己在脚本中的位置，不复制文本；映射的页面由操作系统按需读入、按需回收，
+ * 所以再大的脚本，常驻内存也只和正在处理的几条语句有关。
+ *
+ * 切分规则与原先的规整化相同：
+ * 		字符串以外，空格和制表符分隔词法单元，语法符号（见symbols::grmsymbols）各自单独成为一个词法单元，"!="视为一个；
+ * 		换行成为"\newl"词法单元，行号计数器据此计算行号；
+ * 		字符串以单引号开始和结束，其中的内容原样保留，字符串内不能换行；
+ * 		分号结束一条语句，最后一个分号之后的内容被忽略；但脚本在未闭合的字符串中结束时报错，不会悄悄丢掉最后一条语句。
+ * 只有一点不同：字符串中的分号不再结束语句。
+ *
+ * 切分时不逐字节判断，而是一次分类64字节（结构化扫描）：
+ * 		先用SIMD比较（没有SSE2时逐字节查表）得到单引号、空白、换行、分号、语法符号各自的位掩码；
+ * 		单引号掩码做前缀异或，得到哪些字节位于字符串内（上一块结尾仍在字符串内时整体取反）；
+ * 		字符串以外的空白和符号之外都是词法单元的字节，由此算出每个词法单元的起点和终点。
+ * 之后只需按位遍历这些“事件”：词法单元的起止、符号、分号、字符串内的换行，其余字节不再看第二眼。
+ */
+#ifndef __LEXER_MINIDB_H__
+#define __LEXER_MINIDB_H__
+
+#include "stringop.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+namespace minidb {
+
+// 只读映射的输入文件
+class MappedFile {
+	private:
+		const char* data;
+		size_t length;
+	public:
+		explicit MappedFile(const string);
+		~MappedFile();
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator= (const MappedFile&) = delete;
+		string_view view() const { return string_view(data, length); }
+};
+
+const size_t g_ScanBlockSize = 64;				// 结构化扫描每次分类的字节数，与位掩码的位数相同
+
+// 一个块中各类字节的位掩码，第i位对应块中第i个字节
+struct BlockMasks {
+	uint64_t quote;
+	uint64_t space;								// 空格、制表符
+	uint64_t newline;
+	uint64_t semicolon;
+	uint64_t symbol;							// 除分号、换行以外的语法符号，以及"!"
+};
+
+// 语句切分器：每次从脚本中切出一条语句的词法单元
+class StatementLexer {
+	private:
+		string_view script;
+		size_t block;							// 当前块的起始位置
+		size_t next_block;						// 下一块的起始位置
+		uint64_t pending;						// 当前块中尚未处理的事件
+		uint64_t token_starts;					// 词法单元的第一个字节
+		uint64_t token_ends;					// 词法单元之后的第一个字节
+		uint64_t operators;						// 字符串以外的符号、分号、换行
+		uint64_t broken_strings;				// 字符串内的换行
+		uint64_t in_string_carry;				// 上一块的最后一个字节是否在字符串内（0或全1）
+		uint64_t token_carry;					// 上一块的最后一个字节是否属于词法单元（0或1）
+		size_t token_begin;						// 尚未结束的词法单元的起始位置，没有时为npos
+		size_t skip;							// 已经并入"!="的"="的位置
+		bool loadBlock();						// 分类下一块，脚本已经读完时返回false
+	public:
+		StatementLexer(const string_view);
+		bool next(vtoken&);						// 切出下一条语句，脚本中已经没有完整的语句时返回false，在字符串中结束时报错
+};
+
+void classifyBlock(const char*, BlockMasks&);	// 分类恰好64个字节，语法符号须与symbols::grmsymbols一致
+uint64_t prefixXor(uint64_t);					// 第i位变为原来第0至i位的异或
+
+
+
+
+// 函数体定义全部写在下方
+
+MappedFile::MappedFile(const string path):data(nullptr),length(0) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) throw FailedFileOperation(i18n::parseKey(msg_id::openifilef, {path}));
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		throw FailedFileOperation(i18n::parseKey(msg_id::openifilef, {path}));
+	}
+	length = st.st_size;
+	if (length != 0) {			// 长度为0的文件不能映射，视为空脚本
+		void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			close(fd);
+			throw FailedFileOperation(i18n::parseKey(msg_id::openifilef, {path}));
+		}
+		madvise(p, length, MADV_SEQUENTIAL);	// 从头读到尾，让内核预读后面的页面、尽早回收前面的页面
+		data = static_cast<const char*>(p);
+	}
+	close(fd);					// 映射建立之后就不再需要文件描述符
+}
+MappedFile::~MappedFile() {
+	if (data != nullptr) munmap(const_cast<char*>(data), length);
+}
+
+StatementLexer::StatementLexer(const string_view s):script(s),block(0),next_block(0),pending(0),token_starts(0),token_ends(0),
+	operators(0),broken_strings(0),in_string_carry(0),token_carry(0),token_begin(string_view::npos),skip(string_view::npos){}
+
+bool StatementLexer::loadBlock() {
+	if (next_block >= script.size()) return false;
+	block = next_block;
+	next_block += g_ScanBlockSize;
+
+	BlockMasks m;
+	if (script.size() - block >= g_ScanBlockSize) classifyBlock(script.data() + block, m);
+	else {
+		// 最后不足一块的部分补上空格再分类，补上的字节不属于任何词法单元
+		char tail[g_ScanBlockSize];
+		std::memset(tail, ' ', g_ScanBlockSize);
+		std::memcpy(tail, script.data() + block, script.size() - block);
+		classifyBlock(tail, m);
+	}
+
+	// 字符串内的字节：从左单引号（含）到右单引号（不含）
+	uint64_t in_string = prefixXor(m.quote) ^ in_string_carry;
+	in_string_carry = (in_string >> 63) != 0 ? ~uint64_t(0) : 0;
+
+	uint64_t delimiters = m.space | m.newline | m.semicolon | m.symbol;
+	uint64_t tokens = in_string | m.quote | ~delimiters;
+	uint64_t previous = (tokens << 1) | token_carry;		// 第i位：前一个字节是否属于词法单元
+	token_carry = tokens >> 63;
+
+	token_starts = tokens & ~previous;
+	token_ends = ~tokens & previous;
+	operators = (m.newline | m.semicolon | m.symbol) & ~in_string;
+	broken_strings = m.newline & in_string;
+	pending = token_starts | token_ends | operators | broken_strings;
+	return true;
+}
+
+bool StatementLexer::next(vtoken& params) {
+	params.clear();
+	while (true) {
+		while (pending == 0) {
+			if (loadBlock()) continue;
+			// 最后一个分号之后的内容被忽略，除非它停在一个未闭合的字符串中
+			if (in_string_carry != 0) throw InvalidArgument(i18n::parseKey(msg_id::incmpltstr));
+			return false;
+		}
+		unsigned index = __builtin_ctzll(pending);
+		uint64_t bit = uint64_t(1) << index;
+		pending &= pending - 1;
+		size_t i = block + index;
+
+		// 同一位置上可能既是上一个词法单元的终点，又是一个符号，先结束词法单元
+		if ((token_ends & bit) != 0) {
+			string_view text = script.substr(token_begin, i - token_begin);
+			checkStrValidity(text);
+			params.emplace_back(text);
+			token_begin = string_view::npos;
+		}
+		if ((token_starts & bit) != 0) token_begin = i;
+		if ((broken_strings & bit) != 0) {
+			// 字符串内换行说明字符串不闭合
+			throw InvalidArgument(i18n::parseKey(msg_id::incmpltstr));
+		}
+		if ((operators & bit) == 0 or i == skip) continue;
+
+		switch (script[i]) {
+			case ';':
+				return true;
+			case '\n':
+				params.emplace_back(string_view(symbols::newl));
+				break;
+			case '!':
+				if (i + 1 < script.size() and script[i+1] == '=') {
+					params.emplace_back(script.substr(i, 2));
+					skip = i + 1;
+				}
+				else params.emplace_back(script.substr(i, 1));
+				break;
+			default:
+				params.emplace_back(script.substr(i, 1));
+				break;
+		}
+	}
+}
+
+uint64_t prefixXor(uint64_t x) {
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+#ifdef __SSE2__
+void classifyBlock(const char* p, BlockMasks& m) {
+	m = BlockMasks{0, 0, 0, 0, 0};
+	for (size_t k = 0; k < g_ScanBlockSize; k += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + k));
+		auto eq = [&v](const char ch) { return _mm_cmpeq_epi8(v, _mm_set1_epi8(ch)); };
+		auto bits = [](const __m128i x) { return static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(x))); };
+		__m128i symbol = _mm_or_si128(_mm_or_si128(_mm_or_si128(eq(','), eq('(')), _mm_or_si128(eq(')'), eq('<'))),
+						 _mm_or_si128(_mm_or_si128(eq('>'), eq('=')), _mm_or_si128(eq('+'), eq('-'))));
+		symbol = _mm_or_si128(symbol, _mm_or_si128(_mm_or_si128(eq('*'), eq('/')), _mm_or_si128(eq('%'), eq('!'))));
+		m.quote |= bits(eq('\'')) << k;
+		m.space |= bits(_mm_or_si128(eq(' '), eq('\t'))) << k;
+		m.newline |= bits(eq('\n')) << k;
+		m.semicolon |= bits(eq(';')) << k;
+		m.symbol |= bits(symbol) << k;
+	}
+}
+#else
+void classifyBlock(const char* p, BlockMasks& m) {
+	m = BlockMasks{0, 0, 0, 0, 0};
+	for (size_t k = 0; k < g_ScanBlockSize; ++k) {
+		uint64_t bit = uint64_t(1) << k;
+		switch (p[k]) {
+			case '\'':	m.quote |= bit;		break;
+			case ' ':
+			case '\t':	m.space |= bit;		break;
+			case '\n':	m.newline |= bit;	break;
+			case ';':	m.semicolon |= bit;	break;
+			case ',':	case '(':	case ')':	case '<':	case '>':	case '=':
+			case '+':	case '-':	case '*':	case '/':	case '%':	case '!':
+						m.symbol |= bit;	break;
+			default:	break;
+		}
+	}
+}
+#endif
+
+}
+
+#endif
\ No newline at end of file
@@ -1,168 +1,122 @@
 /**
  * 头文件：loggers.h
- * 向控制台输出日志。
- * 仅在定义了宏__DEBUG_ENVIRONMENT__时被调用。
+ * 已执行语句的调试日志。
+ * 这些函数只负责把语句格式化到给定的流中，由commands.h在debug级别的日志打开时调用（见asynclog.h）。
  */
 
 #ifndef __LOGGER_MINIDB_H__
 #define __LOGGER_MINIDB_H__
 
-#include "exceptions.h"
+#include "statements.h"
 
 namespace minidb {
 
-void logCreateDatabase(const vstring);
-void logCreateTable(const vstring);
-void logUseDatabase(const vstring);
-void logDropTable(const vstring);
-void logInsertion(const vstring);
-void logSelection(const vstring);
-void logInnerJoin(const vstring);
-void logUpdate(const vstring);
-void logDeleteFrom(const vstring);
-void logNullStm();
-void logWhere(const vstring);
+void logCreateDatabase(const CreateDatabaseSt&, ostream&);
+void logCreateTable(const CreateTableSt&, ostream&);
+void logUseDatabase(const UseDatabaseSt&, ostream&);
+void logDropTable(const DropTableSt&, ostream&);
+void logInsertion(const InsertionSt&, ostream&);
+void logSelection(const SelectionSt&, ostream&);
+void logInnerJoin(const InnerJoinSt&, ostream&);
+void logUpdate(const UpdateSt&, ostream&);
+void logDeleteFrom(const DeleteFromSt&, ostream&);
+void logExport(const ExportSt&, ostream&);
+void logVacuum(const VacuumSt&, ostream&);
+void logBegin(ostream&);
+void logCommit(ostream&);
+void logRollback(ostream&);
+void logNullStm(ostream&);
+void logWhere(const WhereClause&, ostream&);
 
 // 函数体定义全部写在下方
-void logCreateDatabase(const vstring params) {
-	clog << i18n::parseKey("l_createdb",{params.at(0)}) << endl;
-}
-void logCreateTable(const vstring params) {
-	clog << i18n::parseKey("l_createtab",{params.at(0)}) << endl;
-	bool f_isTermName = true;
-	for (auto it = params.begin()+1; it != params.end(); ++it) {
-		if (f_isTermName) {
-			clog << i18n::parseKey("l_createtabparam",{*it, *(it+1)}) << endl;
-		}
-		f_isTermName = !f_isTermName;
+void logCreateDatabase(const CreateDatabaseSt& st, ostream& os) {
+	os << i18n::parseKey(msg_id::l_createdb,{st.database}) << endl;
+}
+void logCreateTable(const CreateTableSt& st, ostream& os) {
+	os << i18n::parseKey(msg_id::l_createtab,{st.table}) << endl;
+	for (const auto& p_column : st.columns) {
+		os << i18n::parseKey(msg_id::l_createtabparam,{p_column.first, p_column.second}) << endl;
 	}
 }
-void logUseDatabase(const vstring params) {
-	clog << i18n::parseKey("l_usedb",{params.at(0)}) << endl;
+void logUseDatabase(const UseDatabaseSt& st, ostream& os) {
+	os << i18n::parseKey(msg_id::l_usedb,{st.database}) << endl;
 }
-void logDropTable(const vstring params) {
-	clog << i18n::parseKey("l_droptab",{params.at(0)}) << endl;
+void logDropTable(const DropTableSt& st, ostream& os) {
+	os << i18n::parseKey(msg_id::l_droptab,{st.table}) << endl;
 }
-void logInsertion(const vstring params) {
-	clog << i18n::parseKey("l_insertion",{params.at(0)}) << endl;
-	for (auto it = params.begin()+1; it != params.end(); ++it) {
-		clog << i18n::parseKey("l_insertionval",{*it}) << endl;
+void logInsertion(const InsertionSt& st, ostream& os) {
+	os << i18n::parseKey(msg_id::l_insertion,{st.table}) << endl;
+	for (const string_view value : st.values) {
+		os << i18n::parseKey(msg_id::l_insertionval,{string(value)}) << endl;
 	}
 }
-void logInnerJoin(const vstring params) {
-	clog << i18n::parseKey("l_selection") << endl;
-	int stage = 0;
-	vstring innerjoin_clause;
-	for (string str : params) {
-		if (str == keywords::from) {
-			stage = 1;
-			continue;
-		}
-		if (str == "inner join") {
-			stage = 2;
-			continue;
-		}
-		switch (stage) {
-			case 0:				// 列名
-				clog << i18n::parseKey("l_selectioncol",{str}) << endl;
-				break;
-			case 1:				// 表名
-				clog << i18n::parseKey("l_intab", {str}) << endl;
-				break;
-			case 2:				// 另一个表名
-				innerjoin_clause.push_back(str);
-				break;
-		}
+void logInnerJoin(const InnerJoinSt& st, ostream& os) {
+	os << i18n::parseKey(msg_id::l_selection) << endl;
+	for (const ColumnRef& column : st.columns) {
+		os << i18n::parseKey(msg_id::l_selectioncol,{column.table + "." + column.column}) << endl;
 	}
-	clog << i18n::parseKey("l_intab", {innerjoin_clause.at(0)}) << endl;
-	clog << i18n::parseKey("l_innerjoin", {innerjoin_clause.at(1) + "." + innerjoin_clause.at(2), innerjoin_clause.at(3) + "." + innerjoin_clause.at(4)});
-	clog << endl;
-}
-void logSelection(const vstring params) {
-	clog << i18n::parseKey("l_selection") << endl;
-	int stage = 0;
-	vstring where_clause;
-	for (string str : params) {
-		if (str == keywords::from) {
-			stage = 1;
-			continue;
-		}
-		if (str == keywords::where) {
-			stage = 2;
-			continue;
-		}
-		switch (stage) {
-			case 0:				// 列名
-				clog << i18n::parseKey("l_selectioncol",{str}) << endl;
-				break;
-			case 1:				// 表名
-				clog << i18n::parseKey("l_intab", {str}) << endl;
-				break;
-			case 2:				// where clause
-				where_clause.push_back(str);
-		}
+	os << i18n::parseKey(msg_id::l_intab, {st.table_first}) << endl;
+	os << i18n::parseKey(msg_id::l_intab, {st.table_second}) << endl;
+	os << i18n::parseKey(msg_id::l_innerjoin, {st.on_first.table + "." + st.on_first.column, st.on_second.table + "." + st.on_second.column});
+	os << endl;
+}
+void logSelection(const SelectionSt& st, ostream& os) {
+	os << i18n::parseKey(msg_id::l_selection) << endl;
+	for (const string& column : st.columns) {
+		os << i18n::parseKey(msg_id::l_selectioncol,{column}) << endl;
 	}
-	logWhere(where_clause);
-}
-void logUpdate(const vstring params) {
-	clog << i18n::parseKey("l_update") << endl;
-	int stage = 0;
-	vstring where_clause;
-	string asgn_str = "";
-	for (string str : params) {
-		if (str == keywords::set) {
-			stage = 1;
-			continue;
-		}
-		if (str == symbols::next) {
-			clog << i18n::parseKey("l_assignment", {asgn_str}) << endl;
-			asgn_str = "";
-			continue;
-		}
-		if (str == keywords::where) {
-			clog << i18n::parseKey("l_assignment", {asgn_str}) << endl;
-			asgn_str = "";
-			stage = 2;
-			continue;
-		}
-		switch (stage) {
-			case 0:				// 表名
-				clog << i18n::parseKey("l_intab", {str}) << endl;
-				break;
-			case 1:				// 赋值表达式
-				asgn_str = asgn_str + str + " ";
-				break;
-			case 2:				// where clause
-				where_clause.push_back(str);
-		}
+	os << i18n::parseKey(msg_id::l_intab, {st.table}) << endl;
+	logWhere(st.where, os);
+}
+void logUpdate(const UpdateSt& st, ostream& os) {
+	os << i18n::parseKey(msg_id::l_update) << endl;
+	os << i18n::parseKey(msg_id::l_intab, {st.table}) << endl;
+	for (const Assignment& asgn : st.assignments) {
+		os << i18n::parseKey(msg_id::l_assignment, {asgn.text}) << endl;
 	}
-	logWhere(where_clause);
-}
-void logDeleteFrom(const vstring params) {
-	clog << i18n::parseKey("l_deletefrom", {params.at(0)}) << endl;
-	vstring conditions = params;
-	conditions.erase(conditions.begin());
-	logWhere(conditions);
-}
-void logNullStm() {
-	clog << i18n::parseKey("w_nullstm") << endl;
-}
-void logWhere(const vstring params) {	
-	auto it = params.begin();
-	if (it != params.end()) {
-		clog << i18n::parseKey("l_where") << endl;
-		while (true) {
-			clog << i18n::parseKey("l_logicexpr", {*(it++), *(it++), *(it++)});
-			if (it != params.end()) {
-				clog << ' ' << (*(it++)) << endl;
-				continue;
-			}
-			break;
+	logWhere(st.where, os);
+}
+void logDeleteFrom(const DeleteFromSt& st, ostream& os) {
+	os << i18n::parseKey(msg_id::l_deletefrom, {st.table}) << endl;
+	logWhere(st.where, os);
+}
+void logExport(const ExportSt& st, ostream& os) {
+	string source;
+	if (st.source == export_source::table) source = "table \"" + st.table + "\"";
+	else source = "query result";
+	os << i18n::parseKey(msg_id::l_export, {source, st.path, st.format}) << endl;
+}
+void logBegin(ostream& os) {
+	os << i18n::parseKey(msg_id::l_begin) << endl;
+}
+void logCommit(ostream& os) {
+	os << i18n::parseKey(msg_id::l_commit) << endl;
+}
+void logRollback(ostream& os) {
+	os << i18n::parseKey(msg_id::l_rollback) << endl;
+}
+void logVacuum(const VacuumSt& st, ostream& os) {
+	os << i18n::parseKey(msg_id::l_vacuum,{st.table}) << endl;
+}
+void logNullStm(ostream& os) {
+	os << i18n::parseKey(msg_id::w_nullstm) << endl;
+}
+void logWhere(const WhereClause& where, ostream& os) {
+	if (where.conditions.empty()) return;
+	// 比较式的两侧照原样输出：列名输出列名，常量输出其值
+	auto operandText = [](const Operand& operand) -> const string& {
+		return operand.f_isColumn ? operand.name : operand.literal.getValue();
+	};
+	os << i18n::parseKey(msg_id::l_where) << endl;
+	for (size_t i = 0; i < where.conditions.size(); ++i) {
+		const Condition& cond = where.conditions.at(i);
+		os << i18n::parseKey(msg_id::l_logicexpr, {operandText(cond.first), cond.op, operandText(cond.second)});
+		if (i < where.connectives.size()) {
+			os << ' ' << g_KeywordSpellings[static_cast<int>(where.connectives.at(i))] << endl;
 		}
-		clog << endl;
 	}
+	os << endl;
 }
-
 }
 
 #endif
\ No newline at end of file
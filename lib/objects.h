@@ -9,30 +9,86 @@
 
 namespace minidb {
 
+/**
+ * 文本列的字典编码
+ * 表中每个文本列都有一个字典，列中每个不同的字符串只在字典里存一份，单元格只保存指向字典条目的指针（编码）。
+ * 同一个字典中，字符串相同当且仅当编码相同，因此相等比较、连接键的比较只比较指针；
+ * 字符串本身只在输出、拼接、大小比较时才读取。
+ * 条目只追加、不移动，平时也不删除（被撤销的写入、被删除或覆盖的行留下的条目也保留）；
+ * vacuum回收旧版本之后重建字典，只留下仍被某个版本用到的字符串（见Table::compactDictionaries）。
+ * 只有持有表的写者锁的线程会向字典追加条目；读者查找时加共享锁。
+ *
+ * 每个条目还带有一个定长的前缀键，大小比较先比前缀键（一次整数比较），相等时才比较完整的字符串。
+ * 前缀键取单引号之后的前8个字节，按大端序拼成64位无符号整数，不足8个字节的补0：
+ * 所有字符串都以单引号开头，跳过它之后，前缀键的大小关系与字符串（按无符号字节）的字典序一致。
+ */
+class TextDictionary;
+struct TextEntry {
+	string text;
+	uint64_t prefix;				// textPrefixKey(text)
+	const TextDictionary* owner;
+	size_t ordinal;					// 条目在字典中的序号，同一个字典中不同的字符串序号不同
+};
+class TextDictionary {
+	private:
+		std::deque<TextEntry> entries;
+		unordered_map<string_view, const TextEntry*> index;	// 键指向条目中的字符串
+		mutable shared_mutex index_mutex;
+	public:
+		TextDictionary(){}
+		TextDictionary(const TextDictionary&) = delete;
+		TextDictionary& operator= (const TextDictionary&) = delete;
+		const TextEntry* intern(const string&);				// 取得字符串的编码，没有则追加。调用者须持有表的写者锁
+		const TextEntry* find(const string_view) const;		// 字典中没有这个字符串时返回nullptr
+		size_t size() const { return entries.size(); }
+};
+
+uint64_t textPrefixKey(const string_view);		// 文本的前缀键，见上
+uint64_t doubleZoneKey(double);					// 把浮点数换成按无符号整数比较时大小关系不变的键
+
 class Term {
 	private:
-		string value;
-		string type;
+		// 未编码时value是值本身；表中文本列的值编码后只剩code，指向列字典中的条目，单元格里不再有字符串。
+		// 两者共用同一块空间，由f_Encoded区分。数值从不编码，数值运算直接读取value
+		union {
+			string value;
+			const TextEntry* code;
+		};
+		value_class type;				// 类型按value_class存放，integer、float、text、variable依次对应
+		bool f_Encoded;
+		void setCode(const TextEntry*);	// 改为保存编码，释放字符串
 	public:
-		Term(const string v = "", const kwstring term = keywords::text):value(v),type(term.str()){};
-		bool operator< (const Term) const;
-		bool operator== (const Term) const;
-		bool operator> (const Term) const;
-		bool operator!= (const Term) const;
-		Term operator+ (const Term) const;
-		Term operator- (const Term) const;
-		Term operator* (const Term) const;
-		Term operator/ (const Term) const;
-		Term operator% (const Term) const;
-		Term operator= (const Term);
-		bool isCompatibleWith (const Term) const;
+		Term(const string v = "", const kwstring term = keywords::text);
+		Term(const Term&);
+		Term(Term&&) noexcept;
+		~Term();
+		bool operator< (const Term&) const;
+		bool operator== (const Term&) const;
+		bool operator> (const Term&) const;
+		bool operator!= (const Term&) const;
+		Term operator+ (const Term&) const;
+		Term operator- (const Term&) const;
+		Term operator* (const Term&) const;
+		Term operator/ (const Term&) const;
+		Term operator% (const Term&) const;
+		Term& operator= (const Term&);
+		Term& operator= (Term&&) noexcept;
+		bool isCompatibleWith (const Term&) const;
 		bool doesFitType() const;
-		string getValue() const;
-		string getType() const;
-		Term& setValue(const string);
+		const string& getValue() const;
+		const string& getType() const;
+		const TextEntry* getCode() const;	// 未编码时为nullptr
+		uint64_t prefixKey() const;			// 文本的前缀键，未编码时现算
+		uint64_t zoneKey() const;		// 块的取值范围所用的键：文本为前缀键，数值为doubleZoneKey
+		Term& setValue(const string_view);	// 值与类型不符，或整数超出64位范围时报错
+		Term& setValueFrom(const Term&);	// 同setValue，但编码过的值直接复制编码，不取出字符串
 		Term& setType(const string);
+		void encode(TextDictionary&);		// 文本编码到给定的字典中，已经编码到这个字典的不再查找
+		void encodeExisting(const TextDictionary&);	// 同上，但只查找不追加，字典中没有时保持原样
 		void print(ostream&) const;
 };
+const string& typeName(const value_class);			// Term的类型名，即"integer"、"float"、"text"、"variable"之一
+[[noreturn]] void throwIntegerOverflow(const Term&, const string&, const Term&);	// 两个整数的运算结果超出64位时报错
 typedef pair<string, Term> psterm;
 class Row {
 	private:
@@ -40,43 +96,267 @@ class Row {
 		vector<psterm> terms;
 	public:
 		Row(){}
-		bool doesExist(const string) const;
-		int findIdIndex(const string) const;
-		Term& findTerm(const string);
-		void insertTerm(const string, const Term);
-		void insertTerm(const psterm);
+		// 按列名查找的函数都只读不复制，扫描每一行时不产生任何堆分配
+		bool doesExist(const string_view) const;
+		int findIdIndex(const string_view) const;
+		Term& findTerm(const string_view);
+		const Term& findTerm(const string_view) const;
+		void insertTerm(const string&, const Term&);
+		void insertTerm(const psterm&);
 		void print(ostream&) const;
 		void printTitle(ostream&) const;
 		size_t size() const;
 		vector<psterm>& getRaw();
-		void setTerms(const vector<psterm>);
-		void setTerm(const string, const Term);
-		Row& mergeRowIntersect(const Row, const string);
+		const vector<psterm>& getRaw() const;
+		void setTerms(const vector<psterm>&);
+		void setTerm(const string&, const Term&);
+		void setTermAt(const size_t, const Term&);		// 同setTerm，但按序号
+		Term& at(const size_t i) { return terms[i].second; }
+		const Term& at(const size_t i) const { return terms[i].second; }
+};
+// 两行拼接成的只读视图，第二行的列排在第一行之后。inner join据此对每一对行判断where子句，不必先把两行复制成一行
+class JoinedRow {
+	private:
+		const Row& first;
+		const Row& second;
+	public:
+		JoinedRow(const Row& r1, const Row& r2):first(r1),second(r2){}
+		const Term& at(const size_t i) const { return i < first.size() ? first.at(i) : second.at(i - first.size()); }
+		void print(ostream& os) const { first.print(os); os << ','; second.print(os); }
+};
+
+const size_t g_NoSuchColumn = SIZE_MAX;
+
+// 列名到序号的映射。每条语句执行前按表的标题行建立一次，之后按序号访问每一行的项，不再逐行比较列名。
+// 表中每一行都是标题行的副本，列的顺序与标题行相同。
+class Table;
+class Schema {
+	private:
+		unordered_map<string, size_t> ordinals;
+		vector<const TextDictionary*> dictionaries;	// 每一列的字典，不是文本列、不是按表建立时为nullptr
+		vector<const Term*> columns;				// 每一列在标题行中的项（即列的类型），只有按表建立时才有
+	public:
+		Schema(const Row&);
+		Schema(const Row&, const string&, const Row&, const string&);	// 两表连接后的列，列名为"表名.列名"，序号与JoinedRow一致
+		Schema(const Table&);											// 同上，但同时记下各文本列的字典
+		Schema(const Table&, const string&, const Table&, const string&);
+		size_t ordinalOf(const string&) const;							// 没有这一列时返回g_NoSuchColumn
+		const TextDictionary* dictionaryOf(const size_t) const;			// 没有字典时返回nullptr
+		const Term* columnOf(const size_t) const;						// 没有这一列时返回nullptr
+};
+// 表的写者锁，只有独占模式
+// 不用标准库的互斥量：事务的写者锁可能由执行语句的线程获得、由按顺序提交的线程释放（见commands.h中的语句调度），
+// 而标准库要求互斥量由加锁的线程解锁。这里的锁只记录“是否被持有”，不关心持有者是哪个线程。
+// 表需要能被复制，复制时新表拥有一把新锁，不继承原表锁的状态。
+class TableLatch {
+	private:
+		struct State {
+			mutex mtx;
+			condition_variable cv;
+			bool f_Held = false;
+		};
+		std::unique_ptr<State> state;
+	public:
+		TableLatch():state(new State){}
+		TableLatch(const TableLatch&):state(new State){}
+		TableLatch& operator= (const TableLatch&) { return *this; }
+		void lock();
+		bool try_lock();
+		template <typename Rep, typename Period> bool try_lock_for(const std::chrono::duration<Rep, Period>&);
+		void unlock();
+};
+
+/**
+ * 多版本并发控制（MVCC）
+ * 表由若干行槽组成，每个行槽保存这一行的版本链（新版本在前），每个版本带有起止版本号[begin, end)。
+ * 写语句不修改已有的版本：update将旧版本的end设为提交版本号，再在链头挂一个新版本；delete只设置end；insert追加新的行槽。
+ * 读语句开始时取得一个快照版本号s，沿版本链找到begin <= s < end的版本，因此读者从不等待写者，也不会看到写了一半的结果。
+ * update在原来的行槽中进行，行的先后顺序保持不变。
+ * 
+ * 写语句在提交前，其新版本的begin、删除版本的end都是该语句独有的“待提交标记”（最高位为1），其他快照都看不到；
+ * 提交时在g_CommitMutex下统一改为新的版本号，再发布到g_VersionClock。
+ * 已经对所有活跃快照都不可见的版本由后台线程回收（见collector.h），也可以用vacuum语句立即回收一张表。
+ *
+ * 每个行块还有一张删除位图：delete提交时，若被删的版本仍是行槽的最新版本（整行被删，而不是被update覆盖），
+ * 就把这个行槽的位置1，同时记下块内最晚一次删除的提交版本号。快照的版本号不小于它时，位图中的行对这个快照都已不可见，
+ * 扫描时按位跳过，不必再沿版本链逐个判断；否则这个块照常逐行判断。
+ * 回收时只重建含有可回收版本的块，其余块原样沿用。
+ *
+ * 每个行块还记录每一列在块内所有版本中的取值范围（zone map），键见Term::zoneKey。范围只在追加版本时扩大，回收重建块时重新计算。
+ * 表大多按时间顺序追加，id之类的列在块间天然有序，where子句中“列 < 常量”这样的条件据此就能整块跳过不可能满足的块（见ZoneFilter）。
+ * 版本先扩大所在块的范围再发布，读者看得到的版本一定在范围之内。
+ */
+typedef uint64_t version_t;
+const version_t g_PendingFlag = 1ULL << 63;				// 待提交标记的最高位
+const version_t g_VersionInfinity = UINT64_MAX;			// 尚未被删除的版本的end
+const version_t g_LatestCommitted = g_PendingFlag - 1;	// 比任何已提交版本号都大的快照，看到的是最新提交的内容
+const size_t g_RowBlockCapacity = 1024;					// 每个行块容纳的版本数
+const size_t g_TombstoneWords = g_RowBlockCapacity / 64;	// 删除位图的字数
+const uint64_t g_ZoneKeyMax = UINT64_MAX;
+
+atomic<version_t> g_VersionClock(0);		// 最近一次提交的版本号
+atomic<version_t> g_MarkerCounter(0);		// 用于分配待提交标记
+mutex g_CommitMutex;						// 保证提交按版本号顺序发布
+
+class RowVersion {
+	public:
+		Row row;
+		atomic<version_t> begin;
+		atomic<version_t> end;
+		RowVersion* older;					// 同一行的上一个版本，发布后不再修改
+		RowVersion():begin(0),end(g_VersionInfinity),older(nullptr){}
+};
+// 一列在一个块中的取值范围，块中还没有版本时low > high
+struct ZoneRange {
+	atomic<uint64_t> low;
+	atomic<uint64_t> high;
+};
+class RowBlock;
+class RowSlot {
+	public:
+		atomic<RowVersion*> newest;
+		RowBlock* block;					// 所在的块，新版本由它持有
+		RowSlot():newest(nullptr),block(nullptr){}
+};
+// 行块：行槽只追加、不移动，写者填好一个行槽后才增加count，读者只读取count以内的行槽。
+// 块内所有行槽的版本都存放在versions中，只有持有写者锁的线程会向其中追加（deque追加时不移动已有元素）。
+class RowBlock {
+	public:
+		RowSlot slots[g_RowBlockCapacity];
+		atomic<size_t> count;
+		std::deque<RowVersion> versions;
+		atomic<uint64_t> tombstones[g_TombstoneWords];	// 删除位图，第i位对应第i个行槽
+		atomic<version_t> tombstone_version;			// 位图中最晚一次删除的提交版本号
+		atomic<size_t> dead_versions;					// 块内已失效、尚未回收的版本数
+		std::unique_ptr<ZoneRange[]> zones;				// 每一列的取值范围
+		const size_t zone_count;
+		RowBlock(const size_t);							// 参数为表的列数
+		RowVersion& newVersion(const Row&, const version_t, RowVersion*);
+		void markDeleted(const RowSlot&, const version_t);	// 在g_CommitMutex下或持有写者锁时调用
+		uint64_t deletedMask(const size_t, const version_t) const;	// 位图的第几个字中对给定快照一定不可见的行槽，不能确定时为0
+};
+typedef vector<std::shared_ptr<RowBlock>> vblock;
+typedef std::shared_ptr<const vblock> pinned_blocks;	// 持有块列表期间，其中各块的版本都不会被释放
+
+// 块的过滤条件：where子句中“列 比较运算符 常量”形式的比较式，换成这一列的键必须落入的闭区间。
+// 块中这一列的取值范围与区间不相交时，这个比较式在块中每一行上都不成立；按连接词依次组合之后，
+// 整个where子句在块中每一行上都不可能成立的块，扫描时整块跳过。其余形式的比较式当作可能成立。
+class ZoneFilter {
+	private:
+		struct Test {
+			size_t column;						// 块中的列序号，g_NoSuchColumn表示无法判断、可能成立
+			uint64_t low;
+			uint64_t high;
+			keyword_index connective;			// 与前面的结果如何组合，第一个比较式不用
+		};
+		vector<Test> tests;
+		bool f_isUseful;						// 是否至少有一个比较式可以判断
+	public:
+		ZoneFilter():f_isUseful(false){}
+		void addTest(const size_t, const string&, const Term&, const keyword_index);	// 列 比较运算符 常量
+		void addUnknown(const keyword_index);
+		bool mayMatch(const RowBlock&) const;
+};
+
+// 快照：决定一个版本是否可见
+// owner是写语句自己的待提交标记，这样写者能看到自己此前写入、尚未提交的内容；只读快照的owner为0。
+class Snapshot {
+	private:
+		version_t version;
+		version_t owner;
+	public:
+		Snapshot(const version_t v = g_LatestCommitted, const version_t o = 0):version(v),owner(o){}
+		bool sees(const RowVersion&) const;
+		version_t getVersion() const { return version; }
+};
+// 登记一个活跃快照，析构时注销。回收线程据此判断哪些旧版本仍可能被读到。
+class SnapshotGuard {
+	private:
+		Snapshot snap;
+		std::multiset<version_t>::iterator it;
+	public:
+		SnapshotGuard(const version_t = 0);
+		~SnapshotGuard();
+		SnapshotGuard(const SnapshotGuard&) = delete;
+		SnapshotGuard& operator= (const SnapshotGuard&) = delete;
+		const Snapshot& get() const { return snap; }
 };
+
+std::multiset<version_t> g_ActiveSnapshots;
+mutex g_SnapshotMutex;
+
+version_t getOldestActiveVersion();				// 所有活跃快照中最小的版本号，没有活跃快照时为当前版本号
+
+class WriteBatch;
 class Table {
 	private:
 		Row title;
-		vector<Row> rows;
+		std::shared_ptr<const vblock> blocks;		// 读者用std::atomic_load取得，回收时整体替换
+		mutable TableLatch latch;					// 写者锁：同一张表的写语句依次进行，读者不需要加锁
+		atomic<size_t> dead_versions;				// 已被删除或覆盖、尚未回收的版本数
+		vector<std::unique_ptr<TextDictionary>> dictionaries;	// 每个文本列的字典，其余列为nullptr
+		RowBlock& lastBlockWithRoom();
+		void createDictionaries();
+		void encodeRow(Row&);						// 把新版本中的文本编码到本表的字典中
 	public:
-		Table(const Row row):title(row){}
-		void insertRow(const Row);
+		Table(const Row& row):title(row),blocks(std::make_shared<vblock>()),dead_versions(0) { createDictionaries(); }
+		Table(const Table&);
+		Table& operator= (const Table&) = delete;
+		void insertRow(const Row&);										// 直接插入已提交的行，仅用于查询结果等不共享的表；沿用行中原有的编码
+		void insertRow(const Row&, WriteBatch&);
+		void replaceRow(RowSlot&, const Row&, WriteBatch&);				// 以下两个函数的调用者须持有写者锁
+		void deleteRow(RowSlot&, WriteBatch&);
+		// 依次访问快照可见的每一行。给出过滤条件时，跳过其中不可能有满足条件的行的块；
+		// 给出事先取得的块列表（见pin）时扫描它，扫描结束之后行的引用仍然有效，直到块列表被释放
+		template <typename F> void scan(const Snapshot&, F, const ZoneFilter* = nullptr, const pinned_blocks& = nullptr) const;
+		template <typename F> void scanVersions(const Snapshot&, F, const ZoneFilter* = nullptr, const pinned_blocks& = nullptr) const;	// 同上，但访问的是行槽和可见的版本，供写者使用
+		size_t countRows(const Snapshot&) const;
+		size_t estimateRows() const;									// 粗略的行数，不判断可见性，供选择连接方式时使用
+		pinned_blocks pin() const { return std::atomic_load(&blocks); }
 		void print(ostream&) const;
-		vector<Row>& getRaw();
-		Row getTitle() const;
-		void removeRow(const int);
+		const Row& getTitle() const;
+		TableLatch& getLatch() const { return latch; }
+		void addDeadVersion(RowSlot& slot) { ++dead_versions; ++slot.block->dead_versions; }
+		size_t getDeadVersions() const { return dead_versions; }
+		size_t collectGarbage(const version_t);							// 调用者须持有写者锁，返回回收的版本数
+		size_t compactDictionaries();									// 调用者须持有写者锁和目录的独占锁，返回删去的字典条目数
+		const TextDictionary* getDictionary(const size_t i) const { return dictionaries[i].get(); }
 };
-typedef map<string, Table> mstable;
-typedef pair<string, Table> pstable;
+typedef unordered_map<string, Table> mstable;
+// 表按名字散列存放，查找、建表、删表都是O(1)，不会因为名字检查而碰到表的内容
 class Database {
 	private:
 		mstable tables;
 	public:
 		Database(){}
-		bool doesExist(const string) const;
-		void insertTable(const string, const Table);
-		void dropTable(const string);
-		Table& findTable(const string);
-		mstable getRaw() const;
+		Database(const Database&) = delete;
+		Database& operator= (const Database&) = delete;
+		bool doesExist(const string&) const;
+		Table& createTable(const string&, const Row&);	// 原地构造新表
+		void dropTable(const string&);
+		Table& findTable(const string&);
+		template <typename F> void forEachTable(F);		// 按表名顺序访问每张表，不复制表的内容
+};
+
+// 一个事务产生的新版本和删除标记，提交前可以整体撤销（见transaction.h）
+class WriteBatch {
+	private:
+		version_t marker;
+		struct WrittenVersion { Table* table; RowSlot* slot; RowVersion* version; };
+		vector<WrittenVersion> created;
+		vector<WrittenVersion> deleted;
+		bool f_Finished;
+	public:
+		WriteBatch():marker(g_PendingFlag | ++g_MarkerCounter),f_Finished(false){}
+		~WriteBatch() { if (!f_Finished) abort(); }
+		WriteBatch(const WriteBatch&) = delete;
+		WriteBatch& operator= (const WriteBatch&) = delete;
+		version_t getMarker() const { return marker; }
+		void recordCreate(Table* t, RowSlot* s, RowVersion* v) { created.push_back({t, s, v}); }
+		void recordDelete(Table* t, RowSlot* s, RowVersion* v) { deleted.push_back({t, s, v}); }
+		void commit();
+		void publish();						// 同commit，但调用者须已持有g_CommitMutex
+		void abort();
 };
 
 class BinaryExpression {
@@ -85,146 +365,492 @@ class BinaryExpression {
 		Term second;
 		string op;
 	public:
-		BinaryExpression(const Term f = Term(), const Term str = Term(), const string op = symbols::equals):first(f),second(str),op(op){};
+		BinaryExpression(const Term& f = Term(), const Term& str = Term(), const string& op = symbols::equals):first(f),second(str),op(op){};
 		virtual void verifyValidity() const = 0;
-		void setFirst(const Term t){ first = t; }
-		void setSecond(const Term t){ second = t; }
-		void setOp(const string str){ op = str; }
+		void setFirst(const Term& t){ first = t; }
+		void setSecond(const Term& t){ second = t; }
+		void setOp(const string& str){ op = str; }
 };
 class ComparisonExpression extends public BinaryExpression {
 	private:
 		void verifyValidity() const;
 	public:
-		ComparisonExpression(const Term f = Term(), const Term str = Term(), const string op = symbols::equals):BinaryExpression(f,str,op){};
+		ComparisonExpression(const Term& f = Term(), const Term& str = Term(), const string& op = symbols::equals):BinaryExpression(f,str,op){};
 		bool result() const;
 };
 
-map<string, Database> g_Databases;
-string g_CurrentDatabaseName = "";
+unordered_map<string, Database> g_Databases;
+shared_mutex g_CatalogMutex;		// 保护数据库、表的增删（即g_Databases以及各Database的表名单）。先锁目录，再锁表。
 
 Database& getCurrentDatabase();
 bool doesDatabaseExist(const string);
 void useDatabase(const string);
 void createDatabase(const string);
+template <typename F> void forEachDatabase(F);		// 按数据库名顺序访问每个数据库，写回历史数据、调试输出的顺序因此是确定的
+template <typename T> vector<pair<const string, T>*> sortedByName(unordered_map<string, T>&);
 
 string parseValueType(const string);
 
-const Row mergeRowUnion(Row, Row, const string, const string);
+bool compareTerms(const Term&, const Term&, const string&);	// 按比较运算符比较两项。ComparisonExpression要复制两项，逐行判断where子句时直接用这个
 
 // 函数体定义全部写在下方
 
+void TableLatch::lock() {
+	unique_lock<mutex> lock(state->mtx);
+	state->cv.wait(lock, [this]() { return !state->f_Held; });
+	state->f_Held = true;
+}
+bool TableLatch::try_lock() {
+	lock_guard<mutex> lock(state->mtx);
+	if (state->f_Held) return false;
+	state->f_Held = true;
+	return true;
+}
+template <typename Rep, typename Period>
+bool TableLatch::try_lock_for(const std::chrono::duration<Rep, Period>& timeout) {
+	unique_lock<mutex> lock(state->mtx);
+	if (!state->cv.wait_for(lock, timeout, [this]() { return !state->f_Held; })) return false;
+	state->f_Held = true;
+	return true;
+}
+void TableLatch::unlock() {
+	do {
+		lock_guard<mutex> lock(state->mtx);
+		state->f_Held = false;
+	} while (false);
+	state->cv.notify_one();
+}
+
 void ComparisonExpression::verifyValidity() const {
 	if (isValidCmpOp(op)) return;
-	throw InvalidArgument(i18n::parseKey("invalidcmpop", {op}));
+	throw InvalidArgument(i18n::parseKey(msg_id::invalidcmpop, {op}));
 }
 bool ComparisonExpression::result() const {
 	verifyValidity();
-	bool res;
-	if (op == symbols::less)			res = (first < second);
-	else if (op == symbols::greater)	res = (first > second);
-	else if (op == symbols::equals)		res = (first == second);
-	else if (op == symbols::neq)		res = (first != second);
-	return res;
+	return compareTerms(first, second, op);
+}
+bool compareTerms(const Term& first, const Term& second, const string& op) {
+	if (op == symbols::less)			return (first < second);
+	else if (op == symbols::greater)	return (first > second);
+	else if (op == symbols::equals)		return (first == second);
+	else if (op == symbols::neq)		return (first != second);
+	throw InvalidArgument(i18n::parseKey(msg_id::invalidcmpop, {op}));
 }
 
 Database& getCurrentDatabase() {
-	if (g_CurrentDatabaseName != "") {
-		try {
-			return g_Databases.at(g_CurrentDatabaseName);
-		}
-		catch (out_of_range& e) {
-			throw InvalidArgument(i18n::parseKey("nosuchdb", {g_CurrentDatabaseName}));
-		}
+	if (g_Session->database_name != "") {
+		auto it = g_Databases.find(g_Session->database_name);
+		if (it == g_Databases.end()) throw InvalidArgument(i18n::parseKey(msg_id::nosuchdb, {g_Session->database_name}));
+		return it->second;
 	}
-	throw SyntaxError(i18n::parseKey("noavaldb"));
+	throw SyntaxError(i18n::parseKey(msg_id::noavaldb));
 }
 bool doesDatabaseExists(const string str) {
 	return g_Databases.find(str) != g_Databases.end();
 }
 void useDatabase(const string str) {
-	if (doesDatabaseExists(str)) g_CurrentDatabaseName = str;
-	else throw InvalidArgument(i18n::parseKey("nosuchdb",{str}));
+	if (doesDatabaseExists(str)) g_Session->database_name = str;
+	else throw InvalidArgument(i18n::parseKey(msg_id::nosuchdb,{str}));
 }
 void createDatabase(const string str) {
-	if (doesDatabaseExists(str)) throw InvalidArgument(i18n::parseKey("duplicatedb", {str}));
-	g_Databases.insert(pair<string, Database>(str, Database()));
+	if (doesDatabaseExists(str)) throw InvalidArgument(i18n::parseKey(msg_id::duplicatedb, {str}));
+	g_Databases.try_emplace(str);
 }
-
-bool Database::doesExist(const string str) const {
-	for (pstable p_table : tables) {
-		if (p_table.first == str) return true;
+template <typename F> void forEachDatabase(F visit) {
+	for (auto* p_database : sortedByName(g_Databases)) {
+		visit(p_database->first, p_database->second);
 	}
-	return false;
 }
-void Database::insertTable(const string name, const Table table) {
-	if (doesExist(name))	throw InvalidArgument(i18n::parseKey("duplicatetab", {name}));
-	tables.insert(pstable(name, table));
+template <typename T> vector<pair<const string, T>*> sortedByName(unordered_map<string, T>& items) {
+	// 只排序指向元素的指针
+	vector<pair<const string, T>*> res;
+	res.reserve(items.size());
+	for (auto& item : items) res.push_back(&item);
+	std::sort(res.begin(), res.end(), [](const auto* a, const auto* b) { return a->first < b->first; });
+	return res;
 }
-void Database::dropTable(const string str) {
-	if (!doesExist(str))	throw InvalidArgument(i18n::parseKey("nosuchtab", {str}));
-	tables.erase(str);
+
+bool Database::doesExist(const string& str) const {
+	return tables.find(str) != tables.end();
+}
+Table& Database::createTable(const string& name, const Row& title) {
+	auto res = tables.emplace(std::piecewise_construct, std::forward_as_tuple(name), std::forward_as_tuple(title));
+	if (!res.second) throw InvalidArgument(i18n::parseKey(msg_id::duplicatetab, {name}));
+	return res.first->second;
+}
+void Database::dropTable(const string& str) {
+	if (tables.erase(str) == 0) throw InvalidArgument(i18n::parseKey(msg_id::nosuchtab, {str}));
 }
-Table& Database::findTable(const string str) {
+Table& Database::findTable(const string& str) {
 	auto it_table = tables.find(str);
 	if (it_table != tables.end()) return (*it_table).second;
-	throw InvalidArgument(i18n::parseKey("nosuchtab", {str}));
+	throw InvalidArgument(i18n::parseKey(msg_id::nosuchtab, {str}));
+}
+template <typename F> void Database::forEachTable(F visit) {
+	for (auto* p_table : sortedByName(tables)) {
+		visit(p_table->first, p_table->second);
+	}
+}
+
+bool Snapshot::sees(const RowVersion& v) const {
+	// 先读begin再读end：撤销插入时先把end置0再把begin置0，保证不会读到“begin已生效、end仍为无穷”的中间状态
+	version_t b = v.begin.load();
+	if (b > version and b != owner) return false;
+	version_t e = v.end.load();
+	return (e > version and e != owner);
+}
+
+SnapshotGuard::SnapshotGuard(const version_t owner) {
+	// 在同一把锁下读取版本号并登记，回收线程计算回收界限时也持有这把锁，因而不会回收掉本快照还能看到的版本
+	lock_guard<mutex> lock(g_SnapshotMutex);
+	snap = Snapshot(g_VersionClock.load(), owner);
+	it = g_ActiveSnapshots.insert(snap.getVersion());
+}
+SnapshotGuard::~SnapshotGuard() {
+	lock_guard<mutex> lock(g_SnapshotMutex);
+	g_ActiveSnapshots.erase(it);
 }
-mstable Database::getRaw() const {
-	return tables;
+version_t getOldestActiveVersion() {
+	lock_guard<mutex> lock(g_SnapshotMutex);
+	if (g_ActiveSnapshots.empty()) return g_VersionClock.load();
+	return *g_ActiveSnapshots.begin();
 }
 
-void Table::insertRow(const Row row) {
-	rows.push_back(row);
+void WriteBatch::commit() {
+	lock_guard<mutex> lock(g_CommitMutex);
+	publish();
+}
+void WriteBatch::publish() {
+	f_Finished = true;
+	if (created.empty() and deleted.empty()) return;
+	version_t stamp = g_VersionClock.load() + 1;
+	for (auto& c : created) c.version->begin.store(stamp);
+	for (auto& d : deleted) {
+		d.version->end.store(stamp);
+		d.table->addDeadVersion(*d.slot);
+		if (d.slot->newest.load() == d.version) d.slot->block->markDeleted(*d.slot, stamp);
+	}
+	g_VersionClock.store(stamp);
+	created.clear();
+	deleted.clear();
+}
+void WriteBatch::abort() {
+	for (auto& d : deleted) d.version->end.store(g_VersionInfinity);
+	for (auto it = created.rbegin(); it != created.rend(); ++it) {
+		it->version->end.store(0);			// begin = end = 0：对任何快照都不可见，等待回收
+		it->version->begin.store(0);
+		if (it->slot->newest.load() == it->version) it->slot->newest.store(it->version->older);
+		it->table->addDeadVersion(*it->slot);
+	}
+	created.clear();
+	deleted.clear();
+	f_Finished = true;
+}
+
+Table::Table(const Table& table):title(table.title),blocks(std::make_shared<vblock>()),dead_versions(0) {
+	createDictionaries();
+	SnapshotGuard guard;
+	// 副本有自己的字典，原表的编码不能沿用
+	table.scan(guard.get(), [this](const Row& row) {
+		Row copy = row;
+		encodeRow(copy);
+		insertRow(copy);
+	});
+}
+void Table::createDictionaries() {
+	for (const psterm& p_term : title.getRaw()) {
+		dictionaries.emplace_back(p_term.second.getType() == keywords::text ? new TextDictionary : nullptr);
+	}
+}
+void Table::encodeRow(Row& row) {
+	for (size_t i = 0; i < dictionaries.size(); ++i) {
+		if (dictionaries[i] != nullptr) row.at(i).encode(*dictionaries[i]);
+	}
+}
+RowBlock::RowBlock(const size_t columns):count(0),tombstone_version(0),dead_versions(0),zones(new ZoneRange[columns]),zone_count(columns) {
+	for (RowSlot& slot : slots) slot.block = this;
+	for (auto& word : tombstones) word.store(0);
+	for (size_t i = 0; i < zone_count; ++i) {
+		zones[i].low.store(g_ZoneKeyMax);
+		zones[i].high.store(0);
+	}
+}
+void RowBlock::markDeleted(const RowSlot& slot, const version_t stamp) {
+	size_t i = &slot - slots;
+	// 先记版本号再置位：读者看到某一位时，一定也能看到不早于这次删除的版本号
+	if (stamp > tombstone_version.load()) tombstone_version.store(stamp);
+	tombstones[i / 64].fetch_or(uint64_t(1) << (i % 64));
+}
+uint64_t RowBlock::deletedMask(const size_t word, const version_t snapshot) const {
+	uint64_t mask = tombstones[word].load();
+	// 块中有晚于快照提交的删除，快照可能还看得到被删的行，只能逐行判断
+	if (tombstone_version.load() > snapshot) return 0;
+	return mask;
+}
+RowVersion& RowBlock::newVersion(const Row& row, const version_t begin, RowVersion* older) {
+	versions.emplace_back();
+	RowVersion& version = versions.back();
+	version.row = row;
+	// 先扩大取值范围，调用者之后才会发布这个版本
+	for (size_t i = 0, n = std::min(zone_count, row.size()); i < n; ++i) {
+		uint64_t key = row.at(i).zoneKey();
+		if (key < zones[i].low.load(std::memory_order_relaxed)) zones[i].low.store(key);
+		if (key > zones[i].high.load(std::memory_order_relaxed)) zones[i].high.store(key);
+	}
+	version.begin.store(begin);
+	version.older = older;
+	return version;
+}
+RowBlock& Table::lastBlockWithRoom() {
+	std::shared_ptr<const vblock> current = std::atomic_load(&blocks);
+	if (!current->empty() and current->back()->count.load() < g_RowBlockCapacity) return *current->back();
+	// 最后一块已满，发布一份追加了新块的块列表；已有的块只复制指针
+	auto extended = std::make_shared<vblock>(*current);
+	extended->push_back(std::make_shared<RowBlock>(title.size()));
+	std::atomic_store(&blocks, std::shared_ptr<const vblock>(extended));
+	return *extended->back();
+}
+void Table::insertRow(const Row& row) {
+	RowBlock& block = lastBlockWithRoom();
+	size_t n = block.count.load();
+	block.slots[n].newest.store(&block.newVersion(row, 0, nullptr));
+	block.count.store(n + 1);
+}
+void Table::insertRow(const Row& row, WriteBatch& batch) {
+	RowBlock& block = lastBlockWithRoom();
+	size_t n = block.count.load();
+	RowVersion& version = block.newVersion(row, batch.getMarker(), nullptr);
+	encodeRow(version.row);
+	block.slots[n].newest.store(&version);
+	block.count.store(n + 1);				// 行槽填好后才对读者可见
+	batch.recordCreate(this, &block.slots[n], &version);
+}
+void Table::replaceRow(RowSlot& slot, const Row& row, WriteBatch& batch) {
+	RowVersion* old_version = slot.newest.load();
+	deleteRow(slot, batch);
+	RowVersion& version = slot.block->newVersion(row, batch.getMarker(), old_version);
+	encodeRow(version.row);
+	slot.newest.store(&version);
+	batch.recordCreate(this, &slot, &version);
+}
+void Table::deleteRow(RowSlot& slot, WriteBatch& batch) {
+	RowVersion* version = slot.newest.load();
+	version->end.store(batch.getMarker());
+	batch.recordDelete(this, &slot, version);
+}
+template <typename F> void Table::scanVersions(const Snapshot& snap, F visit, const ZoneFilter* filter, const pinned_blocks& pinned) const {
+	pinned_blocks current = (pinned != nullptr ? pinned : pin());
+	size_t block_cnt = current->size();
+	if (block_cnt == 0) return;
+	// 只有最后一块会增长。先记下它此刻的大小，扫描期间追加的行（包括本语句自己插入的）不会被访问到
+	size_t last_count = current->back()->count.load();
+	for (size_t b = 0; b < block_cnt; ++b) {
+		RowBlock& block = *(*current)[b];
+		size_t n = (b + 1 == block_cnt ? last_count : block.count.load());
+		if (filter != nullptr and !filter->mayMatch(block)) continue;	// 取值范围在行数之后读取，覆盖前n行
+		uint64_t deleted = 0;
+		for (size_t i = 0; i < n; ++i) {
+			if (i % 64 == 0) {
+				deleted = block.deletedMask(i / 64, snap.getVersion());
+				if (deleted == ~uint64_t(0)) {		// 这64行都已删除
+					i += 63;
+					continue;
+				}
+			}
+			if ((deleted >> (i % 64)) & 1) continue;
+			for (RowVersion* v = block.slots[i].newest.load(); v != nullptr; v = v->older) {
+				if (!snap.sees(*v)) continue;
+				visit(block.slots[i], *v);
+				break;
+			}
+		}
+	}
+}
+template <typename F> void Table::scan(const Snapshot& snap, F visit, const ZoneFilter* filter, const pinned_blocks& pinned) const {
+	scanVersions(snap, [&visit](RowSlot&, RowVersion& version) { visit(static_cast<const Row&>(version.row)); }, filter, pinned);
+}
+void ZoneFilter::addTest(const size_t column, const string& op, const Term& literal, const keyword_index connective) {
+	// 区间取得宽一些没有关系，只要满足比较式的值一定落在区间内
+	uint64_t key = literal.zoneKey();
+	Test test{column, 0, g_ZoneKeyMax, connective};
+	if (literal.getType() == keywords::text) {
+		// 前缀键保序但不严格：a < b只能推出a的前缀键 <= b的前缀键
+		if (op == symbols::less)			test.high = key;
+		else if (op == symbols::greater)	test.low = key;
+		else if (op == symbols::equals)		test.low = test.high = key;
+		else								test.column = g_NoSuchColumn;
+	}
+	else {
+		double value = stringToDouble(literal.getValue());
+		if (op == symbols::less)			test.high = key;
+		else if (op == symbols::greater)	test.low = key;
+		else if (op == symbols::equals) {	// 数值的相等允许g_DoubleEqCritDelta的误差
+			test.low = doubleZoneKey(value - g_DoubleEqCritDelta);
+			test.high = doubleZoneKey(value + g_DoubleEqCritDelta);
+		}
+		else								test.column = g_NoSuchColumn;
+	}
+	if (test.column != g_NoSuchColumn) f_isUseful = true;
+	tests.push_back(test);
+}
+void ZoneFilter::addUnknown(const keyword_index connective) {
+	tests.push_back(Test{g_NoSuchColumn, 0, g_ZoneKeyMax, connective});
+}
+bool ZoneFilter::mayMatch(const RowBlock& block) const {
+	if (!f_isUseful) return true;
+	// 与fitsWhereRequirement相同，不支持括号，按顺序组合。“可能成立”对and、or、xor都是保守的近似
+	bool res = true;
+	for (size_t i = 0; i < tests.size(); ++i) {
+		const Test& test = tests[i];
+		bool temp = true;
+		if (test.column != g_NoSuchColumn and test.column < block.zone_count) {
+			const ZoneRange& zone = block.zones[test.column];
+			temp = zone.low.load() <= test.high and zone.high.load() >= test.low;
+		}
+		if (i == 0) res = temp;
+		else if (test.connective == keyword_index::_and)	res = res and temp;
+		else												res = res or temp;
+	}
+	return res;
+}
+size_t Table::countRows(const Snapshot& snap) const {
+	size_t n = 0;
+	scanVersions(snap, [&n](RowSlot&, RowVersion&) { ++n; });
+	return n;
+}
+size_t Table::estimateRows() const {
+	// 只数各块的行槽，减去删除位图中的行，不沿版本链判断可见性：
+	// 尚未提交的写入、快照之后的删除，以及对所有快照都已不可见但还没有进入位图的行都会使它与countRows有出入
+	size_t n = 0;
+	pinned_blocks current = pin();
+	for (const auto& p_block : *current) {
+		n += p_block->count.load();
+		for (const auto& word : p_block->tombstones) n -= __builtin_popcountll(word.load());
+	}
+	return n;
+}
+size_t Table::collectGarbage(const version_t horizon) {
+	// end <= horizon的版本对现在和将来的所有快照都不可见。含有这种版本的块，把其余版本按原来的行序、链序复制到新块，
+	// 所有版本都已失效的行槽直接丢弃，相邻的几个这样的块的剩余行并入同样的新块；其余块原样沿用，新旧块列表共享它们。
+	// 正在扫描的读者仍持有旧的块列表，不受影响。
+	std::shared_ptr<const vblock> current = std::atomic_load(&blocks);
+	auto fresh = std::make_shared<vblock>();
+	size_t removed = 0;
+	RowBlock* filling = nullptr;				// 正在填入复制行的新块
+	vector<const RowVersion*> chain;
+	auto countExpired = [horizon](const RowBlock& block) {
+		size_t expired = 0;
+		for (size_t i = 0, n = block.count.load(); i < n; ++i) {
+			for (const RowVersion* v = block.slots[i].newest.load(); v != nullptr; v = v->older) {
+				if (v->end.load() <= horizon) ++expired;
+			}
+		}
+		return expired;
+	};
+	for (const auto& p_block : *current) {
+		if (p_block->dead_versions.load() == 0 or countExpired(*p_block) == 0) {
+			fresh->push_back(p_block);
+			filling = nullptr;
+			continue;
+		}
+		size_t n = p_block->count.load();
+		for (size_t i = 0; i < n; ++i) {
+			chain.clear();
+			for (const RowVersion* v = p_block->slots[i].newest.load(); v != nullptr; v = v->older) {
+				if (v->end.load() <= horizon) ++removed;
+				else chain.push_back(v);
+			}
+			if (chain.empty()) continue;
+			if (filling == nullptr or filling->count.load() == g_RowBlockCapacity) {
+				fresh->push_back(std::make_shared<RowBlock>(title.size()));
+				filling = fresh->back().get();
+			}
+			RowVersion* older = nullptr;
+			for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+				RowVersion& copy = filling->newVersion((*it)->row, (*it)->begin.load(), older);
+				version_t end = (*it)->end.load();
+				copy.end.store(end);
+				if (end != g_VersionInfinity) ++filling->dead_versions;		// 已失效、还不能回收的版本，留待下次
+				older = &copy;
+			}
+			size_t m = filling->count.load();
+			RowSlot& slot = filling->slots[m];
+			slot.newest.store(older);
+			// 整行已被删除、只是还有快照看得到的行，在新块的位图中照样标记（写者锁下不会有未提交的删除）
+			if (older->end.load() != g_VersionInfinity) filling->markDeleted(slot, older->end.load());
+			filling->count.store(m + 1);
+		}
+	}
+	if (removed == 0) return 0;
+	std::atomic_store(&blocks, std::shared_ptr<const vblock>(fresh));
+	size_t dead = dead_versions.load();
+	dead_versions.store(dead > removed ? dead - removed : 0);
+	return removed;
+}
+size_t Table::compactDictionaries() {
+	// 把每个版本重新编码到新字典中，没有版本用到的条目随旧字典一起释放。
+	// 编码就地改写，因此要求没有读者：读者、查询结果和绑定过的where子句都只在语句执行期间持有编码，语句执行时都持有目录的共享锁
+	size_t dropped = 0;
+	std::shared_ptr<const vblock> current = std::atomic_load(&blocks);
+	for (size_t i = 0; i < dictionaries.size(); ++i) {
+		if (dictionaries[i] == nullptr) continue;
+		std::unique_ptr<TextDictionary> fresh(new TextDictionary);
+		for (const auto& p_block : *current) {
+			for (RowVersion& version : p_block->versions) {
+				if (i < version.row.size()) version.row.at(i).encode(*fresh);
+			}
+		}
+		dropped += dictionaries[i]->size() - fresh->size();
+		dictionaries[i] = std::move(fresh);
+	}
+	return dropped;
 }
 void Table::print(ostream& os) const {
 	title.printTitle(os);
 	os << endl;
-	for (Row row : rows) {
+	SnapshotGuard guard;
+	scan(guard.get(), [&os](const Row& row) {
 		row.print(os);
 		os << endl;
-	}
+	});
 }
-vector<Row>& Table::getRaw() {
-	return rows;
-}
-void Table::removeRow(const int n) {
-	if (n < 0 or (size_t)n > rows.size()) throw InvalidArgument(i18n::parseKey("outofbound", {itos(n)}));
-	rows.erase(rows.begin()+n);
-}
-Row Table::getTitle() const {
+const Row& Table::getTitle() const {
 	return title;
 }
 
-bool Row::doesExist(const string id) const {
-	for (psterm p_term : terms) {
-		if (p_term.first == id) return true;
+bool Row::doesExist(const string_view id) const {
+	for (const psterm& p_term : terms) {
+		if (string_view(p_term.first) == id) return true;
 	}
 	return false;
 }
-int Row::findIdIndex(const string id) const {
-	int i = -1;
-	for (psterm p_term : terms) {
-		++i;
-		if (p_term.first == id) break;
+int Row::findIdIndex(const string_view id) const {
+	for (int i = 0, size = terms.size(); i < size; ++i) {
+		if (string_view(terms[i].first) == id) return i;
 	}
-	return i;
+	return -1;
 }
-Term& Row::findTerm(const string id) {
+Term& Row::findTerm(const string_view id) {
 	int index = findIdIndex(id);
-	if (index != -1) return terms.at(index).second;
-	throw InvalidArgument(i18n::parseKey("nosuchterm", {id}));
+	if (index != -1) return terms[index].second;
+	throw InvalidArgument(i18n::parseKey(msg_id::nosuchterm, {string(id)}));
 }
-void Row::insertTerm(const string id, const Term term) {
-	if (doesExist(id)) throw InvalidArgument(i18n::parseKey("duplicateterm", {id}));
+const Term& Row::findTerm(const string_view id) const {
+	int index = findIdIndex(id);
+	if (index != -1) return terms[index].second;
+	throw InvalidArgument(i18n::parseKey(msg_id::nosuchterm, {string(id)}));
+}
+void Row::insertTerm(const string& id, const Term& term) {
+	if (doesExist(id)) throw InvalidArgument(i18n::parseKey(msg_id::duplicateterm, {id}));
 	terms.push_back(psterm(id, term));
 }
-void Row::insertTerm(const psterm p_term) {
-	if (doesExist(p_term.first)) throw InvalidArgument(i18n::parseKey("duplicateterm", {p_term.first}));
+void Row::insertTerm(const psterm& p_term) {
+	if (doesExist(p_term.first)) throw InvalidArgument(i18n::parseKey(msg_id::duplicateterm, {p_term.first}));
 	terms.push_back(p_term);
 }
 void Row::print(ostream& os) const {
 	bool f_isFirst = true;
-	for (psterm p_term : terms) {
+	for (const psterm& p_term : terms) {
 		if (f_isFirst) f_isFirst = false;
 		else os << ',';
 		p_term.second.print(os);
@@ -232,7 +858,7 @@ void Row::print(ostream& os) const {
 }
 void Row::printTitle(ostream& os) const {
 	bool f_isFirst = true;
-	for (psterm p_term : terms) {
+	for (const psterm& p_term : terms) {
 		if (f_isFirst) f_isFirst = false;
 		else os << ',';
 		os << p_term.first;
@@ -244,50 +870,128 @@ size_t Row::size() const {
 vector<psterm>& Row::getRaw() {
 	return terms;
 }
-void Row::setTerms(const vector<psterm> p_term) {
+const vector<psterm>& Row::getRaw() const {
+	return terms;
+}
+void Row::setTerms(const vector<psterm>& p_term) {
 	terms = p_term;
 }
-void Row::setTerm(const string id, const Term term) {
-	Term& t = findTerm(id);
+void Row::setTerm(const string& id, const Term& term) {
+	int index = findIdIndex(id);
+	if (index == -1) throw InvalidArgument(i18n::parseKey(msg_id::nosuchterm, {id}));
+	setTermAt(index, term);
+}
+void Row::setTermAt(const size_t index, const Term& term) {
+	Term& t = at(index);
 	if (t.isCompatibleWith(term)) {
-		t.setValue(term.getValue());
+		t.setValueFrom(term);
 	}
 	else {
-		throw InvalidArgument(i18n::parseKey("incmpttypes", {t.getType(), term.getType()}));
+		throw InvalidArgument(i18n::parseKey(msg_id::incmpttypes, {t.getType(), term.getType()}));
 	}
 }
-Row& Row::mergeRowIntersect(const Row row, const string tabn) {
-	vstring row_ids;
-	for (psterm p_term : terms) {
-		row_ids.push_back(p_term.first);
+Schema::Schema(const Row& title) {
+	const vector<psterm>& terms = title.getRaw();
+	for (size_t i = 0; i < terms.size(); ++i) {
+		ordinals.emplace(terms[i].first, i);
 	}
-	vector<psterm> terms_raw = row.terms;
-	for (psterm p_term : terms_raw) {
-		string id = tabn + "." + p_term.first;
-		if (doesContain(id, row_ids)) {
-			Term term = p_term.second;
-			this->setTerm(id, p_term.second);
-		}
+}
+Schema::Schema(const Row& first, const string& tabn_first, const Row& second, const string& tabn_second) {
+	size_t i = 0;
+	for (const psterm& p_term : first.getRaw()) {
+		ordinals.emplace(tabn_first + "." + p_term.first, i++);
+	}
+	for (const psterm& p_term : second.getRaw()) {
+		ordinals.emplace(tabn_second + "." + p_term.first, i++);
 	}
-	return *this;
 }
-const Row mergeRowUnion(Row row1, Row row2, const string tabn1, const string tabn2) {
-	Row res;
-	for (psterm& p_term : row1.getRaw()) {
-		res.insertTerm(tabn1 + "." + p_term.first, p_term.second);
+Schema::Schema(const Table& table):Schema(table.getTitle()) {
+	for (size_t i = 0; i < table.getTitle().size(); ++i) {
+		dictionaries.push_back(table.getDictionary(i));
+		columns.push_back(&table.getTitle().at(i));
 	}
-	for (psterm& p_term : row2.getRaw()) {
-		res.insertTerm(tabn2 + "." + p_term.first, p_term.second);
+}
+Schema::Schema(const Table& first, const string& tabn_first, const Table& second, const string& tabn_second)
+	:Schema(first.getTitle(), tabn_first, second.getTitle(), tabn_second) {
+	for (size_t i = 0; i < first.getTitle().size(); ++i) {
+		dictionaries.push_back(first.getDictionary(i));
+		columns.push_back(&first.getTitle().at(i));
 	}
-	return res;
+	for (size_t i = 0; i < second.getTitle().size(); ++i) {
+		dictionaries.push_back(second.getDictionary(i));
+		columns.push_back(&second.getTitle().at(i));
+	}
+}
+size_t Schema::ordinalOf(const string& id) const {
+	auto it = ordinals.find(id);
+	return it == ordinals.end() ? g_NoSuchColumn : it->second;
+}
+const TextDictionary* Schema::dictionaryOf(const size_t ordinal) const {
+	return ordinal < dictionaries.size() ? dictionaries[ordinal] : nullptr;
+}
+const Term* Schema::columnOf(const size_t ordinal) const {
+	return ordinal < columns.size() ? columns[ordinal] : nullptr;
+}
+
+const TextEntry* TextDictionary::intern(const string& text) {
+	// 只有持有写者锁的线程会改动索引，这里查找不必加锁
+	auto it = index.find(text);
+	if (it != index.end()) return it->second;
+	unique_lock<shared_mutex> lock(index_mutex);
+	entries.push_back(TextEntry{text, textPrefixKey(text), this, entries.size()});
+	const TextEntry* entry = &entries.back();
+	index.emplace(string_view(entry->text), entry);
+	return entry;
+}
+uint64_t textPrefixKey(const string_view text) {
+	unsigned char bytes[8] = {0};
+	if (text.size() > 1) std::memcpy(bytes, text.data() + 1, std::min<size_t>(8, text.size() - 1));
+	uint64_t key = 0;
+	for (unsigned char byte : bytes) key = (key << 8) | byte;
+	return key;
+}
+uint64_t doubleZoneKey(double value) {
+	if (value == 0) value = 0;				// -0与0相等，取同一个键
+	uint64_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	// 负数按位取反（绝对值越大越小），非负数把符号位置1（排在所有负数之后）
+	return (bits >> 63) != 0 ? ~bits : (bits | (uint64_t(1) << 63));
+}
+const TextEntry* TextDictionary::find(const string_view text) const {
+	shared_lock<shared_mutex> lock(index_mutex);
+	auto it = index.find(text);
+	return it == index.end() ? nullptr : it->second;
 }
 
-bool Term::operator< (const Term term) const {
+Term::Term(const string v, const kwstring term):value(v),type(value_class::text),f_Encoded(false) {
+	if (term.str() == keywords::integer) type = value_class::integer;
+	else if (term.str() == keywords::_float) type = value_class::floating;
+	else if (term.str() == keywords::variable) type = value_class::variable;
+}
+Term::Term(const Term& term):type(term.type),f_Encoded(term.f_Encoded) {
+	if (f_Encoded) code = term.code;
+	else new (&value) string(term.value);
+}
+Term::Term(Term&& term) noexcept:type(term.type),f_Encoded(term.f_Encoded) {
+	if (f_Encoded) code = term.code;
+	else new (&value) string(std::move(term.value));
+}
+Term::~Term() {
+	if (!f_Encoded) value.~string();
+}
+uint64_t Term::zoneKey() const {
+	if (type == value_class::text) return prefixKey();
+	return doubleZoneKey(stringToDouble(value));
+}
+bool Term::operator< (const Term& term) const {
 	if (!isCompatibleWith(term)) {
-		throw InvalidArgument(i18n::parseKey("incmpttypes", {type, term.type}));
+		throw InvalidArgument(i18n::parseKey(msg_id::incmpttypes, {getType(), term.getType()}));
 	}
-	if (type == keywords::text) {
-		return value < term.value;
+	if (type == value_class::text) {
+		if (f_Encoded and term.f_Encoded and code == term.code) return false;
+		uint64_t first = prefixKey(), second = term.prefixKey();
+		if (first != second) return first < second;
+		return getValue() < term.getValue();
 	}
 	else {
 		double v1 = stringToDouble(value);
@@ -295,24 +999,30 @@ bool Term::operator< (const Term term) const {
 		return v1 < v2;
 	}
 }
-bool Term::operator== (const Term term) const {
+bool Term::operator== (const Term& term) const {
 	if (!isCompatibleWith(term)) {
-		throw InvalidArgument(i18n::parseKey("incmpttypes", {type, term.type}));
+		throw InvalidArgument(i18n::parseKey(msg_id::incmpttypes, {getType(), term.getType()}));
 	}
-	if (type == keywords::text) {
-		return value == term.value;
+	if (type == value_class::text) {
+		// 编码到同一个字典中的两个值，只需比较编码。两表连接时两边的值来自不同的字典，用不上这一点：
+		// 连接键由evalInnerJoin、mergeJoinInto先在内层的字典中查到编码再比较，where子句中跨表的文本比较仍比较字符串
+		if (f_Encoded and term.f_Encoded and code->owner == term.code->owner) return code == term.code;
+		return getValue() == term.getValue();
 	}
 	else {
 		double difference = stringToDouble(value) - stringToDouble(term.value);
 		return (difference > -g_DoubleEqCritDelta and difference < g_DoubleEqCritDelta);
 	}
 }
-bool Term::operator> (const Term term) const {
+bool Term::operator> (const Term& term) const {
 	if (!isCompatibleWith(term)) {
-		throw InvalidArgument(i18n::parseKey("incmpttypes", {type, term.type}));
+		throw InvalidArgument(i18n::parseKey(msg_id::incmpttypes, {getType(), term.getType()}));
 	}
-	if (type == keywords::text) {
-		return value > term.value;
+	if (type == value_class::text) {
+		if (f_Encoded and term.f_Encoded and code == term.code) return false;
+		uint64_t first = prefixKey(), second = term.prefixKey();
+		if (first != second) return first > second;
+		return getValue() > term.getValue();
 	}
 	else {
 		double v1 = stringToDouble(value);
@@ -320,137 +1030,201 @@ bool Term::operator> (const Term term) const {
 		return v1 > v2;
 	}
 }
-bool Term::operator!= (const Term term) const {
+bool Term::operator!= (const Term& term) const {
 	return !((*this) == term);
 }
-Term Term::operator+ (const Term term) const {
+Term Term::operator+ (const Term& term) const {
 	if (!isCompatibleWith(term)) {
-		throw InvalidArgument(i18n::parseKey("incmpttypes", {type, term.type}));
+		throw InvalidArgument(i18n::parseKey(msg_id::incmpttypes, {getType(), term.getType()}));
 	}
-	if (type == keywords::text) {
-		return Term(value.substr(0,value.size()-1)+term.value.substr(1), keywords::text);
+	if (type == value_class::text) {
+		// 两个字符串都带着单引号，去掉前者的右引号和后者的左引号直接拼接
+		const string& first = getValue();
+		const string& second = term.getValue();
+		string res;
+		res.append(first, 0, first.size() - 1).append(second, 1, string::npos);
+		return Term(res, keywords::text);
 	}
 	else {
-		if (type == keywords::integer and term.type == keywords::integer) {
-			return Term(to_string(stringToInt(value) + stringToInt(term.value)),keywords::integer);
+		if (type == value_class::integer and term.type == value_class::integer) {
+			int64_t res;
+			if (__builtin_add_overflow(stringToInt(value), stringToInt(term.value), &res)) throwIntegerOverflow(*this, symbols::plus, term);
+			return Term(to_string(res),keywords::integer);
 		}
 		else {
 			return Term(to_string(stringToDouble(value) + stringToDouble(term.value)),keywords::_float);
 		}
 	}
 }
-Term Term::operator- (const Term term) const {
-	if (type == keywords::text or term.type == keywords::text) {
-		throw InvalidArgument(i18n::parseKey("incmpttypes", {type, term.type}));
+Term Term::operator- (const Term& term) const {
+	if (type == value_class::text or term.type == value_class::text) {
+		throw InvalidArgument(i18n::parseKey(msg_id::incmpttypes, {getType(), term.getType()}));
 	}
-	if (type == keywords::integer and term.type == keywords::integer) {
-		return Term(to_string(stringToInt(value) - stringToInt(term.value)),keywords::integer);
+	if (type == value_class::integer and term.type == value_class::integer) {
+		int64_t res;
+		if (__builtin_sub_overflow(stringToInt(value), stringToInt(term.value), &res)) throwIntegerOverflow(*this, symbols::minus, term);
+		return Term(to_string(res),keywords::integer);
 	}
 	else {
 		return Term(to_string(stringToDouble(value) - stringToDouble(term.value)),keywords::_float);
 	}
 }
-Term Term::operator* (const Term term) const {
-	if (type == keywords::text or term.type == keywords::text) {
-		throw InvalidArgument(i18n::parseKey("incmpttypes", {type, term.type}));
+Term Term::operator* (const Term& term) const {
+	if (type == value_class::text or term.type == value_class::text) {
+		throw InvalidArgument(i18n::parseKey(msg_id::incmpttypes, {getType(), term.getType()}));
 	}
-	if (type == keywords::integer and term.type == keywords::integer) {
-		return Term(to_string(stringToInt(value) * stringToInt(term.value)),keywords::integer);
+	if (type == value_class::integer and term.type == value_class::integer) {
+		int64_t res;
+		if (__builtin_mul_overflow(stringToInt(value), stringToInt(term.value), &res)) throwIntegerOverflow(*this, symbols::times, term);
+		return Term(to_string(res),keywords::integer);
 	}
 	else {
 		return Term(to_string(stringToDouble(value) * stringToDouble(term.value)),keywords::_float);
 	}
 }
-Term Term::operator/ (const Term term) const {
-	if (type == keywords::text or term.type == keywords::text) {
-		throw InvalidArgument(i18n::parseKey("incmpttypes", {type, term.type}));
+Term Term::operator/ (const Term& term) const {
+	if (type == value_class::text or term.type == value_class::text) {
+		throw InvalidArgument(i18n::parseKey(msg_id::incmpttypes, {getType(), term.getType()}));
 	}
 	if (stringToDouble(term.value) == 0) {
-		throw InvalidArgument(i18n::parseKey("divzero"));
+		throw InvalidArgument(i18n::parseKey(msg_id::divzero));
 	}
-	if (type == keywords::integer and term.type == keywords::integer) {
-		return Term(to_string(stringToInt(value) / stringToInt(term.value)),keywords::integer);
+	if (type == value_class::integer and term.type == value_class::integer) {
+		int64_t first = stringToInt(value), second = stringToInt(term.value);
+		if (first == INT64_MIN and second == -1) throwIntegerOverflow(*this, symbols::divides, term);	// 唯一一种整除溢出
+		return Term(to_string(first / second),keywords::integer);
 	}
 	else {
 		return Term(to_string(stringToDouble(value) / stringToDouble(term.value)),keywords::_float);
 	}
 }
-Term Term::operator% (const Term term) const {
-	if (type == keywords::text or term.type == keywords::text) {
-		throw InvalidArgument(i18n::parseKey("incmpttypes", {type, term.type}));
+Term Term::operator% (const Term& term) const {
+	if (type == value_class::text or term.type == value_class::text) {
+		throw InvalidArgument(i18n::parseKey(msg_id::incmpttypes, {getType(), term.getType()}));
 	}
 	if (stringToDouble(term.value) == 0) {
-		throw InvalidArgument(i18n::parseKey("divzero"));
+		throw InvalidArgument(i18n::parseKey(msg_id::divzero));
 	}
-	if (type == keywords::integer and term.type == keywords::integer) {
-		return Term(to_string(stringToInt(value) % stringToInt(term.value)),keywords::integer);
+	if (type == value_class::integer and term.type == value_class::integer) {
+		int64_t first = stringToInt(value), second = stringToInt(term.value);
+		// INT64_MIN % -1在数学上是0，但直接计算会因为商溢出而出错
+		return Term(to_string(second == -1 ? 0 : first % second),keywords::integer);
 	}
 	else {
 		return Term(to_string(fmod(stringToDouble(value) , stringToDouble(term.value))),keywords::_float);
 	}
 }
-Term Term::operator= (const Term term) {
+void throwIntegerOverflow(const Term& first, const string& op, const Term& second) {
+	throw InvalidArgument(i18n::parseKey(msg_id::intoverflow, {first.getValue() + " " + op + " " + second.getValue()}));
+}
+Term& Term::operator= (const Term& term) {
 	type = term.type;
-	value = term.value;
+	if (term.f_Encoded) setCode(term.code);
+	else if (!f_Encoded) value = term.value;
+	else {
+		new (&value) string(term.value);
+		f_Encoded = false;
+	}
 	return *this;
 }
-bool Term::isCompatibleWith (const Term term) const {
-	if (
-		(type == keywords::text and term.type != keywords::text)
-	or	(type != keywords::text and term.type == keywords::text)
-	) {
-		return false;
+Term& Term::operator= (Term&& term) noexcept {
+	type = term.type;
+	if (term.f_Encoded) setCode(term.code);
+	else if (!f_Encoded) value = std::move(term.value);
+	else {
+		new (&value) string(std::move(term.value));
+		f_Encoded = false;
 	}
-	return true;
+	return *this;
+}
+void Term::setCode(const TextEntry* entry) {
+	if (!f_Encoded) value.~string();
+	code = entry;
+	f_Encoded = true;
+}
+bool Term::isCompatibleWith (const Term& term) const {
+	return (type == value_class::text) == (term.type == value_class::text);
 }
 bool Term::doesFitType() const {
-	string real_type = parseValueType(value);
-	if (type == keywords::integer or type == keywords::_float) {
-		return real_type == keywords::_float or real_type == keywords::integer;
+	value_class real_class = classifyValue(getValue());
+	if (type == value_class::integer or type == value_class::floating) {
+		return real_class == value_class::floating or real_class == value_class::integer;
 	}
-	else return real_type == type;
+	return real_class == type;
+}
+const string& Term::getValue() const {
+	return f_Encoded ? code->text : value;
+}
+const TextEntry* Term::getCode() const {
+	return f_Encoded ? code : nullptr;
 }
-string Term::getValue() const {
-	return value;
+uint64_t Term::prefixKey() const {
+	return f_Encoded ? code->prefix : textPrefixKey(value);
 }
-string Term::getType() const {
-	return type;
+const string& Term::getType() const {
+	return typeName(type);
 }
-Term& Term::setValue(const string v) {
-	value = v;
+Term& Term::setValue(const string_view v) {
+	if (f_Encoded) {
+		new (&value) string(v);
+		f_Encoded = false;
+	}
+	else value.assign(v);
 	if(!doesFitType()) {
-		throw InvalidArgument(i18n::parseKey("vnfitt", {v, type}));
+		throw InvalidArgument(i18n::parseKey(msg_id::vnfitt, {value, getType()}));
+	}
+	int64_t temp;
+	if (type == value_class::integer and !parseInt64(value, temp)) {
+		throw InvalidArgument(i18n::parseKey(msg_id::intoverflow, {value}));
 	}
 	return *this;
 }
+Term& Term::setValueFrom(const Term& term) {
+	if (!term.f_Encoded) return setValue(term.value);
+	// 编码过的值一定是文本，兼容的类型也只有文本，不必再检查
+	setCode(term.code);
+	return *this;
+}
 Term& Term::setType(const string term) {
-	if (term == keywords::integer) type = keywords::integer.str();
-	else if (term == keywords::_float) type = keywords::_float.str();
-	else if (term == keywords::text) type = keywords::text.str();
-	else if (term == keywords::variable) type = keywords::variable.str();
-	else throw InvalidArgument(i18n::parseKey("unacptvt", {term}));
+	if (term == keywords::integer) type = value_class::integer;
+	else if (term == keywords::_float) type = value_class::floating;
+	else if (term == keywords::text) type = value_class::text;
+	else if (term == keywords::variable) type = value_class::variable;
+	else throw InvalidArgument(i18n::parseKey(msg_id::unacptvt, {term}));
 	return *this;
 }
+void Term::encode(TextDictionary& dictionary) {
+	if (type != value_class::text) return;
+	if (f_Encoded and code->owner == &dictionary) return;
+	setCode(dictionary.intern(getValue()));	// 字符串已经存进字典，单元格里的副本随之释放
+}
+void Term::encodeExisting(const TextDictionary& dictionary) {
+	if (type != value_class::text) return;
+	const TextEntry* entry = dictionary.find(getValue());
+	if (entry == nullptr) return;
+	setCode(entry);
+}
 void Term::print(ostream& os) const {
-	if (type == keywords::integer)	os << stringToInt(value);
-	else if (type == keywords::_float)	os << std::fixed << std::setprecision(2) << stringToDouble(value);
-	else if (type == keywords::text) {
-		if (value.size() <= 2) os << "''";
-		else os << '\'' << value.substr(1,value.size()-2) << '\'';
+	const string& v = getValue();
+	if (type == value_class::integer)	os << stringToInt(v);
+	else if (type == value_class::floating)	os << std::fixed << std::setprecision(2) << stringToDouble(v);
+	else if (type == value_class::text) {
+		if (v.size() <= 2) os << "''";
+		else os << '\'' << string_view(v).substr(1,v.size()-2) << '\'';
 	}
-	else os << value;
+	else os << v;
+}
+const string& typeName(const value_class type) {
+	static const string names[] = {keywords::integer.str(), keywords::_float.str(), keywords::text.str(), keywords::variable.str()};
+	return names[static_cast<int>(type)];
 }
 
-// 注意：该函数的invalid_argument是std::~而不是minidb::InvalidArgument。这是利用“stoi/stod在解析失败时抛出该异常”进行类型判断。
 string parseValueType(const string value) {
-	try {
-		stod(value);
-		if (value.find('.') != string::npos) return keywords::_float.str();
-		else return keywords::integer.str();
-	}
-	catch (invalid_argument& e) {		
-		if (value.size() != 0 and value.at(0) == '\'') return keywords::text.str();
-		else return keywords::variable.str();
+	switch (classifyValue(value)) {
+		case value_class::integer:	return keywords::integer.str();
+		case value_class::floating:	return keywords::_float.str();
+		case value_class::text:		return keywords::text.str();
+		default:					return keywords::variable.str();
 	}
 }
 
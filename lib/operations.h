@@ -6,251 +6,408 @@
 #define __OPERATIONS_MINIDB_H__
 
 #include "calculator.h"
+#include "exporter.h"
+#include "extsort.h"
+#include "transaction.h"
 
 namespace minidb {
 
-#ifndef __PRINT_FINAL_SEPARATOR__
-	bool gf_isFirst = true;
-#endif
-
-void runStCreateDatabase(const vstring);
-void runStUseDatabase(const vstring);
-void runStCreateTable(const vstring);
-void runStDropTable(const vstring);
-void runStInsertion(const vstring);
-void runStInnerJoin(const vstring, ostream&);
-void runStSelection(const vstring, ostream&);
-void runStUpdate(const vstring);
-void runStDeleteFrom(const vstring);
-
-bool fitsWhereRequirement(const Row, const vstring);
-
-bool fitsWhereRequirement(const Row r, const vstring conditions) {
-	typedef ComparisonExpression cmpex;
-	typedef vector<cmpex> vcmpex;
-
-	Row row = r;
-
-	vstring ops = {};
-	vcmpex expressions (conditions.size()/4+1);
-
-	int index = 0;
-	for (string str : conditions) {
-		switch (index % 4) {
-			case 0:		// 左值
-				do {
-					Term term;
-					string type = parseValueType(str);
-					if (type != keywords::variable) {
-						term.setType(type).setValue(str);
-					}
-					else {
-						term = row.findTerm(str);
-					}
-					expressions.at(index/4).setFirst(term);
-				} while (false);
-				break;
-			case 1:		// 比较运算符
-				expressions.at(index/4).setOp(str);
-				break;
-			case 2:		// 右值
-				do {
-					Term term;
-					string type = parseValueType(str);
-					if (type != keywords::variable) {
-						term.setType(type).setValue(str);
-					}
-					else {
-						term = row.findTerm(str);
-					}
-					expressions.at(index/4).setSecond(term);
-				} while (false);
-				break;
-			case 3:		// 可能存在的逻辑运算符
-				ops.push_back(str);
-				break;
-		}
-		++index;
-	}
+void runStCreateDatabase(const CreateDatabaseSt&);
+void runStUseDatabase(const UseDatabaseSt&);
+void runStCreateTable(const CreateTableSt&);
+void runStDropTable(const DropTableSt&, table_wlock&);	// 调用者已锁定这张表，删除前释放
+void runStInsertion(const InsertionSt&, Transaction&);
+void runStInnerJoin(const InnerJoinSt&, ostream&);
+void runStSelection(const SelectionSt&, ostream&);
+void runStUpdate(const UpdateSt&, Transaction&);
+void runStDeleteFrom(const DeleteFromSt&, Transaction&);
+void runStExport(const ExportSt&);
+void runStVacuum(const VacuumSt&);						// 调用者已独占目录锁并锁定这张表
+
+Table evalInnerJoin(const InnerJoinSt&);				// 执行inner join查询并返回结果表
+// 执行select查询并返回结果表
+// 标题行总是按查询列的顺序；结果行中的值默认按原表中列的顺序排列（与select一贯的输出相同），
+// 第二个参数为true时也按查询列的顺序排列，与标题行一一对应，并且查询原表中没有的列时报错（导出时使用）
+Table evalSelection(const SelectionSt&, const bool = false);
+void printSelectionResult(const Table&, ostream&);		// 输出查询结果以及分隔线
+void printSelectionSeparator(ostream&);					// 输出查询结果之后的分隔线
+
+// where子句中的列名换成序号之后的结果，每条语句执行前建立一次，放在内存池中
+// 常量与文本列比较时，常量预先编码到这一列的字典中（字典中有这个字符串的话），逐行比较相等时只比较编码；
+// 字典中没有的常量编码到BoundWhere自己的字典中，这样逐行比较大小时也不必每次现算常量的前缀键
+struct BoundCondition {
+	const Condition* condition;
+	size_t first;						// 两侧是列时的序号，不存在的列为g_NoSuchColumn，等到真正取值时才报错
+	size_t second;
+	Term literal_first;					// 两侧是常量时的值
+	Term literal_second;
+};
+struct BoundWhere {
+	std::pmr::vector<BoundCondition> conditions;
+	const vector<keyword_index>* connectives;
+	std::unique_ptr<TextDictionary> literals;	// 列字典中没有的文本常量
+};
+
+BoundWhere bindWhereClause(const WhereClause&, const Schema&);
+// 由绑定好的where子句得到一张表的块过滤条件（见objects.h中的ZoneFilter），这张表的列在schema中的序号从第三个参数开始
+ZoneFilter compileZoneFilter(const BoundWhere&, const Schema&, const size_t, const size_t);
+bool isWhereInfallible(const BoundWhere&, const Schema&);	// where子句逐行判断时是否一定不会报错（列都存在、类型都兼容）
+
+// inner join的运行时过滤：先扫描一遍内层表，把连接键放进Bloom过滤器，再下推到外层表的扫描中。
+// 外层某一行的连接键一定不在过滤器中时，内层没有与它相等的键，整趟内层扫描连同其中逐对行的where判断都可以省去。
+// 数值的相等允许g_DoubleEqCritDelta的误差：放入的是键向下取整的值，查询时取键加减两倍误差后向下取整，至多两个不同的值都查一遍。
+class JoinKeyFilter {
+	private:
+		BloomFilter bloom;
+		bool f_isText;
+		static uint64_t numericHash(double);
+	public:
+		JoinKeyFilter(const std::pmr::vector<uint64_t>&, const bool);	// 参数为内层各行的hashOf以及键是否是文本
+		bool mayContain(const Term&) const;
+		static uint64_t hashOf(const Term&, const bool);
+};
 
-	// 不支持括号，不支持短路
-	bool result = expressions.at(0).result();
-	expressions.erase(expressions.begin());
-	for (size_t i = 0; i < ops.size(); ++i) {
-		string op = ops.at(i);
-		cmpex expr = expressions.at(i);
-		clog << op << endl;
-		if (op == keywords::_and) {
-			result = result and expr.result();
+/**
+ * 排序合并连接（sort-merge join）
+ * 两张表各扫描一遍，记下每一行的引用和连接键，用外部排序器（见extsort.h）按连接键排序，再两边同时按键的顺序前进：
+ * 外层的每个键，在内层中与它相等的键是连续的一段。数值的相等允许g_DoubleEqCritDelta的误差，但外层键与内层键之差随内层键单调，
+ * 这一段仍然连续，并且随着外层键增大只会向后移动，不必回头，所以内层只需在一个窗口中保留当前这一段。
+ * 文本键先在内层的字典中查到条目，排序和比较只用条目的前缀键和序号，外层中查不到的行不会有匹配，直接略去。
+ * 段内的每一对行再判断where子句。满足条件的一对行按（外层位置，内层位置）排序之后才组装，结果的顺序与嵌套循环完全相同。
+ * 这几次排序都受内存预算约束，数据量超出预算时溢出到磁盘；本来就有序时不排序。
+ * 行只保存引用：扫描前先取得两张表的块列表（见Table::pin），合并完之前其中的版本不会被回收。
+ * 规划：where子句和连接键的比较都不会报错、并且两表行数之积不小于g_MergeJoinMinPairs时使用，否则用嵌套循环。
+ * 行数用Table::estimateRows估计，只数行槽，不扫描版本链。
+ */
+const size_t g_MergeJoinMinPairs = 1 << 16;
+struct JoinSide {						// 参与连接的一张表
+	const Table* table;
+	const ZoneFilter* filter;
+	size_t key;							// 连接键在这张表中的序号
+};
+void mergeJoinInto(Table&, const Row&, const std::pmr::vector<size_t>&, const JoinSide&, const JoinSide&, const bool, const BoundWhere&, const Snapshot&);
+// 以下三个函数中的R为Row或JoinedRow，按序号读取行中的项
+template <typename R> bool fitsWhereRequirement(const R&, const BoundWhere&);
+template <typename R> const Term& resolveOperand(const R&, const Operand&, const size_t, const Term&);	// 操作数是列名时取该行对应的值，否则就是（编码过的）常量
+template <typename R> const Term& columnAt(const R&, const size_t, const string&);			// 取某一列的值，没有这一列时按列名报错
+
+BoundWhere bindWhereClause(const WhereClause& where, const Schema& schema) {
+	BoundWhere res{std::pmr::vector<BoundCondition>(&getStatementArena()), &where.connectives, std::make_unique<TextDictionary>()};
+	for (const Condition& cond : where.conditions) {
+		BoundCondition bound{
+			&cond,
+			cond.first.f_isColumn ? schema.ordinalOf(cond.first.name) : g_NoSuchColumn,
+			cond.second.f_isColumn ? schema.ordinalOf(cond.second.name) : g_NoSuchColumn,
+			cond.first.literal,
+			cond.second.literal
+		};
+		auto encodeLiteral = [&schema, &res](Term& literal, const size_t column) {
+			const TextDictionary* dictionary = schema.dictionaryOf(column);
+			if (dictionary == nullptr) return;
+			literal.encodeExisting(*dictionary);
+			if (literal.getCode() == nullptr) literal.encode(*res.literals);
+		};
+		if (!cond.first.f_isColumn and cond.second.f_isColumn) encodeLiteral(bound.literal_first, bound.second);
+		if (cond.first.f_isColumn and !cond.second.f_isColumn) encodeLiteral(bound.literal_second, bound.first);
+		res.conditions.push_back(std::move(bound));
+	}
+	return res;
+}
+bool isWhereInfallible(const BoundWhere& where, const Schema& schema) {
+	auto typeOf = [&schema](const Operand& operand, const size_t ordinal, const Term& literal) {
+		return operand.f_isColumn ? schema.columnOf(ordinal) : &literal;
+	};
+	for (const BoundCondition& bound : where.conditions) {
+		const Condition& cond = *bound.condition;
+		const Term* first = typeOf(cond.first, bound.first, bound.literal_first);
+		const Term* second = typeOf(cond.second, bound.second, bound.literal_second);
+		if (first == nullptr or second == nullptr or !first->isCompatibleWith(*second) or !isValidCmpOp(cond.op)) return false;
+	}
+	return true;
+}
+ZoneFilter compileZoneFilter(const BoundWhere& where, const Schema& schema, const size_t begin, const size_t columns) {
+	// 跳过一个块，也就跳过了对其中每一行的比较。比较式可能在逐行比较时报错时不跳过任何块，让错误照旧在第一行上报出来
+	if (!isWhereInfallible(where, schema)) return ZoneFilter();
+	ZoneFilter res;
+	for (size_t i = 0; i < where.conditions.size(); ++i) {
+		const BoundCondition& bound = where.conditions.at(i);
+		const Condition& cond = *bound.condition;
+		keyword_index connective = (i == 0 ? keyword_index::unexpected : where.connectives->at(i-1));
+		size_t column = g_NoSuchColumn;
+		const Term* literal = nullptr;
+		string op = cond.op;
+		if (cond.first.f_isColumn and !cond.second.f_isColumn) {
+			column = bound.first;
+			literal = &bound.literal_second;
 		}
-		else if (op == keywords::_or) {
-			result = result or expr.result();
+		else if (!cond.first.f_isColumn and cond.second.f_isColumn) {
+			// 常量在左侧时把比较式左右交换
+			column = bound.second;
+			literal = &bound.literal_first;
+			if (op == symbols::less) op = symbols::greater;
+			else if (op == symbols::greater) op = symbols::less;
 		}
-		else if (op == keywords::_xor) {
-			result = result xor expr.result();
+		if (column != g_NoSuchColumn and column >= begin and column < begin + columns) {
+			res.addTest(column - begin, op, *literal, connective);
 		}
+		else res.addUnknown(connective);
 	}
-	return result;
+	return res;
 }
-void runStDeleteFrom(const vstring params) {
-	Database& database = getCurrentDatabase();
-	
-	string table_name = params.at(0);
-	Table& table = database.findTable(table_name);
+JoinKeyFilter::JoinKeyFilter(const std::pmr::vector<uint64_t>& hashes, const bool f_text):bloom(hashes.size()),f_isText(f_text) {
+	for (uint64_t hash : hashes) bloom.insert(hash);
+}
+uint64_t JoinKeyFilter::numericHash(double value) {
+	value = std::floor(value);
+	if (value == 0) value = 0;				// -0与0相等，取同一个值
+	uint64_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+uint64_t JoinKeyFilter::hashOf(const Term& key, const bool f_text) {
+	if (f_text) return std::hash<string_view>()(key.getValue());
+	return numericHash(stringToDouble(key.getValue()));
+}
+bool JoinKeyFilter::mayContain(const Term& key) const {
+	if (f_isText) return bloom.mayContain(hashOf(key, true));
+	// 与键相差不到g_DoubleEqCritDelta的值，向下取整之后只能是以下几个值之一（区间长度小于1）
+	double value = stringToDouble(key.getValue());
+	uint64_t low = numericHash(value - 2 * g_DoubleEqCritDelta), high = numericHash(value + 2 * g_DoubleEqCritDelta);
+	return bloom.mayContain(low) or (high != low and bloom.mayContain(high)) or bloom.mayContain(numericHash(value));
+}
+void mergeJoinInto(Table& result, const Row& title, const std::pmr::vector<size_t>& sources, const JoinSide& first, const JoinSide& second,
+	const bool f_isText, const BoundWhere& where, const Snapshot& snap) {
+	// 文本键换成内层字典中的条目，按（前缀键, 条目序号）排序：两边相等的字符串对应同一个条目，
+	// 排出来的顺序虽然不是字典序，但两边一致，足以归并。这样键只有定长的整数，溢出到磁盘时不需要字符串留在内存中
+	struct Entry {
+		double number;					// 数值键
+		uint64_t prefix;				// 文本键：前缀键
+		size_t ordinal;					// 文本键：在内层字典中的序号
+		size_t position;				// 行在扫描顺序中的位置
+	};
+	struct Match {						// 满足条件的一对行
+		size_t outer;
+		size_t inner;
+	};
+	auto textLess = [](const Entry& a, const Entry& b) {
+		return a.prefix != b.prefix ? a.prefix < b.prefix : a.ordinal < b.ordinal;
+	};
+	auto keyLess = [f_isText, textLess](const Entry& a, const Entry& b) {
+		return f_isText ? textLess(a, b) : a.number < b.number;
+	};
+	auto matchLess = [](const Match& a, const Match& b) {
+		return a.outer != b.outer ? a.outer < b.outer : a.inner < b.inner;
+	};
+	typedef ExternalSorter<Entry, decltype(keyLess)> entry_sorter;
+	struct SortedSide {
+		pinned_blocks blocks;
+		std::pmr::vector<const Row*> rows{&getStatementArena()};
+	};
+	const TextDictionary* dictionary = f_isText ? second.table->getDictionary(second.key) : nullptr;
+	auto collect = [&](const JoinSide& side, SortedSide& res, entry_sorter& sorter) {
+		res.blocks = side.table->pin();
+		side.table->scan(snap, [&](const Row& row) {
+			const Term& key = row.at(side.key);
+			Entry entry{0, 0, 0, res.rows.size()};
+			if (f_isText) {
+				// 内层的值已经编码到这个字典中；外层的值在字典中查不到，内层就没有与它相等的键
+				const TextEntry* code = (key.getCode() != nullptr and key.getCode()->owner == dictionary) ? key.getCode() : dictionary->find(key.getValue());
+				if (code == nullptr) return;
+				entry.prefix = code->prefix;
+				entry.ordinal = code->ordinal;
+			}
+			else entry.number = stringToDouble(key.getValue());
+			sorter.push(entry);
+			res.rows.push_back(&row);
+		}, side.filter, res.blocks);
+		sorter.finish();
+	};
+	SortedSide outer, inner;
+	entry_sorter outer_keys(keyLess), inner_keys(keyLess);
+	collect(first, outer, outer_keys);
+	collect(second, inner, inner_keys);
+
+	// 内层键排在外层键所在的一段之前、之后
+	// 数值与Term::operator==相同：外层键减内层键落在(-δ, δ)之内即相等
+	auto isBelow = [f_isText, textLess](const Entry& in, const Entry& out) {
+		return f_isText ? textLess(in, out) : out.number - in.number >= g_DoubleEqCritDelta;
+	};
+	auto isAbove = [f_isText, textLess](const Entry& in, const Entry& out) {
+		return f_isText ? textLess(out, in) : out.number - in.number <= -g_DoubleEqCritDelta;
+	};
+	ExternalSorter<Match, decltype(matchLess)> matches(matchLess);
+	std::deque<Entry> window;			// 内层中与当前外层键相等的一段
+	Entry entry, pending;
+	bool f_hasPending = false;			// pending中是否有读出来还没放进窗口的内层键
+	while (outer_keys.next(entry)) {
+		while (!window.empty() and isBelow(window.front(), entry)) window.pop_front();
+		while (f_hasPending or (f_hasPending = inner_keys.next(pending))) {
+			if (isAbove(pending, entry)) break;
+			if (!isBelow(pending, entry)) window.push_back(pending);
+			f_hasPending = false;
+		}
+		for (const Entry& in : window) {
+			if (fitsWhereRequirement(JoinedRow(*outer.rows[entry.position], *inner.rows[in.position]), where)) {
+				matches.push(Match{entry.position, in.position});
+			}
+		}
+	}
 
-	vstring conditions = params;
-	conditions.erase(conditions.begin());
+	matches.finish();
+	Match match;
+	while (matches.next(match)) {
+		JoinedRow joined(*outer.rows[match.outer], *inner.rows[match.inner]);
+		Row res_row = title;
+		for (size_t i = 0; i < sources.size(); ++i) {
+			res_row.setTermAt(i, joined.at(sources.at(i)));
+		}
+		result.insertRow(res_row);
+	}
+}
+template <typename R> const Term& columnAt(const R& row, const size_t ordinal, const string& name) {
+	if (ordinal == g_NoSuchColumn) throw InvalidArgument(i18n::parseKey(msg_id::nosuchterm, {name}));
+	return row.at(ordinal);
+}
+template <typename R> const Term& resolveOperand(const R& row, const Operand& operand, const size_t ordinal, const Term& literal) {
+	if (operand.f_isColumn) return columnAt(row, ordinal, operand.name);
+	return literal;
+}
+template <typename R> bool fitsWhereRequirement(const R& row, const BoundWhere& where) {
+	if (where.conditions.empty()) return true;
 
-	int index = 0;
-	vector<int> indices;
-	for (Row row : table.getRaw()) {
-		if (fitsWhereRequirement(row, conditions)) {
-			indices.push_back(index);
+	// 不支持括号，不支持短路
+	auto evalCondition = [&row](const BoundCondition& bound) {
+		const Condition& cond = *bound.condition;
+		return compareTerms(resolveOperand(row, cond.first, bound.first, bound.literal_first),
+							resolveOperand(row, cond.second, bound.second, bound.literal_second), cond.op);
+	};
+	const vector<keyword_index>& connectives = *where.connectives;
+	bool result = evalCondition(where.conditions.at(0));
+	for (size_t i = 0; i < connectives.size(); ++i) {
+		bool temp = evalCondition(where.conditions.at(i+1));
+		switch (connectives.at(i)) {
+			case keyword_index::_and:	result = result and temp;	break;
+			case keyword_index::_or:	result = result or temp;	break;
+			case keyword_index::_xor:	result = result xor temp;	break;
+			default:					break;
 		}
-		++index;
 	}
-	for (auto it = indices.rbegin(); it != indices.rend(); ++it) {
-		// 从后向前移除，因为移除前项index会导致后项index改变，进而导致越界
-		table.removeRow(*it);
+	#ifdef __ENABLE_TRACE__
+		logLazy(log_level::trace, [&row, result](ostream& os) {
+			std::ostringstream row_text;
+			row.print(row_text);
+			os << endl << i18n::parseKey(msg_id::t_whererow, {result ? "true" : "false", row_text.str()}) << endl;
+		});
+	#endif
+	return result;
+}
+void runStDeleteFrom(const DeleteFromSt& st, Transaction& txn) {
+	Database& database = getCurrentDatabase();
+	
+	Table& table = database.findTable(st.table);
+	// 写者锁保证同一张表上没有其他事务在写，读语句照常进行，看到的是删除前的内容，直到事务提交
+	WriteBatch& batch = txn.lockForWrite(table, st.table);
+	Schema schema(table);
+	BoundWhere where = bindWhereClause(st.where, schema);
+	ZoneFilter filter = compileZoneFilter(where, schema, 0, table.getTitle().size());
+
+	SnapshotGuard guard(batch.getMarker());
+	std::pmr::vector<RowSlot*> matches(&getStatementArena());
+	table.scanVersions(guard.get(), [&](RowSlot& slot, RowVersion& version) {
+		if (fitsWhereRequirement(version.row, where)) matches.push_back(&slot);
+	}, &filter);
+	for (RowSlot* p_slot : matches) {
+		table.deleteRow(*p_slot, batch);
 	}
 }
-void runStUpdate(const vstring params) {
+void runStUpdate(const UpdateSt& st, Transaction& txn) {
 	Database& database = getCurrentDatabase();
 	
-	string table_name = params.at(0);
-	Table& table = database.findTable(table_name);
+	Table& table = database.findTable(st.table);
+	WriteBatch& batch = txn.lockForWrite(table, st.table);
 
-	vstring assignments;
-	vstring conditions;
-	string asgn_str = "";
-	auto it = params.begin()+1;
-	for (; it != params.end(); ++it) {
-		if  (*it == keywords::set) continue; 
-		if (*it == symbols::next or *it == keywords::where) {
-			assignments.push_back(asgn_str);
-			asgn_str = "";
-			if (*it == keywords::where) {
-				++it;
-				break;
-			}
-			continue;
-		}
-		asgn_str = asgn_str + (*it) + " ";
-	}
-	for (; it != params.end(); ++it) {
-		conditions.push_back(*it);
-	}
+	Schema schema(table);
+	BoundWhere where = bindWhereClause(st.where, schema);
+	ZoneFilter filter = compileZoneFilter(where, schema, 0, table.getTitle().size());
 
 	// 以下是更新数据的部分
-	for (Row& row : table.getRaw()) {
-		if (!fitsWhereRequirement(row, conditions)) continue;
-		for (string asgn : assignments) {
-			applyAsgnExpr(row, asgn);
+	// 不在原地修改，而是为每个匹配的行生成新版本；任何一个赋值出错时，事务回滚会撤销已写入的全部版本
+	SnapshotGuard guard(batch.getMarker());
+	std::pmr::vector<RowSlot*> matches(&getStatementArena());
+	table.scanVersions(guard.get(), [&](RowSlot& slot, RowVersion& version) {
+		if (fitsWhereRequirement(version.row, where)) matches.push_back(&slot);
+	}, &filter);
+	// 赋值表达式解析时已经转为后缀表达式，这里在第一个匹配的行上逐条把列名换成序号，之后的行直接复用；
+	// 没有匹配的行时不检查，出错的时机与逐行解析时相同
+	vector<CompiledAssignment> assignments;
+	for (RowSlot* p_slot : matches) {
+		Row row = p_slot->newest.load()->row;
+		for (size_t i = 0; i < st.assignments.size(); ++i) {
+			if (i == assignments.size()) assignments.push_back(bindAssignment(st.assignments.at(i), schema));
+			applyAsgnExpr(row, assignments.at(i));
 		}
+		table.replaceRow(*p_slot, row, batch);
 	}
 }
-void runStInnerJoin(const vstring params, ostream& os) {
+void runStInnerJoin(const InnerJoinSt& st, ostream& os) {
+	printSelectionResult(evalInnerJoin(st), os);
+}
+Table evalInnerJoin(const InnerJoinSt& st) {
 	Database& database = getCurrentDatabase();
 	
-	vstring columns;
-	string tabn_first, tabn_second;
-	vstring join_terms;
-	vstring conditions;
-	
-	int stage = 0;
-	for (string str : params) {
-		if (str == keywords::from) {
-			stage = 1;
-			continue;
-		}
-		if (str == "inner join") {
-			stage = 2;
-			continue;
-		}
-		if (str == "where") {
-			stage = 4;
-			continue;
-		}
-		switch(stage) {
-			case 0:
-				columns.push_back(str);
-				break;
-			case 1:
-				tabn_first = str;
-				break;
-			case 2:
-				tabn_second = str;
-				stage = 3;
-				break;
-			case 3:
-				join_terms.push_back(str);
-				break;
-			case 4:
-				conditions.push_back(str);
-				break;
-		}
-	}
+	const string& tabn_first = st.table_first;
+	const string& tabn_second = st.table_second;
 
 	// 检查表名的合法性
 	if (tabn_first == tabn_second) {
-		throw InvalidArgument(i18n::parseKey("invdupc", {tabn_first}));
+		throw InvalidArgument(i18n::parseKey(msg_id::invdupc, {tabn_first}));
 	}
 
-	string jtabn_first = join_terms.at(0), jtabn_second = join_terms.at(2);
+	const string& jtabn_first = st.on_first.table;
+	const string& jtabn_second = st.on_second.table;
 
 	if (jtabn_first != tabn_first and jtabn_first != tabn_second) {
 		string expt = "\"" + tabn_first + "\" or \"" + tabn_second + "\"";
-		throw InvalidArgument(i18n::parseKey("exptsthgotothers", {expt, jtabn_first}));
+		throw InvalidArgument(i18n::parseKey(msg_id::exptsthgotothers, {expt, jtabn_first}));
 	}
 	if (jtabn_second != tabn_first and jtabn_second != tabn_second) {
 		string expt = "\"" + tabn_first + "\" or \"" + tabn_second + "\"";
-		throw InvalidArgument(i18n::parseKey("exptsthgotothers", {expt, jtabn_second}));
+		throw InvalidArgument(i18n::parseKey(msg_id::exptsthgotothers, {expt, jtabn_second}));
 	}
 	if (jtabn_first == jtabn_second) {
 		if (jtabn_first == tabn_first) {
-			throw InvalidArgument(i18n::parseKey("dupclunre", {tabn_first, tabn_second}));
+			throw InvalidArgument(i18n::parseKey(msg_id::dupclunre, {tabn_first, tabn_second}));
 		}
 		else {
-			throw InvalidArgument(i18n::parseKey("dupclunre", {tabn_second, tabn_first}));
+			throw InvalidArgument(i18n::parseKey(msg_id::dupclunre, {tabn_second, tabn_first}));
 		}
 	}
 
 	// 找表
 	Table& table_first = database.findTable(jtabn_first);
 	Table& table_second = database.findTable(jtabn_second);
+	// 两张表用同一个快照读取，不加锁。处在显式事务中时，还能看到本事务尚未提交的写入
+	SnapshotGuard guard(getSessionMarker());
 	
 	// 检查列名，整理结果的标题行
 	Row title;
 	
 	vstring tabn, coln;
 
-	for (string str : columns) {
-		auto pos = str.find('.');
-		if (pos == string::npos) {
-			throw InvalidArgument(i18n::parseKey("nmemspec", {str}));
-		}
-		string table_name = str.substr(0,pos);
-		string column_name = str.substr(pos+1);
-		
-		if (table_name != tabn_first and table_name != tabn_second) {
+	// 列名的格式在解析时已经检查过
+	for (const ColumnRef& column : st.columns) {
+		if (column.table != tabn_first and column.table != tabn_second) {
 			string expt = "\"" + tabn_first + "\" or \"" + tabn_second + "\"";
-			throw InvalidArgument(i18n::parseKey("exptsthgotothers", {expt, table_name}));
-		}
-		if (!isValidVarName(table_name)) {
-			throw InvalidArgument(i18n::parseKey("unacptvarn", {table_name}));
+			throw InvalidArgument(i18n::parseKey(msg_id::exptsthgotothers, {expt, column.table}));
 		}
-		if (!isValidVarName(column_name) and column_name != symbols::fwildcard) {
-			throw InvalidArgument(i18n::parseKey("unacptvarn", {column_name}));
-		}
-
-		tabn.push_back(table_name);
-		coln.push_back(column_name);
+		tabn.push_back(column.table);
+		coln.push_back(column.column);
 	}
 
 	for (int i = 0, size = tabn.size(); i < size ; ++i) {
 		for (int j = i + 1; j < size ; ++j) {
 			if (coln.at(i) == coln.at(j)) {
-				throw InvalidArgument(i18n::parseKey("dupselterm", {coln.at(i)}));
+				throw InvalidArgument(i18n::parseKey(msg_id::dupselterm, {coln.at(i)}));
 			}
 		}
 	}
@@ -265,18 +422,18 @@ void runStInnerJoin(const vstring params, ostream& os) {
 			coln.erase(coln.begin() + i);
 			
 			if (doesContain(table_name, tabn)) {
-				throw InvalidArgument(i18n::parseKey("dupselwildc"));
+				throw InvalidArgument(i18n::parseKey(msg_id::dupselwildc));
 			}
 
 			// 展开通配符
-			for (psterm p_term : database.findTable(table_name).getTitle().getRaw()) {
+			for (const psterm& p_term : database.findTable(table_name).getTitle().getRaw()) {
 				tabn.push_back(table_name);
 				coln.push_back(p_term.first);
 			}
 		}
 		else {
 			// 检查是否确实存在此项，存在则不会抛异常
-			Term temp = database.findTable(table_name).getTitle().findTerm(column_name);
+			const Term& temp = database.findTable(table_name).getTitle().findTerm(column_name);
 			// 插入一个项到标题行。注意：本项目认为结果表中存在同名列也属于错误。
 			title.insertTerm(table_name + "." + column_name, temp);
 		}
@@ -286,67 +443,101 @@ void runStInnerJoin(const vstring params, ostream& os) {
 	// 结果表
 	Table result(title);
 
-	string jcoln_first = join_terms.at(1), jcoln_second = join_terms.at(3);
+	const string& jcoln_first = st.on_first.column;
+	const string& jcoln_second = st.on_second.column;
+
+	// 连接条件、where子句和结果的各列都在这里换成两行拼接后的序号
+	Schema schema(table_first, jtabn_first, table_second, jtabn_second);
+	BoundWhere where = bindWhereClause(st.where, schema);
+	// where子句中只涉及其中一张表的条件，可以用来跳过这张表中的块
+	size_t columns_first = table_first.getTitle().size();
+	ZoneFilter filter_first = compileZoneFilter(where, schema, 0, columns_first);
+	ZoneFilter filter_second = compileZoneFilter(where, schema, columns_first, table_second.getTitle().size());
+	size_t key_first = schema.ordinalOf(jtabn_first + "." + jcoln_first);
+	size_t key_second = schema.ordinalOf(jtabn_second + "." + jcoln_second);
+	std::pmr::vector<size_t> sources(&getStatementArena());
+	for (const psterm& p_term : title.getRaw()) {
+		sources.push_back(schema.ordinalOf(p_term.first));
+	}
 
-	for (Row row_first : table_first.getRaw()) {
-		for (Row row_second : table_second.getRaw()) {
-			Row union_row = mergeRowUnion(row_first, row_second, jtabn_first, jtabn_second);
-			if (stage == 4) {
-				if(!fitsWhereRequirement(union_row, conditions)) continue;
-			}
-			if (row_first.findTerm(jcoln_first) == row_second.findTerm(jcoln_second)) {
-				Row res_row = title;
-				res_row.mergeRowIntersect(row_first, jtabn_first).mergeRowIntersect(row_second, jtabn_second);
-				result.insertRow(res_row);
-			}
-		}
+	// 两个连接键都是文本列时，外层每一行先在内层连接键的字典中查到自己的编码，内层逐行只比较编码。
+	// 表中的文本都已编码，字典中查不到就说明内层没有相等的键
+	const TextDictionary* key_dictionary = nullptr;
+	if (key_first != g_NoSuchColumn and key_second != g_NoSuchColumn and schema.dictionaryOf(key_first) != nullptr) {
+		key_dictionary = schema.dictionaryOf(key_second);
 	}
 
-	result.print(os);
-	
-	#ifndef __PRINT_FINAL_SEPARATOR__	
-	// 输出
-	// 判别是否为第一次输出
-		if (gf_isFirst) gf_isFirst = false;
-		else {
-	#endif
-			os << "---" << endl;
-	#ifndef __PRINT_FINAL_SEPARATOR__
+	// where子句和连接键的比较都不会报错时，每一对行先比较连接键，键相等才判断where子句，并且使用运行时过滤（见JoinKeyFilter）；
+	// 否则逐对行照旧先判断where子句，错误在第一对行上报出来
+	const Term* type_first = schema.columnOf(key_first);
+	const Term* type_second = schema.columnOf(key_second);
+	bool f_isInfallible = type_first != nullptr and type_second != nullptr and type_first->isCompatibleWith(*type_second)
+		and key_first < columns_first and key_second >= columns_first and isWhereInfallible(where, schema);
+	if (f_isInfallible and table_first.estimateRows() * table_second.estimateRows() >= g_MergeJoinMinPairs) {
+		JoinSide side_first{&table_first, &filter_first, key_first};
+		JoinSide side_second{&table_second, &filter_second, key_second - columns_first};
+		mergeJoinInto(result, title, sources, side_first, side_second, type_second->getType() == keywords::text, where, guard.get());
+		return result;
+	}
+	std::unique_ptr<JoinKeyFilter> key_filter;
+	if (f_isInfallible) {
+		// 内层中where子句不可能成立的块里的键不必放入
+		bool f_isText = (type_second->getType() == keywords::text);
+		std::pmr::vector<uint64_t> hashes(&getStatementArena());
+		table_second.scan(guard.get(), [&](const Row& row_second) {
+			hashes.push_back(JoinKeyFilter::hashOf(row_second.at(key_second - columns_first), f_isText));
+		}, &filter_second);
+		key_filter.reset(new JoinKeyFilter(hashes, f_isText));
+	}
+
+	// 内层直接再扫描一遍第二张表，不把它的行先复制出来；只有满足条件的一对行才会组装成结果行
+	table_first.scan(guard.get(), [&](const Row& row_first) {
+		if (key_filter != nullptr and !key_filter->mayContain(row_first.at(key_first))) return;
+		const TextEntry* probe = nullptr;
+		if (key_dictionary != nullptr) {
+			probe = key_dictionary->find(row_first.at(key_first).getValue());
+			if (probe == nullptr and f_isInfallible) return;
 		}
-	#endif
+		auto keysMatch = [&](const JoinedRow& joined) {
+			return (key_dictionary != nullptr)
+				? (probe != nullptr and joined.at(key_second).getCode() == probe)
+				: (columnAt(joined, key_first, jcoln_first) == columnAt(joined, key_second, jcoln_second));
+		};
+		table_second.scan(guard.get(), [&](const Row& row_second) {
+			JoinedRow joined(row_first, row_second);
+			if (f_isInfallible and !keysMatch(joined)) return;
+			if (!fitsWhereRequirement(joined, where)) return;
+			if (!f_isInfallible and !keysMatch(joined)) return;
+			Row res_row = title;
+			for (size_t i = 0; i < sources.size(); ++i) {
+				res_row.setTermAt(i, joined.at(sources.at(i)));
+			}
+			result.insertRow(res_row);
+		}, &filter_second);
+	}, &filter_first);
+
+	return result;
+}
+void runStSelection(const SelectionSt& st, ostream& os) {
+	printSelectionResult(evalSelection(st), os);
 }
-void runStSelection(const vstring params, ostream& os) {
+Table evalSelection(const SelectionSt& st, const bool f_inRequestedOrder) {
 	Database& database = getCurrentDatabase();
 
-	vstring targets;
-	string table_name;
-	vstring conditions;
-
-	bool f_isTargets = true;
-
-	for (auto it = params.begin(); it != params.end(); ++it) {
-		if (*it == keywords::from) {
-			f_isTargets = false;
-			++it;
-			table_name = *it;
-			continue;
-		}
-		if (*it == keywords::where) continue;
-		if (f_isTargets) targets.push_back(*it);
-		else conditions.push_back(*it);
-	}
+	vstring targets = st.columns;
+	const string& table_name = st.table;
 
 	Table& table = database.findTable(table_name);
+	SnapshotGuard guard(getSessionMarker());			// 读语句只取快照，不等待写者
 	
 	// 通配符检查
 	if (doesContain(symbols::fwildcard, targets)) {
 		// 通配符和变量名混用时直接报错
-		if (targets.size() != 1) throw InvalidArgument(i18n::parseKey("dupselwildc"));
+		if (targets.size() != 1) throw InvalidArgument(i18n::parseKey(msg_id::dupselwildc));
 		else { 
 		// 否则将通配符替换为所有项目
 			vstring temp;
-			vector<psterm> term = table.getTitle().getRaw();
-			for (psterm p_term : term) {
+			for (const psterm& p_term : table.getTitle().getRaw()) {
 				temp.push_back(p_term.first);
 			}
 			targets = temp;
@@ -355,36 +546,54 @@ void runStSelection(const vstring params, ostream& os) {
 	else {
 		for (auto it = targets.begin(); it != targets.end(); ++it) {
 			for (auto jt = it+1; jt != targets.end(); ++jt) {
-				if (*it == *jt)	throw InvalidArgument(i18n::parseKey("dupselterm", {*it}));
+				if (*it == *jt)	throw InvalidArgument(i18n::parseKey(msg_id::dupselterm, {*it}));
 			}
 		}
 	}
 
+	// 标题行的类型取自原表，导出二进制文件时需要据此确定每列的类型
+	const Row& src_title = table.getTitle();
+	Schema schema(table);
+	BoundWhere where = bindWhereClause(st.where, schema);
+	ZoneFilter filter = compileZoneFilter(where, schema, 0, src_title.size());
 	Row title;
-	for (string str : targets) {
-		title.insertTerm(str, Term());
+	Row pattern;						// 结果行的模板，只含原表中确实存在的查询列
+	std::pmr::vector<size_t> sources(&getStatementArena());	// 模板中每一列在原表中的序号
+	for (const string& str : targets) {
+		size_t ordinal = schema.ordinalOf(str);
+		// 查询时不存在的列只出现在标题行中；导出的文件里标题行与每一行的列必须一一对应，直接报错
+		if (ordinal == g_NoSuchColumn and f_inRequestedOrder) throw InvalidArgument(i18n::parseKey(msg_id::nosuchterm, {str}));
+		title.insertTerm(str, ordinal != g_NoSuchColumn ? src_title.at(ordinal) : Term());
+		if (ordinal != g_NoSuchColumn) sources.push_back(ordinal);
+	}
+	if (!f_inRequestedOrder) std::sort(sources.begin(), sources.end());
+	for (const size_t ordinal : sources) {
+		pattern.insertTerm(src_title.getRaw().at(ordinal).first, src_title.at(ordinal));
 	}
 
 	//结果表
 	Table result(title);
 
-	for (Row row : table.getRaw()) {
-		if (!fitsWhereRequirement(row, conditions)) continue;
-		Row row_temp;
-		for (psterm p_term : row.getRaw()) {
-			string table_name = p_term.first;
-			Term term = p_term.second;
-			if (doesContain(table_name, targets)) row_temp.insertTerm(p_term);
+	table.scan(guard.get(), [&](const Row& row) {
+		if (!fitsWhereRequirement(row, where)) return;
+		Row row_temp = pattern;
+		for (size_t i = 0; i < sources.size(); ++i) {
+			row_temp.at(i) = row.at(sources.at(i));
 		}
 		result.insertRow(row_temp);
-	}
+	}, &filter);
 
+	return result;
+}
+void printSelectionResult(const Table& result, ostream& os) {
 	result.print(os);
-	
+	printSelectionSeparator(os);
+}
+void printSelectionSeparator(ostream& os) {
 	#ifndef __PRINT_FINAL_SEPARATOR__	
 	// 输出
 	// 判别是否为第一次输出
-		if (gf_isFirst) gf_isFirst = false;
+		if (g_Session->f_isFirstOutput) g_Session->f_isFirstOutput = false;
 		else {
 	#endif
 			os << "---" << endl;
@@ -392,44 +601,64 @@ void runStSelection(const vstring params, ostream& os) {
 		}
 	#endif
 }
-void runStInsertion(const vstring params) {
+void runStExport(const ExportSt& st) {
+	export_format format = parseExportFormat(st.format);
+	switch (st.source) {
+		case export_source::selection:
+			exportTable(evalSelection(st.selection, true), st.path, format);
+			break;
+		case export_source::innerjoin:
+			exportTable(evalInnerJoin(st.innerjoin), st.path, format);
+			break;
+		case export_source::table:
+			exportTable(getCurrentDatabase().findTable(st.table), st.path, format, getSessionMarker());
+			break;
+	}
+}
+void runStInsertion(const InsertionSt& st, Transaction& txn) {
 	Database& database = getCurrentDatabase();
-	Table& table = database.findTable(params.at(0));
+	Table& table = database.findTable(st.table);
+	WriteBatch& batch = txn.lockForWrite(table, st.table);
 
 	Row row = table.getTitle();
-	if (row.size() != params.size()-1) {
-		throw ArgumentCountError(row.size(), params.size(), i18n::parseKey("upp"));
+	if (row.size() != st.values.size()) {
+		throw ArgumentCountError(row.size(), st.values.size()+1, i18n::parseKey(msg_id::upp));
 	}
-	int i = 1;
-	vector<psterm> terms = row.getRaw();
-	for (auto it = terms.begin(); it != terms.end(); ++it) {
-		it->second.setValue(params.at(i));
+	// 标题行的副本就是新行，直接在其中填值
+	int i = 0;
+	for (psterm& p_term : row.getRaw()) {
+		p_term.second.setValue(st.values.at(i));
 		++i;
 	}
-	row.setTerms(terms);
-	table.insertRow(row);
+	table.insertRow(row, batch);
 }
-void runStDropTable(const vstring params) {
+void runStDropTable(const DropTableSt& st, table_wlock& table_lock) {
 	Database& database = getCurrentDatabase();
-	database.dropTable(params.at(0));
+	// 锁随表一同销毁，必须先释放；调用者仍独占目录锁，其他语句此时找不到这张表
+	table_lock.unlock();
+	database.dropTable(st.table);
+}
+void runStVacuum(const VacuumSt& st) {
+	Table& table = getCurrentDatabase().findTable(st.table);
+	// 与回收线程相同，只是不管失效版本够不够多
+	table.collectGarbage(getOldestActiveVersion());
+	table.compactDictionaries();
 }
-void runStCreateTable(const vstring params) {
+void runStCreateTable(const CreateTableSt& st) {
 	Database& database = getCurrentDatabase();
 	Row title;
-	for (auto it = params.begin()+1; it != params.end(); ++it) {
+	for (const auto& p_column : st.columns) {
 		Term term;
-		string term_name = *it;
-		++it;
-		term.setType(*it);
-		title.insertTerm(term_name, term);
+		term.setType(p_column.second);
+		title.insertTerm(p_column.first, term);
 	}
-	database.insertTable(params.at(0), Table(title));
+	database.createTable(st.table, title);
 }
-void runStUseDatabase(const vstring params) {
-	useDatabase(params.at(0));
+void runStUseDatabase(const UseDatabaseSt& st) {
+	useDatabase(st.database);
 }
-void runStCreateDatabase(const vstring params) {
-	createDatabase(params.at(0));
+void runStCreateDatabase(const CreateDatabaseSt& st) {
+	createDatabase(st.database);
 }
 
 }
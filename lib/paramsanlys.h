@@ -1,63 +1,71 @@
 /**
  * 头文件：paramsanlys.h
  * 此头文件的内容是MiniDB分析参数组成的函数。
+ * 解析的结果写入statements.h中的语句结构体，执行时不再回头读取参数列表。
  */
 #ifndef __PARAMSANLYS_MINIDB_H__
 #define __PARAMSANLYS_MINIDB_H__
 
-#include "stringop.h"
+#include "statements.h"
+#include "arena.h"
 
 namespace minidb {
 
-enum cmd_type {				// SQL语句的种类
-	createdb,	createtab,	usedb,		droptab,
-	insertion,	selection,	update,		delfrom,
-	innerjoin, 
-	null = -1
-};
-// 这里单独把inner join拎出来特判
+void eraseNewlFront(vtoken&);						// 去除参数列表前方的新行
+void eraseNewlBack(vtoken&);						// 去除参数列表后方的新行
+int cntAvailableArgs(const vtoken&);				// 检查参数列表中有多少有效的参数（也即不计"\newline"的总数）
 
-void eraseNewlFront(vstring&);						// 去除参数列表前方的新行
-void eraseNewlBack(vstring&);						// 去除参数列表后方的新行
-int cntAvailableArgs(const vstring);				// 检查参数列表中有多少有效的参数（也即不计"\newline"的总数）
+cmd_type parseCreateStParams(vtoken&, Statement&);		// 解析并检查	create	开头语句的参数
+cmd_type parseUseStParams(vtoken&, Statement&);		// 解析并检查	use		开头语句的参数
+cmd_type parseDropStParams(vtoken&, Statement&);		// 解析并检查	drop	开头语句的参数
+cmd_type parseInsertStParams(vtoken&, Statement&);		// 解析并检查	insert	开头语句的参数
+cmd_type parseDeletionStParams(vtoken&, Statement&);	// 解析并检查	delete	开头语句的参数
+cmd_type parseSelectStParams(vtoken&, Statement&);		// 解析并检查	select	开头语句的参数
+cmd_type parseExportStParams(vtoken&, Statement&);		// 解析并检查	export	开头语句的参数
+cmd_type parseTransactionStParams(vtoken&, const cmd_type);	// 检查	begin、commit、rollback	语句没有多余的参数
+cmd_type parseVacuumStParams(vtoken&, Statement&);		// 解析并检查	vacuum	语句的参数
 
-cmd_type parseCreateStParams(vstring&);				// 解析并检查	create	开头语句的参数
-cmd_type parseUseStParams(vstring&);				// 解析并检查	use		开头语句的参数
-cmd_type parseDropStParams(vstring&);				// 解析并检查	drop	开头语句的参数
-cmd_type parseInsertStParams(vstring&);				// 解析并检查	insert	开头语句的参数
-cmd_type ParssDeletionStParams(vstring&);			// 解析并检查	delete	开头语句的参数
-cmd_type parseSelectStParams(vstring&);				// 解析并检查	select	开头语句的参数
+void parseCreateDatabaseParams(vtoken&, CreateDatabaseSt&);	// 解析并检查	create database			语句的参数
+void parseCreateTableParams(vtoken&, CreateTableSt&);		// 解析并检查	create table			语句的参数
+void parseUseDatabaseParams(vtoken&, UseDatabaseSt&);		// 解析并检查	use database			语句的参数
+void parseDropTableParams(vtoken&, DropTableSt&);			// 解析并检查	drop table				语句的参数
+void parseInsertIntoParams(vtoken&, InsertionSt&);			// 解析并检查	insert into				语句的参数
+void parseDeleteFromParams(vtoken&, DeleteFromSt&);		// 解析并检查	delete from				语句的参数
+cmd_type parseUpdateParams(vtoken&, Statement&);			// 解析并检查	update					语句的参数
+Assignment parseAssignment(const string&);					// 解析一条赋值表达式，出错时把异常记在结果中
 
-void parseCreateDatabaseParams(vstring&);			// 解析并检查	create database			语句的参数
-void parseCreateTableParams(vstring&);				// 解析并检查	create table			语句的参数
-void parseUseDatabaseParams(vstring&);				// 解析并检查	use database			语句的参数
-void parseDropTableParams(vstring&);				// 解析并检查	drop table				语句的参数
-void parseInsertIntoParams(vstring&);				// 解析并检查	insert into				语句的参数
-void parseDeleteFromParams(vstring&);				// 解析并检查	delete from				语句的参数
-cmd_type parseUpdateParams(vstring&);				// 解析并检查	update					语句的参数
+vstring convert2Postfix(const string);						// 右值表达式转为后缀表达式
+bool isExprOps(const string);
+int getOpPriority(const string);
+vstring g_exprOps = {
+	symbols::plus,	symbols::minus,		symbols::times,		symbols::divides,
+	symbols::mods,	symbols::lparen,	symbols::rparen
+};
 
-void parseSelectionMainParams(vstring&);			// 解析并检查	select ... 	主句的参数
-void parseSelectionJoinParams(vstring&);			// 呃……这很难解释，总之有用
+cmd_type parseQueryParams(vtoken&, SelectionSt&, InnerJoinSt&);	// 解析select之后的部分，按语句种类填入其中一个结构体（export也要用）
+void parseSelectionMainParams(vtoken&, SelectionSt&);		// 解析并检查	select ... 	主句的参数
+void parseSelectionJoinParams(vtoken&, InnerJoinSt&);		// 呃……这很难解释，总之有用
 
-void parseInnerJoinParams(vstring&);				// 解析并检查	inner join	从句的参数
-void parseWhereClauseParams(vstring&, const bool);	// 解析并检查	where		从句的参数
+void parseInnerJoinParams(vtoken&, InnerJoinSt&);			// 解析并检查	inner join	从句的参数
+void parseWhereClauseParams(vtoken&, WhereClause&, const bool);	// 解析并检查	where		从句的参数
+ColumnRef splitColumnRef(const string&);					// 把"表名.列名"拆开，没有"."时报错
 
 
 
 
-void parseWhereClauseParams(vstring& params, const bool f_isInnerJoin = false) {
-	vstring res;
+void parseWhereClauseParams(vtoken& params, WhereClause& where, const bool f_isInnerJoin = false) {
 	eraseNewlFront(params);
 	int size = cntAvailableArgs(params);
 	if (size % 4 != 3) {
-		throw ArgumentCountError(size/4*4+3, size, i18n::parseKey("incmpltparamlist"));
+		throw ArgumentCountError(size/4*4+3, size, i18n::parseKey(msg_id::incmpltparamlist));
 	}
 	int i = 0;
+	Condition cond;
 	while (true) {
 		eraseNewlFront(params);
-		g_LnCounter.increment();
+		g_Session->ln_counter.increment();
 		if (params.size() == 0)	break;
-		string current_str = params.at(0);
+		const Token& current_str = params.at(0);
 		switch (i % 4) {
 			case 0:
 				do {
@@ -69,32 +77,35 @@ void parseWhereClauseParams(vstring& params, const bool f_isInnerJoin = false) {
 						f_temp = isValidVarName(current_str);
 					}
 					if (!f_temp) {
-						throw InvalidArgument(i18n::parseKey("unacptvarn", {current_str}));
+						throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {current_str}));
 					}
+					cond.first = makeOperand(current_str);
 				} while (false);
 				break;
 			case 1:
 				if (!isValidCmpOp(current_str)) {
-					throw SyntaxError(i18n::parseKey("invalidcmpop", {current_str}));
+					throw SyntaxError(i18n::parseKey(msg_id::invalidcmpop, {current_str}));
 				}
+				cond.op = current_str;
+				break;
+			case 2:
+				cond.second = makeOperand(current_str);
+				where.conditions.push_back(cond);
 				break;
-			case 2:	break;
 			case 3:
 				if (!isValidLogicOp(current_str)) {
-					throw SyntaxError(i18n::parseKey("invalidlgop", {current_str}));
+					throw SyntaxError(i18n::parseKey(msg_id::invalidlgop, {current_str}));
 				}
+				where.connectives.push_back(getKeywordIndex(current_str));
 				break;
 		}
-		res.push_back(current_str);
 		params.erase(params.begin());
 		++i;
 	}
-	params = res;
 	eraseNewlBack(params);
 }
-void parseDeleteFromParams(vstring& params) {
+void parseDeleteFromParams(vtoken& params, DeleteFromSt& st) {
 	eraseNewlFront(params);
-	vstring res;
 	int stage = 0;				// 解析阶段标记
 	string current_str;
 	while (true) {
@@ -102,25 +113,22 @@ void parseDeleteFromParams(vstring& params) {
 		if (params.size() == 0) break;
 		current_str = params.at(0);
 		if (stage == 2) {
-			parseWhereClauseParams(params);
-			for (string s : params) {
-				res.push_back(s);
-			}
+			parseWhereClauseParams(params, st.where);
 			break;
 		}
 		switch (stage) {
 			case 0:							// 读取表名
-				g_LnCounter.increment();
+				g_Session->ln_counter.increment();
 				if (!isValidVarName(current_str)) {
-					throw InvalidArgument(i18n::parseKey("unacptvarn", {current_str}));
+					throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {current_str}));
 				}
-				res.push_back(current_str);
+				st.table = current_str;
 				stage = 1;
 				break;
 			case 1:							// 读取where
-				g_LnCounter.increment();
+				g_Session->ln_counter.increment();
 				if (current_str != keywords::where) {
-					throw SyntaxError(i18n::parseKey("unexptstr", {current_str}));
+					throw SyntaxError(i18n::parseKey(msg_id::unexptstr, {current_str}));
 				}
 				stage = 2;
 				break;
@@ -128,31 +136,31 @@ void parseDeleteFromParams(vstring& params) {
 		params.erase(params.begin());
 	}
 	switch (stage) {
-		case 0:		throw SyntaxError(i18n::parseKey("exptsthgotnil", {i18n::parseKey("p_tablename").str()}));
-		case 1:		throw SyntaxError(i18n::parseKey("exptwheregotnil"));
+		case 0:		throw SyntaxError(i18n::parseKey(msg_id::exptsthgotnil, {i18n::parseKey(msg_id::p_tablename).str()}));
+		case 1:		throw SyntaxError(i18n::parseKey(msg_id::exptwheregotnil));
 		case 2:		break;
 	}
-	params = res;
 	eraseNewlBack(params);
 }
-cmd_type parseDeletionStParams(vstring& params) {
+cmd_type parseDeletionStParams(vtoken& params, Statement& st) {
 	eraseNewlFront(params);
-	if (params.size() == 0) throw SyntaxError(i18n::parseKey("exptkwgotnil", {keywords::from}));
-	g_LnCounter.increment();
+	if (params.size() == 0) throw SyntaxError(i18n::parseKey(msg_id::exptkwgotnil, {keywords::from}));
+	g_Session->ln_counter.increment();
 	switch (getKeywordIndex(params.at(0))) {
 		case keyword_index::from:
 			params.erase(params.begin());		// 用于删去开头的"from"
-			parseDeleteFromParams(params);
+			parseDeleteFromParams(params, st.body.emplace<DeleteFromSt>());
 			return cmd_type::delfrom;
 		default:
-			throw SyntaxError(i18n::parseKey("unexptstr", {params.at(0)}));
+			throw SyntaxError(i18n::parseKey(msg_id::unexptstr, {params.at(0)}));
 	}
 }
-cmd_type parseUpdateParams(vstring& params) {
+cmd_type parseUpdateParams(vtoken& params, Statement& st) {
 	eraseNewlFront(params);
-	vstring res;
+	UpdateSt& body = st.body.emplace<UpdateSt>();
+	string asgn_str = "";
 	int stage = 0;
-	string now;
+	Token now;
 	while (true) {
 		eraseNewlFront(params);
 		if (params.size() == 0) break;
@@ -160,9 +168,8 @@ cmd_type parseUpdateParams(vstring& params) {
 		if (now == keywords::set) {
 			// 如果set没有出现在读取from的阶段（stage 1）则一定语法错误
 			if (stage != 1) {
-				throw SyntaxError(i18n::parseKey("unexptkw", {keywords::set}));
+				throw SyntaxError(i18n::parseKey(msg_id::unexptkw, {keywords::set}));
 			}
-			res.push_back(keywords::set.str());
 			params.erase(params.begin());
 			stage = 2;
 			continue;
@@ -170,62 +177,74 @@ cmd_type parseUpdateParams(vstring& params) {
 		if (now == keywords::where) {
 			// 如果set没有出现在读取from的阶段（stage 2）则一定语法错误
 			if (stage != 2) {
-				throw SyntaxError(i18n::parseKey("unexptkw", {keywords::where}));
+				throw SyntaxError(i18n::parseKey(msg_id::unexptkw, {keywords::where}));
 			}
-			res.push_back(keywords::where.str());
+			body.assignments.push_back(parseAssignment(asgn_str));
 			params.erase(params.begin());	// 删除"where"
-			if (params.size() == 0) throw SyntaxError(i18n::parseKey("exptsthgotnil", {i18n::parseKey("p_termname").str()}));
-			parseWhereClauseParams(params);
+			if (params.size() == 0) throw SyntaxError(i18n::parseKey(msg_id::exptsthgotnil, {i18n::parseKey(msg_id::p_termname).str()}));
+			parseWhereClauseParams(params, body.where);
 			stage = 3;
 			continue;
 		}
 		switch (stage) {
 			case 0:							// 读取表名
-				g_LnCounter.increment();
+				g_Session->ln_counter.increment();
 				if (!isValidVarName(now)) {
-					throw InvalidArgument(i18n::parseKey("unacptvarn", {now}));
+					throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {now}));
 				}
-				res.push_back(now);
+				body.table = now;
 				stage = 1;
 				break;
 			case 1:							// 读取"set"
 				if (now != keywords::set) {
-					throw SyntaxError(i18n::parseKey("unexptstr", {now}));
+					throw SyntaxError(i18n::parseKey(msg_id::unexptstr, {now}));
 				}
 				break;
-			case 2:
-			case 3:
-				g_LnCounter.increment();
-				res.push_back(now);
+			case 2:							// 读取赋值表达式，以\next分隔
+				g_Session->ln_counter.increment();
+				if (now == symbols::next) {
+					body.assignments.push_back(parseAssignment(asgn_str));
+					asgn_str = "";
+				}
+				else asgn_str.append(now.str()).push_back(' ');
+				break;
+			case 3:							// where子句已经解析完毕，这里只是跳过（行号计数与以往保持一致）
+				g_Session->ln_counter.increment();
 				break;
 		}
 		params.erase(params.begin());
 	}
 	switch (stage) {
-		case 0:		throw SyntaxError(i18n::parseKey("exptsthgotnil", {i18n::parseKey("p_tablename").str()}));
-		case 1:		throw SyntaxError(i18n::parseKey("exptkwgotnil", {keywords::set}));
-		case 2:		throw SyntaxError(i18n::parseKey("incmpltparamlist"));
+		case 0:		throw SyntaxError(i18n::parseKey(msg_id::exptsthgotnil, {i18n::parseKey(msg_id::p_tablename).str()}));
+		case 1:		throw SyntaxError(i18n::parseKey(msg_id::exptkwgotnil, {keywords::set}));
+		case 2:		throw SyntaxError(i18n::parseKey(msg_id::incmpltparamlist));
 		case 3:		break;
 	}
-	params = res;
 	eraseNewlBack(params);
 	return cmd_type::update;
 }
-cmd_type parseSelectStParams(vstring& params) {
+cmd_type parseSelectStParams(vtoken& params, Statement& st) {
+	SelectionSt selection;
+	InnerJoinSt innerjoin;
+	cmd_type type = parseQueryParams(params, selection, innerjoin);
+	if (type == cmd_type::innerjoin) st.body = std::move(innerjoin);
+	else st.body = std::move(selection);
+	return type;
+}
+cmd_type parseQueryParams(vtoken& params, SelectionSt& selection, InnerJoinSt& innerjoin) {
 	cmd_type type = cmd_type::selection;
-	vstring main_clause;
-	string type_str = "";
-	vstring append_clause;
+	// 拆出来的子句只在解析这条语句时使用，放在内存池中
+	vtoken main_clause(&getStatementArena());
+	vtoken append_clause(&getStatementArena());
 	bool f_isAppendClause = false;
 	bool f_isInnerJoin = false;
-	for (string str : params) {
-		if (str == symbols::newl) {
-			g_LnCounter.newl();
+	for (const Token& str : params) {
+		if (str.keyword() == keyword_index::newline) {
+			g_Session->ln_counter.newl();
 			continue;
 		}
 		if (str == keywords::where) {
 			f_isAppendClause = true;
-			type_str = "where";
 			continue;
 		}
 		else if (str == keywords::inner) {
@@ -235,7 +254,7 @@ cmd_type parseSelectStParams(vstring& params) {
 
 		if (f_isInnerJoin and (!f_isAppendClause)) {
 			if (str != keywords::join) {
-				throw SyntaxError(i18n::parseKey("exptkwgotothers", {keywords::join, str}));
+				throw SyntaxError(i18n::parseKey(msg_id::exptkwgotothers, {keywords::join, str}));
 			}
 			f_isAppendClause = true;
 			type = cmd_type::innerjoin;
@@ -250,212 +269,233 @@ cmd_type parseSelectStParams(vstring& params) {
 		}
 	}
 	if (f_isInnerJoin) {
-		type_str = "inner join";
-		parseSelectionJoinParams(main_clause);
-		parseInnerJoinParams(append_clause);
+		parseSelectionJoinParams(main_clause, innerjoin);
+		parseInnerJoinParams(append_clause, innerjoin);
 	}
-	else if (append_clause.size() != 0) {
-		parseSelectionMainParams(main_clause);
-		parseWhereClauseParams(append_clause);
+	else {
+		parseSelectionMainParams(main_clause, selection);
+		if (append_clause.size() != 0) parseWhereClauseParams(append_clause, selection.where);
 	}
+	return type;
+}
+cmd_type parseExportStParams(vtoken& params, Statement& st) {
+	eraseNewlFront(params);
+	if (params.size() == 0) throw SyntaxError(i18n::parseKey(msg_id::exptsthgotnil, {i18n::parseKey(msg_id::p_tablename).str()}));
 
-	params = {};
-	for (string str : main_clause) {
-		params.push_back(str);
-	}
-	if (type_str != "") {
-		params.push_back(type_str);
-		for (string str : append_clause) {
-			params.push_back(str);
-		}
+	// 语句固定以 to '<path>' format <csv|binary> 结尾，先从尾部数出这四个token，前面的部分就是导出的数据源
+	int split = params.size();
+	int tail_cnt = 0;
+	for (int i = params.size()-1; i >= 0 and tail_cnt < 4; --i) {
+		if (params.at(i).keyword() == keyword_index::newline) continue;
+		split = i;
+		++tail_cnt;
+	}
+	vtoken source(params.begin(), params.begin()+split, &getStatementArena());
+	vtoken tail(params.begin()+split, params.end(), &getStatementArena());
+	if (tail_cnt < 4 or cntAvailableArgs(source) == 0) {
+		throw SyntaxError(i18n::parseKey(msg_id::incmpltparamlist));
+	}
+
+	ExportSt& body = st.body.emplace<ExportSt>();
+	if (getKeywordIndex(source.at(0)) == keyword_index::select) {
+		g_Session->ln_counter.increment();
+		source.erase(source.begin());		// 删去开头的"select"
+		cmd_type type = parseQueryParams(source, body.selection, body.innerjoin);
+		body.source = (type == cmd_type::innerjoin ? export_source::innerjoin : export_source::selection);
+	}
+	else {
+		g_Session->ln_counter.increment();
+		eraseNewlBack(source);
+		if (!isValidVarName(source.at(0))) throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {source.at(0)}));
+		if (source.size() != 1) throw SyntaxError(i18n::parseKey(msg_id::unexptstr, {source.at(1)}));
+		body.source = export_source::table;
+		body.table = source.at(0);
 	}
-	for (string str : params) {
-		clog << str << ' ';
+
+	int stage = 0;
+	while (true) {
+		eraseNewlFront(tail);
+		if (tail.size() == 0) break;
+		const Token& now = tail.at(0);
+		g_Session->ln_counter.increment();
+		switch (stage) {
+			case 0:							// 读取"to"
+				if (now != keywords::to) throw SyntaxError(i18n::parseKey(msg_id::exptkwgotothers, {keywords::to, now}));
+				break;
+			case 1:							// 读取路径，必须是字符串常量
+				if (now.size() <= 2 or now.at(0) != '\'') {
+					throw InvalidArgument(i18n::parseKey(msg_id::exptsthgotothers, {i18n::parseKey(msg_id::p_exppath).str(), now}));
+				}
+				body.path = now.str().substr(1, now.size()-2);
+				break;
+			case 2:							// 读取"format"
+				if (now != keywords::format) throw SyntaxError(i18n::parseKey(msg_id::exptkwgotothers, {keywords::format, now}));
+				break;
+			case 3:							// 读取格式名
+				if (now != keywords::csv and now != keywords::binary) {
+					throw InvalidArgument(i18n::parseKey(msg_id::unacptfmt, {now}));
+				}
+				body.format = toLowercase(now);
+				break;
+		}
+		tail.erase(tail.begin());
+		++stage;
 	}
-	return type;
+
+	return cmd_type::exportion;
 }
-void parseInnerJoinParams(vstring& params) {
+void parseInnerJoinParams(vtoken& params, InnerJoinSt& st) {
 	int size = cntAvailableArgs(params);
 	if (size > 5) {
-		vstring temp;
-		for (auto it = params.begin()+5; it != params.end(); ++it) {
-			temp.push_back(*it);
-			clog << *it << ' ';
-		}
-		parseWhereClauseParams(temp, true);
+		vtoken temp(params.begin()+5, params.end(), &getStatementArena());
+		parseWhereClauseParams(temp, st.where, true);
 	}
 	else if (size < 5) {
-		throw ArgumentCountError(5, size, i18n::parseKey("upp"));
+		throw ArgumentCountError(5, size, i18n::parseKey(msg_id::upp));
 	}
 	if (params.at(1) != keywords::on) {
-		throw SyntaxError(i18n::parseKey("exptkwgotothers", {keywords::on, params.at(1)}));
+		throw SyntaxError(i18n::parseKey(msg_id::exptkwgotothers, {keywords::on, params.at(1)}));
 	}
 	if (params.at(3) != symbols::equals) {
-		throw SyntaxError(i18n::parseKey("exptkwgotothers", {symbols::equals, params.at(3)}));
+		throw SyntaxError(i18n::parseKey(msg_id::exptkwgotothers, {symbols::equals, params.at(3)}));
 	}
-	const string innerjoin_name = params.at(0);
+	const string& innerjoin_name = params.at(0);
 
-	string match_first = params.at(2), match_second = params.at(4);
-
-	auto pos_first = match_first.find('.'), pos_second = match_second.find('.');
-	if (pos_first == string::npos) {
-		throw InvalidArgument(i18n::parseKey("nmemspec", {match_first}));
-	}
-	if (pos_second == string::npos) {
-		throw InvalidArgument(i18n::parseKey("nmemspec", {match_second}));
-	}
-
-	string table_first = match_first.substr(0,pos_first);
-	string table_second = match_second.substr(0,pos_second);
-	string column_first = match_first.substr(pos_first+1);
-	string column_second = match_second.substr(pos_second+1);
+	st.on_first = splitColumnRef(params.at(2));
+	st.on_second = splitColumnRef(params.at(4));
 
 	if (!isValidVarName(innerjoin_name)) {
-		throw InvalidArgument(i18n::parseKey("unacptvarn", {innerjoin_name}));
+		throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {innerjoin_name}));
 	}
-	if (!isValidVarName(table_first)) {
-		throw InvalidArgument(i18n::parseKey("unacptvarn", {table_first}));
+	if (!isValidVarName(st.on_first.table)) {
+		throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {st.on_first.table}));
 	}
-	if (!isValidVarName(table_second)) {
-		throw InvalidArgument(i18n::parseKey("unacptvarn", {table_second}));
+	if (!isValidVarName(st.on_second.table)) {
+		throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {st.on_second.table}));
 	}
-	if (!isValidVarName(column_first)) {
-		throw InvalidArgument(i18n::parseKey("unacptvarn", {column_first}));
+	if (!isValidVarName(st.on_first.column)) {
+		throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {st.on_first.column}));
 	}
-	if (!isValidVarName(column_second)) {
-		throw InvalidArgument(i18n::parseKey("unacptvarn", {column_second}));
+	if (!isValidVarName(st.on_second.column)) {
+		throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {st.on_second.column}));
 	}
-
-	vstring temp = {
-		innerjoin_name, table_first, column_first, table_second, column_second
-	};
-	if (size > 5) {
-		temp.push_back(keywords::where.str());
-		for (auto it = params.begin()+5; it != params.end(); ++it) {
-			temp.push_back(*it);
-		}
+	st.table_second = innerjoin_name;
+}
+ColumnRef splitColumnRef(const string& str) {
+	auto pos = str.find('.');
+	if (pos == string::npos) {
+		throw InvalidArgument(i18n::parseKey(msg_id::nmemspec, {str}));
 	}
-
-	params = temp;
+	return {str.substr(0, pos), str.substr(pos+1)};
 }
-void parseSelectionMainParams(vstring& params) {
+void parseSelectionMainParams(vtoken& params, SelectionSt& st) {
 	eraseNewlFront(params);
-	vstring res;
 	int stage = 0;
-	string now;
+	Token now;
 	while (true) {
 		eraseNewlFront(params);
 		if (params.size() == 0) break;
 		now = params.at(0);
 		if (now == symbols::next) {
 			// 如果\next没有出现在读取\next的阶段（stage 1）则一定语法错误
-			if (stage != 1) throw SyntaxError(i18n::parseKey("exptsthgotnil", {i18n::parseKey("p_termname").str()}));
+			if (stage != 1) throw SyntaxError(i18n::parseKey(msg_id::exptsthgotnil, {i18n::parseKey(msg_id::p_termname).str()}));
 		}
 		if (now == keywords::from) {
 			// 如果from没有出现在读取from的阶段（stage 1）则一定语法错误
 			if (stage != 1) {
-				throw SyntaxError(i18n::parseKey("unexptkw", {"from"}));
+				throw SyntaxError(i18n::parseKey(msg_id::unexptkw, {"from"}));
 			}
 			stage = 2;
 		}
 		switch (stage) {
 			case 0:							// 读取列名（通配符\times也是合理的列名）
-				g_LnCounter.increment();
+				g_Session->ln_counter.increment();
 				if (!isValidVarName(now) and now != symbols::times) {
-					throw InvalidArgument(i18n::parseKey("unacptvarn", {now}));
+					throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {now}));
 				}
-				res.push_back(now);
+				st.columns.push_back(now);
 				stage = 1;
 				break;
 			case 1:							// 读取\next或"from"
 				if (now != symbols::next) {
-					throw SyntaxError(i18n::parseKey("unexptstr", {now}));
+					throw SyntaxError(i18n::parseKey(msg_id::unexptstr, {now}));
 				}
 				stage = 0;
 				break;
 			case 2:							// 处理"from"
-				g_LnCounter.increment();
-				res.push_back(keywords::from.str());
+				g_Session->ln_counter.increment();
 				stage = 3;
 				break;
 			case 3:							// 读取表名
-				g_LnCounter.increment();
+				g_Session->ln_counter.increment();
 				if (!isValidVarName(now)) {
-					throw InvalidArgument(i18n::parseKey("unacptvarn", {now}));
+					throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {now}));
 				}
-				res.push_back(now);
+				st.table = now;
 				stage = 4;
 				break;
 		}
 		params.erase(params.begin());
 	}
 	switch (stage) {
-		case 0:		throw SyntaxError(i18n::parseKey("exptsthgotnil", {i18n::parseKey("p_termname").str()}));
-		case 1:		throw SyntaxError(i18n::parseKey("redundant"));
+		case 0:		throw SyntaxError(i18n::parseKey(msg_id::exptsthgotnil, {i18n::parseKey(msg_id::p_termname).str()}));
+		case 1:		throw SyntaxError(i18n::parseKey(msg_id::redundant));
 		case 2:		throw exception();
-		case 3:		throw SyntaxError(i18n::parseKey("exptsthgotnil", {i18n::parseKey("p_tablename").str()}));
+		case 3:		throw SyntaxError(i18n::parseKey(msg_id::exptsthgotnil, {i18n::parseKey(msg_id::p_tablename).str()}));
 		case 4:		break;
 	}
-	params = res;
 	eraseNewlBack(params);
 }
-void parseSelectionJoinParams(vstring& params) {
+void parseSelectionJoinParams(vtoken& params, InnerJoinSt& st) {
 	eraseNewlFront(params);
-	vstring res;
 	int stage = 0;
-	string now;
+	Token now;
 	while (params.size() != 0) {
 		eraseNewlFront(params);
 		now = params.at(0);
 		if (now == symbols::next) {
 			// 如果\next没有出现在读取\next的阶段（stage 1）则一定语法错误
-			if (stage != 1) throw SyntaxError(i18n::parseKey("exptsthgotnil", {i18n::parseKey("p_termname").str()}));
+			if (stage != 1) throw SyntaxError(i18n::parseKey(msg_id::exptsthgotnil, {i18n::parseKey(msg_id::p_termname).str()}));
 		}
 		if (now == keywords::from) {
 			// 如果from没有出现在读取from的阶段（stage 1）则一定语法错误
 			if (stage != 1) {
-				throw SyntaxError(i18n::parseKey("unexptkw", {"from"}));
+				throw SyntaxError(i18n::parseKey(msg_id::unexptkw, {"from"}));
 			}
 			stage = 2;
 		}
 		switch (stage) {
 			case 0:							// 读取列名（通配符\times也是合理的列名）
 				do {
-					g_LnCounter.increment();
-					auto pos = now.find('.');
-					if (pos == string::npos) {
-						throw InvalidArgument(i18n::parseKey("nmemspec", {now}));
-					}
-					string table_name = now.substr(0,pos);
-					string column_name = now.substr(pos+1);
+					g_Session->ln_counter.increment();
+					ColumnRef column = splitColumnRef(now);
 					
-					if (!isValidVarName(table_name)) {
-						throw InvalidArgument(i18n::parseKey("unacptvarn", {table_name}));
+					if (!isValidVarName(column.table)) {
+						throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {column.table}));
 					}
-					if (!isValidVarName(column_name) and column_name != symbols::fwildcard) {
-						throw InvalidArgument(i18n::parseKey("unacptvarn", {column_name}));
+					if (!isValidVarName(column.column) and column.column != symbols::fwildcard) {
+						throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {column.column}));
 					}
-					res.push_back(now);
+					st.columns.push_back(column);
 					stage = 1;
 				} while (false);
 				break;
 			case 1:							// 读取\next或"from"
 				if (now != symbols::next) {
-					throw SyntaxError(i18n::parseKey("unexptstr", {now}));
+					throw SyntaxError(i18n::parseKey(msg_id::unexptstr, {now}));
 				}
 				stage = 0;
 				break;
 			case 2:							// 处理"from"
-				g_LnCounter.increment();
-				res.push_back(keywords::from.str());
+				g_Session->ln_counter.increment();
 				stage = 3;
 				break;
 			case 3:							// 读取表名
-				g_LnCounter.increment();
+				g_Session->ln_counter.increment();
 				if (!isValidVarName(now)) {
-					throw InvalidArgument(i18n::parseKey("unacptvarn", {now}));
+					throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {now}));
 				}
-				res.push_back(now);
+				st.table_first = now;
 				stage = 4;
 				break;
 		}
@@ -463,33 +503,31 @@ void parseSelectionJoinParams(vstring& params) {
 		eraseNewlBack(params);
 	}
 	switch (stage) {
-		case 0:		throw SyntaxError(i18n::parseKey("exptsthgotnil", {i18n::parseKey("p_termname").str()}));
-		case 1:		throw SyntaxError(i18n::parseKey("redundant"));
+		case 0:		throw SyntaxError(i18n::parseKey(msg_id::exptsthgotnil, {i18n::parseKey(msg_id::p_termname).str()}));
+		case 1:		throw SyntaxError(i18n::parseKey(msg_id::redundant));
 		case 2:		throw exception();
-		case 3:		throw SyntaxError(i18n::parseKey("exptsthgotnil", {i18n::parseKey("p_tablename").str()}));
+		case 3:		throw SyntaxError(i18n::parseKey(msg_id::exptsthgotnil, {i18n::parseKey(msg_id::p_tablename).str()}));
 		case 4:		break;
 	}
-	params = res;
 	eraseNewlBack(params);
 }
-cmd_type parseInsertStParams(vstring& params) {
+cmd_type parseInsertStParams(vtoken& params, Statement& st) {
 	eraseNewlFront(params);
-	if (params.size() == 0) throw SyntaxError(i18n::parseKey("exptkwgotnil", {keywords::into}));
-	g_LnCounter.increment();
+	if (params.size() == 0) throw SyntaxError(i18n::parseKey(msg_id::exptkwgotnil, {keywords::into}));
+	g_Session->ln_counter.increment();
 	switch (getKeywordIndex(params.at(0))) {
 		case keyword_index::into:
 			params.erase(params.begin());		// 用于删去开头的"into"
-			parseInsertIntoParams(params);
+			parseInsertIntoParams(params, st.body.emplace<InsertionSt>());
 			return cmd_type::insertion;
 		default:
-			throw SyntaxError(i18n::parseKey("unexptstr", {params.at(0)}));
+			throw SyntaxError(i18n::parseKey(msg_id::unexptstr, {params.at(0)}));
 	}
 }
-void parseInsertIntoParams(vstring& params) {
+void parseInsertIntoParams(vtoken& params, InsertionSt& st) {
 	eraseNewlFront(params);
-	vstring res;
 	int stage = 0;				// 解析阶段标记
-	string now;
+	Token now;
 	bool f_Halt = false;
 	while (true) {
 		eraseNewlFront(params);
@@ -497,7 +535,7 @@ void parseInsertIntoParams(vstring& params) {
 		now = params.at(0);
 		if (now == symbols::next) {
 			// 如果\next没有出现在读取\next的阶段（stage 3）则一定语法错误
-			if (stage != 3) throw SyntaxError(i18n::parseKey("exptsthgotnil", {i18n::parseKey("p_termname").str()}));
+			if (stage != 3) throw SyntaxError(i18n::parseKey(msg_id::exptsthgotnil, {i18n::parseKey(msg_id::p_termname).str()}));
 		}
 		if (now == symbols::paramsend) {
 			stage = 5;
@@ -507,123 +545,139 @@ void parseInsertIntoParams(vstring& params) {
 		}
 		switch (stage) {
 			case 0:							// 读取表名
-				g_LnCounter.increment();
+				g_Session->ln_counter.increment();
 				if (!isValidVarName(now)) {
-					throw InvalidArgument(i18n::parseKey("unacptvarn", {now}));
+					throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {now}));
 				}
-				res.push_back(now);
+				st.table = now;
 				stage = 1;
 				break;
 			case 1:							// 必须为values紧跟\paramsbegin
-				g_LnCounter.increment();
+				g_Session->ln_counter.increment();
 				if (getKeywordIndex(now) != keyword_index::values) {
-					throw SyntaxError(i18n::parseKey("exptkwgotothers", {"values", now}));
+					throw SyntaxError(i18n::parseKey(msg_id::exptkwgotothers, {"values", now}));
 				}
 				params.erase(params.begin());
-				if (params.size() == 0) throw SyntaxError(i18n::parseKey("exptkwgotnil"));
+				if (params.size() == 0) throw SyntaxError(i18n::parseKey(msg_id::exptkwgotnil));
 				now = params.at(0);
 				if (now != symbols::paramsbegin) {
-					throw SyntaxError(i18n::parseKey("exptkwgotothers", {now}));
+					throw SyntaxError(i18n::parseKey(msg_id::exptkwgotothers, {now}));
 				}
 				stage = 2;
 				break;
 			case 2:							// 读取参数名
 			case 4:							// \next后的等待阶段+重新读取参数名
-				g_LnCounter.increment();
-				res.push_back(now);
+				g_Session->ln_counter.increment();
+				st.values.push_back(now.str());
 				stage = 3;
 				break;
 			case 3:							// 读取\next或\paramsend
 				if (now == symbols::next) {
 					stage = 4;
 				}
-				else throw SyntaxError(i18n::parseKey("exptsthgotothers", {"',' or ')'", now}));
+				else throw SyntaxError(i18n::parseKey(msg_id::exptsthgotothers, {"',' or ')'", now}));
 				break;
 		}
 		params.erase(params.begin());
 	}
 	switch (stage) {
-		case 0:		throw SyntaxError(i18n::parseKey("exptsthgotnil", {i18n::parseKey("p_tablename").str()}));
-		case 1:		throw SyntaxError(i18n::parseKey("exptparamsgotnil"));
+		case 0:		throw SyntaxError(i18n::parseKey(msg_id::exptsthgotnil, {i18n::parseKey(msg_id::p_tablename).str()}));
+		case 1:		throw SyntaxError(i18n::parseKey(msg_id::exptparamsgotnil));
 		case 2:
-		case 4:		throw SyntaxError(i18n::parseKey("exptsthgotnil", {i18n::parseKey("p_termname").str()}));
+		case 4:		throw SyntaxError(i18n::parseKey(msg_id::exptsthgotnil, {i18n::parseKey(msg_id::p_termname).str()}));
 		case 5:		break;
 		case 3:
-		default:	throw SyntaxError(i18n::parseKey("mismparen"));
+		default:	throw SyntaxError(i18n::parseKey(msg_id::mismparen));
 	}
-	if (params.size() != 0)	throw SyntaxError(i18n::parseKey("exptsthgotothers", {"';'", params.at(0)}));
-	params = res;
+	if (params.size() != 0)	throw SyntaxError(i18n::parseKey(msg_id::exptsthgotothers, {"';'", params.at(0)}));
+}
+cmd_type parseTransactionStParams(vtoken& params, const cmd_type type) {
+	eraseNewlFront(params);
 	eraseNewlBack(params);
+	if (params.size() != 0) throw SyntaxError(i18n::parseKey(msg_id::exptsthgotothers, {"';'", params.at(0)}));
+	return type;
 }
-cmd_type parseDropStParams(vstring& params) {
+cmd_type parseVacuumStParams(vtoken& params, Statement& st) {
 	eraseNewlFront(params);
-	if (params.size() == 0) throw SyntaxError(i18n::parseKey("exptkwgotnil", {keywords::table}));
-	g_LnCounter.increment();
+	if (params.size() == 0) throw SyntaxError(i18n::parseKey(msg_id::exptsthgotnil, {i18n::parseKey(msg_id::p_tablename).str()}));
+	g_Session->ln_counter.increment();
+	if (!isValidVarName(params.at(0))) throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {params.at(0)}));
+	eraseNewlBack(params);
+	if (params.size() != 1) throw InvalidArgument(i18n::parseKey(msg_id::unexptstr, {params.at(1)}));
+	st.body.emplace<VacuumSt>().table = params.at(0);
+	return cmd_type::vacuum;
+}
+cmd_type parseDropStParams(vtoken& params, Statement& st) {
+	eraseNewlFront(params);
+	if (params.size() == 0) throw SyntaxError(i18n::parseKey(msg_id::exptkwgotnil, {keywords::table}));
+	g_Session->ln_counter.increment();
 	switch (getKeywordIndex(params.at(0))) {
 		case keyword_index::table:
 			params.erase(params.begin());		// 用于删去开头的"table"
-			parseDropTableParams(params);
+			parseDropTableParams(params, st.body.emplace<DropTableSt>());
 			return cmd_type::droptab;
 		default:
-			throw SyntaxError(i18n::parseKey("unexptstr", {params.at(0)}));
+			throw SyntaxError(i18n::parseKey(msg_id::unexptstr, {params.at(0)}));
 	}
 }
-void parseDropTableParams(vstring& params) {
+void parseDropTableParams(vtoken& params, DropTableSt& st) {
 	eraseNewlFront(params);
-	g_LnCounter.increment();
-	if (!isValidVarName(params.at(0))) throw InvalidArgument(i18n::parseKey("unacptvarn", {params.at(0)}));
+	g_Session->ln_counter.increment();
+	if (!isValidVarName(params.at(0))) throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {params.at(0)}));
 	eraseNewlBack(params);
-	if (params.size() != 1) throw InvalidArgument(i18n::parseKey("unexptstr", {params.at(1)}));
+	if (params.size() != 1) throw InvalidArgument(i18n::parseKey(msg_id::unexptstr, {params.at(1)}));
+	st.table = params.at(0);
 }
-cmd_type parseUseStParams(vstring& params) {
+cmd_type parseUseStParams(vtoken& params, Statement& st) {
 	eraseNewlFront(params);
-	if (params.size() == 0) throw SyntaxError(i18n::parseKey("exptkwgotnil", {keywords::database}));
-	g_LnCounter.increment();
+	if (params.size() == 0) throw SyntaxError(i18n::parseKey(msg_id::exptkwgotnil, {keywords::database}));
+	g_Session->ln_counter.increment();
 	switch (getKeywordIndex(params.at(0))) {
 		case keyword_index::database:
 			params.erase(params.begin());		// 用于删去开头的"database"
-			parseUseDatabaseParams(params);
+			parseUseDatabaseParams(params, st.body.emplace<UseDatabaseSt>());
 			return cmd_type::usedb;
 		default:
-			throw SyntaxError(i18n::parseKey("unexptstr", {params.at(0)}));
+			throw SyntaxError(i18n::parseKey(msg_id::unexptstr, {params.at(0)}));
 	}
 }
-void parseUseDatabaseParams(vstring& params) {
+void parseUseDatabaseParams(vtoken& params, UseDatabaseSt& st) {
 	eraseNewlFront(params);
-	g_LnCounter.increment();
-	if (!isValidVarName(params.at(0))) throw InvalidArgument(i18n::parseKey("unacptvarn", {params.at(0)}));
+	g_Session->ln_counter.increment();
+	if (!isValidVarName(params.at(0))) throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {params.at(0)}));
 	eraseNewlBack(params);
-	if (params.size() != 1) throw InvalidArgument(i18n::parseKey("unexptstr", {params.at(1)}));
+	if (params.size() != 1) throw InvalidArgument(i18n::parseKey(msg_id::unexptstr, {params.at(1)}));
+	st.database = params.at(0);
 }
-cmd_type parseCreateStParams(vstring& params) {
+cmd_type parseCreateStParams(vtoken& params, Statement& st) {
 	eraseNewlFront(params);
-	if (params.size() == 0) throw SyntaxError(i18n::parseKey("exptkwgotnil", {keywords::database.str()+"\" or \""+keywords::table.str()}));
-	g_LnCounter.increment();
+	if (params.size() == 0) throw SyntaxError(i18n::parseKey(msg_id::exptkwgotnil, {keywords::database.str()+"\" or \""+keywords::table.str()}));
+	g_Session->ln_counter.increment();
 	switch (getKeywordIndex(params.at(0))) {
 		case keyword_index::database:
 			params.erase(params.begin());		// 用于删去开头的"database"
-			parseCreateDatabaseParams(params);
+			parseCreateDatabaseParams(params, st.body.emplace<CreateDatabaseSt>());
 			return cmd_type::createdb;
 		case keyword_index::table:
 			params.erase(params.begin());		// 用于删去开头的"table"
-			parseCreateTableParams(params);
+			parseCreateTableParams(params, st.body.emplace<CreateTableSt>());
 			return cmd_type::createtab;
 		default:
-			throw SyntaxError(i18n::parseKey("unexptstr", {params.at(0)}));
+			throw SyntaxError(i18n::parseKey(msg_id::unexptstr, {params.at(0)}));
 	}
 }
-void parseCreateDatabaseParams(vstring& params) {
+void parseCreateDatabaseParams(vtoken& params, CreateDatabaseSt& st) {
 	eraseNewlFront(params);
-	g_LnCounter.increment();
-	if (!isValidVarName(params.at(0))) throw InvalidArgument(i18n::parseKey("unacptvarn", {params.at(0)}));
+	g_Session->ln_counter.increment();
+	if (!isValidVarName(params.at(0))) throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {params.at(0)}));
 	eraseNewlBack(params);
-	if (params.size() != 1) throw InvalidArgument(i18n::parseKey("unexptstr", {params.at(1)}));
+	if (params.size() != 1) throw InvalidArgument(i18n::parseKey(msg_id::unexptstr, {params.at(1)}));
+	st.database = params.at(0);
 }
-void parseCreateTableParams(vstring& params) {
+void parseCreateTableParams(vtoken& params, CreateTableSt& st) {
 	eraseNewlFront(params);
-	vstring res;
 	int stage = 0;				// 解析阶段标记
-	string now;
+	Token now;
 	bool f_Halt = false;
 	while (true) {
 		eraseNewlFront(params);
@@ -632,7 +686,7 @@ void parseCreateTableParams(vstring& params) {
 		now = params.at(0);
 		if (now == symbols::next) {
 			// 如果\next没有出现在读取\next的阶段（stage 4）则一定语法错误
-			if (stage != 4) throw SyntaxError(i18n::parseKey("incmpltparamlist"));
+			if (stage != 4) throw SyntaxError(i18n::parseKey(msg_id::incmpltparamlist));
 		}
 		if (now == symbols::paramsend) {
 			stage = 6;
@@ -641,76 +695,157 @@ void parseCreateTableParams(vstring& params) {
 		}
 		switch (stage) {
 			case 0:							// 读取表名
-				g_LnCounter.increment();
+				g_Session->ln_counter.increment();
 				if (!isValidVarName(now)) {
-					throw InvalidArgument(i18n::parseKey("unacptvarn", {now}));
+					throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {now}));
 				}
-				res.push_back(now);
+				st.table = now;
 				stage = 1;
 				break;
 			case 1:							// 必须为\paramsbegin
 				if (now != symbols::paramsbegin) {
-					throw SyntaxError(i18n::parseKey("exptparamsgotothers", {now}));
+					throw SyntaxError(i18n::parseKey(msg_id::exptparamsgotothers, {now}));
 				}
 				stage = 2;
 				break;
 			case 2:							// 读取参数名
 			case 5:							// \next后的等待阶段+重新读取参数名
-				g_LnCounter.increment();
+				g_Session->ln_counter.increment();
 				if (!isValidVarName(now)) {
-					throw InvalidArgument(i18n::parseKey("unacptvarn", {now}));
+					throw InvalidArgument(i18n::parseKey(msg_id::unacptvarn, {now}));
 				}
-				res.push_back(now);
+				st.columns.push_back({now, ""});
 				stage = 3;
 				break;
 			case 3:							// 读取参数类型
-				g_LnCounter.increment();
-				if (now == keywords::integer)		res.push_back(keywords::integer.str());
-				else if (now == keywords::_float)	res.push_back(keywords::_float.str());
-				else if (now == keywords::text)		res.push_back(keywords::text.str());
-				else throw SyntaxError(i18n::parseKey("unacptvt", {now}));
+				g_Session->ln_counter.increment();
+				if (now == keywords::integer)		st.columns.back().second = keywords::integer.str();
+				else if (now == keywords::_float)	st.columns.back().second = keywords::_float.str();
+				else if (now == keywords::text)		st.columns.back().second = keywords::text.str();
+				else throw SyntaxError(i18n::parseKey(msg_id::unacptvt, {now}));
 				stage = 4;
 				break;
 			case 4:							// 读取\next或\paramsend
 				if (now == symbols::next) {
 					stage = 5;
 				}
-				else throw SyntaxError(i18n::parseKey("exptsthgotothers", {"',' or ')", now}));
+				else throw SyntaxError(i18n::parseKey(msg_id::exptsthgotothers, {"',' or ')", now}));
 				break;
 		}
 		params.erase(params.begin());
 	}
 	switch (stage) {
-		case 0:		throw SyntaxError(i18n::parseKey("exptsthgotnil", {i18n::parseKey("p_tablename").str()}));
-		case 1:		throw SyntaxError(i18n::parseKey("exptparamsgotnil"));
+		case 0:		throw SyntaxError(i18n::parseKey(msg_id::exptsthgotnil, {i18n::parseKey(msg_id::p_tablename).str()}));
+		case 1:		throw SyntaxError(i18n::parseKey(msg_id::exptparamsgotnil));
 		case 2:
-		case 5:		throw SyntaxError(i18n::parseKey("exptsthgotnil", {i18n::parseKey("p_termname").str()}));
-		case 3:		throw SyntaxError(i18n::parseKey("exptsthgotnil", {i18n::parseKey("p_termtype").str()}));
+		case 5:		throw SyntaxError(i18n::parseKey(msg_id::exptsthgotnil, {i18n::parseKey(msg_id::p_termname).str()}));
+		case 3:		throw SyntaxError(i18n::parseKey(msg_id::exptsthgotnil, {i18n::parseKey(msg_id::p_termtype).str()}));
 		case 6:		break;
 		case 4:
-		default:	throw SyntaxError(i18n::parseKey("mismparen"));
+		default:	throw SyntaxError(i18n::parseKey(msg_id::mismparen));
 	}
-	params = res;
-	eraseNewlBack(params);
 }
-void eraseNewlFront(vstring& params) {
-	while (params.size() != 0 and params.at(0) == symbols::newl) {
-		g_LnCounter.newl();
+Assignment parseAssignment(const string& asgn_expr) {
+	Assignment res;
+	res.text = asgn_expr;
+	try {
+		auto pos = asgn_expr.find('=');
+		if (pos == string::npos) throw InvalidArgument(i18n::parseKey(msg_id::exptsthgotothers, {i18n::parseKey(msg_id::p_asgn).str(), "\"" + asgn_expr + "\""}));
+		string lvalue = trim(asgn_expr.substr(0,pos));
+		if (!isValidVarName(lvalue)) throw InvalidArgument(i18n::parseKey(msg_id::invalidlval, {lvalue}));
+		res.target = lvalue;
+		for (const string& token : convert2Postfix(trim(asgn_expr.substr(pos+1)))) {
+			ExprItem item{isExprOps(token), "", Operand()};
+			if (item.f_isOperator) item.op = token;
+			else item.operand = makeOperand(token);
+			res.postfix.push_back(item);
+		}
+	}
+	catch (MiniDBExceptionBase&) {
+		res.error = std::current_exception();
+	}
+	return res;
+}
+// 这里的expr是右值表达式
+vstring convert2Postfix(const string expr) {
+	stack<string> ops;
+	vstring res;
+
+	for (string token : splitByDelimiters(expr, ' ')) {
+		if (token == "") continue;
+		if (isExprOps(token)) {
+			if (token == symbols::lparen) {
+				ops.push(token);
+			}
+			else if (token == symbols::rparen) {
+				string top;
+				do {
+					if (ops.empty()) throw SyntaxError(i18n::parseKey(msg_id::mismparen));
+					top = ops.top();
+					ops.pop();
+					if (top != symbols::lparen) res.push_back(top);
+					else break;
+				} while (true);
+			}
+			else {
+				if (ops.empty()) {
+					ops.push(token);
+					continue;
+				}
+				string top;
+				do {
+					if (ops.empty()) break;
+					top = ops.top();
+					if (getOpPriority(top) < getOpPriority(token)) break;
+					else {
+						ops.pop();
+						res.push_back(top);
+					}
+				} while (true);
+				ops.push(token);
+			}
+			continue;
+		}
+		else res.push_back(token);
+	}
+	while (!ops.empty()) {
+		string op = ops.top();
+		res.push_back(op);
+		ops.pop();
+	}
+	return res;
+}
+int getOpPriority(const string op) {
+	if (op == symbols::plus or op == symbols::minus) return 1;
+	else if (op == symbols::times or op == symbols::divides or op == symbols::mods) return 2;
+	else if (op == symbols::lparen) return 0;
+	else return -1;
+}
+bool isExprOps(const string op) {
+	for (string str : g_exprOps) {
+		if (op == str) return true;
+	}
+	return false;
+}
+
+void eraseNewlFront(vtoken& params) {
+	while (params.size() != 0 and params.at(0).keyword() == keyword_index::newline) {
+		g_Session->ln_counter.newl();
 		params.erase(params.begin());
 	}
 }
-void eraseNewlBack(vstring& params) {
+void eraseNewlBack(vtoken& params) {
 	int size = params.size();
-	while (size != 0 and params.at(size-1) == symbols::newl) {
-		g_LnCounter.newl();
+	while (size != 0 and params.at(size-1).keyword() == keyword_index::newline) {
+		g_Session->ln_counter.newl();
 		params.erase(params.end()-1);
 		size--;
 	}
 }
-int cntAvailableArgs(const vstring vs) {
+int cntAvailableArgs(const vtoken& vs) {
 	int c = 0;
-	for (string s : vs) {
-		if (s != symbols::newl) ++c;
+	for (const Token& s : vs) {
+		if (s.keyword() != keyword_index::newline) ++c;
 	}
 	return c;
 }
@@ -0,0 +1,441 @@
+/**
+ * 头文件：server.h
+ * 服务器模式与客户端模式。仅支持POSIX系统（Unix域套接字）。
+ *
+ * 服务器常驻内存，每个连接由单独的线程处理。启动时读取一次历史数据，之后g_Databases一直保留在内存中，
+ * 直到收到停止请求（或SIGINT/SIGTERM）时才写回历史数据并退出。这样一批批的小脚本就不必每次都重新加载、写回全部数据。
+ *
+ * 命令行：
+ * 		minidb -server <socket>					启动服务器
+ * 		minidb -client <socket> <in> <out>		将脚本<in>发送给服务器执行，结果写入<out>
+ * 		minidb -stop <socket>					让服务器写回历史数据并退出
+ */
+#ifndef __SERVER_MINIDB_H__
+#define __SERVER_MINIDB_H__
+
+#include "commands.h"
+#include "collector.h"
+
+#include <csignal>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace minidb {
+
+/**
+ * 通信协议：
+ * 		请求		1字节标记 + 内容，客户端写完后关闭写端（shutdown(SHUT_WR)）表示请求结束。
+ * 					'q'：内容为SQL脚本；'x'：停止服务器，无内容。
+ * 		响应		若干帧，每帧为 1字节标记 + u32长度（小端序） + 内容。
+ * 					'o'：输出文件的内容，边执行边发送；'e'：错误信息；'s'：返回状态（i32），总是最后一帧。
+ */
+namespace frame_tag {
+	const char query = 'q';
+	const char stop = 'x';
+	const char output = 'o';
+	const char error = 'e';
+	const char status = 's';
+}
+
+const size_t g_SocketBufferSize = 1 << 16;
+
+atomic<bool> gf_ServerStopRequested(false);		// 无锁原子量，可以在信号处理函数中安全写入
+int g_ListenFd = -1;
+
+// 每个连接由一个独立线程处理，停止时需要等待所有连接处理完毕再写回历史数据
+mutex g_ConnectionMutex;
+condition_variable g_ConnectionCv;
+int g_ActiveConnections = 0;
+
+// 把写入的内容打包为'o'帧发送到套接字的流缓冲区，缓冲区满或flush时发送一帧
+class FrameStreamBuf extends public std::streambuf {
+	private:
+		int fd;
+		vector<char> buffer;
+		bool sendBuffered();
+	protected:
+		virtual int_type overflow(int_type) override;
+		virtual int sync() override;
+	public:
+		FrameStreamBuf(const int);
+		virtual ~FrameStreamBuf() override { sync(); }
+};
+
+return_status runSocketMode(int, char**&);					// 根据命令行分派到以下三种模式
+return_status runServer(const string);
+return_status runClient(const string, const string, const string);
+return_status stopServer(const string);
+
+void serveConnection(const int);							// 连接线程的入口
+void handleConnection(const int);							// 处理一个客户端连接
+sockaddr_un makeSocketAddress(const string);
+int listenOnSocket(const string, struct stat&);				// 在给定路径上监听，并记下所绑定的套接字文件；路径已被占用时报错
+void removeStaleSocket(const string);						// 路径上残留的是无人监听的套接字文件时删除它，其余情况一律报错
+void releaseSocketPath(const string, const struct stat&);	// 路径仍是自己绑定的那个套接字文件时才删除
+int connectToServer(const string);
+void sendAll(const int, const char*, const size_t);
+void sendFrame(const int, const char, const string&);
+bool recvAll(const int, char*, const size_t);
+void onServerSignal(int);
+
+
+
+// 函数体定义全部写在下方
+
+FrameStreamBuf::FrameStreamBuf(const int f):fd(f),buffer(g_SocketBufferSize) {
+	setp(buffer.data(), buffer.data() + buffer.size());
+}
+bool FrameStreamBuf::sendBuffered() {
+	std::ptrdiff_t n = pptr() - pbase();
+	if (n == 0) return true;
+	try {
+		sendFrame(fd, frame_tag::output, string(pbase(), n));
+	}
+	catch (MiniDBExceptionBase&) {
+		return false;
+	}
+	setp(buffer.data(), buffer.data() + buffer.size());
+	return true;
+}
+FrameStreamBuf::int_type FrameStreamBuf::overflow(int_type ch) {
+	if (!sendBuffered()) return traits_type::eof();
+	if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+		*pptr() = traits_type::to_char_type(ch);
+		pbump(1);
+	}
+	return traits_type::not_eof(ch);
+}
+int FrameStreamBuf::sync() {
+	return sendBuffered() ? 0 : -1;
+}
+
+return_status runSocketMode(int argc, char**& argv) {
+	string mode = argv[1];
+	if (mode == "-server") {
+		if (argc != 3) throw ArgumentCountError(2, argc-1, i18n::parseKey(msg_id::unacptcmdl));
+		return runServer(argv[2]);
+	}
+	if (mode == "-client") {
+		if (argc != 5) throw ArgumentCountError(4, argc-1, i18n::parseKey(msg_id::unacptcmdl));
+		return runClient(argv[2], argv[3], argv[4]);
+	}
+	if (argc != 3) throw ArgumentCountError(2, argc-1, i18n::parseKey(msg_id::unacptcmdl));
+	return stopServer(argv[2]);
+}
+
+return_status runServer(const string socket_path) {
+	// 先占住套接字，再读取历史数据：路径被另一个服务器占用时直接退出，不碰它的历史数据
+	struct stat bound_stat;
+	int listen_fd = listenOnSocket(socket_path, bound_stat);
+
+	#ifdef __STORE_LEGACY__
+		try {
+			readLegacyDatabases();
+			openLegacyJournal();
+		}
+		catch (...) {
+			close(listen_fd);
+			releaseSocketPath(socket_path, bound_stat);
+			throw;
+		}
+		logLine(log_level::info, i18n::parseKey(msg_id::readlegfsuc).str());
+	#endif
+
+	// 不设置SA_RESTART，这样accept会被信号打断，从而有机会检查停止标记
+	struct sigaction action = {};
+	action.sa_handler = onServerSignal;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+	signal(SIGPIPE, SIG_IGN);
+
+	logLine(log_level::info, i18n::parseKey(msg_id::srvlisten, {socket_path}).str());
+
+	g_ListenFd = listen_fd;
+	do {
+		// 回收线程同样不处理信号
+		sigset_t blocked, old_mask;
+		sigemptyset(&blocked);
+		sigaddset(&blocked, SIGINT);
+		sigaddset(&blocked, SIGTERM);
+		pthread_sigmask(SIG_BLOCK, &blocked, &old_mask);
+		g_VersionCollector.start();
+		pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+	} while (false);
+	while (!gf_ServerStopRequested) {
+		int conn_fd = accept(listen_fd, nullptr, nullptr);
+		if (conn_fd < 0) {
+			if (errno == EINTR or gf_ServerStopRequested) continue;
+			logLine(log_level::warn, i18n::parseKey(msg_id::sockerr, {"accept", strerror(errno)}).str());
+			continue;
+		}
+		{
+			lock_guard<mutex> lock(g_ConnectionMutex);
+			++g_ActiveConnections;
+		}
+		// 信号只交给主线程处理，连接线程创建时屏蔽SIGINT/SIGTERM（新线程继承信号掩码）
+		sigset_t blocked, old_mask;
+		sigemptyset(&blocked);
+		sigaddset(&blocked, SIGINT);
+		sigaddset(&blocked, SIGTERM);
+		pthread_sigmask(SIG_BLOCK, &blocked, &old_mask);
+		thread(serveConnection, conn_fd).detach();
+		pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+	}
+
+	do {
+		unique_lock<mutex> lock(g_ConnectionMutex);
+		g_ConnectionCv.wait(lock, []{ return g_ActiveConnections == 0; });
+	} while (false);
+	g_VersionCollector.stop();
+
+	close(listen_fd);
+	releaseSocketPath(socket_path, bound_stat);
+	logLine(log_level::info, i18n::parseKey(msg_id::srvstop).str());
+
+	#ifdef __STORE_LEGACY__
+		closeLegacyJournal();
+		storeLegacyDatabases();
+	#endif
+	return return_status::success;
+}
+
+void serveConnection(const int conn_fd) {
+	handleConnection(conn_fd);
+	close(conn_fd);
+	lock_guard<mutex> lock(g_ConnectionMutex);
+	--g_ActiveConnections;
+	g_ConnectionCv.notify_all();
+}
+
+void handleConnection(const int conn_fd) {
+	char tag;
+	if (!recvAll(conn_fd, &tag, 1)) return;
+
+	if (tag == frame_tag::stop) {
+		gf_ServerStopRequested = true;
+		shutdown(g_ListenFd, SHUT_RDWR);			// 唤醒阻塞在accept上的主线程
+		int32_t status = static_cast<int32_t>(return_status::success);
+		try {
+			sendFrame(conn_fd, frame_tag::status, string(reinterpret_cast<char*>(&status), sizeof(status)));
+		}
+		catch (MiniDBExceptionBase&) {}
+		return;
+	}
+
+	return_status status = return_status::success;
+	try {
+		if (tag != frame_tag::query) {
+			throw InvalidArgument(i18n::parseKey(msg_id::unexptstr, {string(1, tag)}));
+		}
+		string script;
+		vector<char> chunk(g_SocketBufferSize);
+		while (true) {
+			ssize_t n = recv(conn_fd, chunk.data(), chunk.size(), 0);
+			if (n < 0 and errno == EINTR) continue;
+			if (n < 0) throw FailedFileOperation(i18n::parseKey(msg_id::sockerr, {"recv", strerror(errno)}));
+			if (n == 0) break;
+			script.append(chunk.data(), n);
+		}
+
+		// 每个脚本都从“未选择数据库”的状态开始，和文件模式下一次运行的行为一致
+		g_Session->reset();
+
+		FrameStreamBuf outbuf(conn_fd);
+		ostream os(&outbuf);
+		try {
+			parseCommand(script, os);
+			os.flush();
+		}
+		catch (...) {
+			os.flush();			// 出错前已经产生的输出照常送达
+			throw;
+		}
+	}
+	catch (MiniDBExceptionBase& e) {
+		string msg = e.what() + g_Session->ln_counter.where();
+		logLine(log_level::error, msg);
+		status = e.status();
+		try { sendFrame(conn_fd, frame_tag::error, msg); } catch (MiniDBExceptionBase&) {}
+	}
+	catch (exception& e) {
+		string msg = i18n::parseKey(msg_id::unexpectederr, {e.what()}).str() + g_Session->ln_counter.where();
+		logLine(log_level::error, msg);
+		status = return_status::unexpt;
+		try { sendFrame(conn_fd, frame_tag::error, msg); } catch (MiniDBExceptionBase&) {}
+	}
+
+	int32_t status_raw = static_cast<int32_t>(status);
+	try {
+		sendFrame(conn_fd, frame_tag::status, string(reinterpret_cast<char*>(&status_raw), sizeof(status_raw)));
+	}
+	catch (MiniDBExceptionBase&) {}		// 客户端已经断开，无需再通知
+}
+
+return_status runClient(const string socket_path, const string ifile_name, const string ofile_name) {
+	ifstream ifile(ifile_name, ios::in | ios::binary);
+	if (!ifile.is_open()) {
+		throw FailedFileOperation(i18n::parseKey(msg_id::openifilef, {ifile_name}));
+	}
+	ofstream ofile(ofile_name, ios::out | ios::binary);
+	if (!ofile.is_open()) {
+		throw FailedFileOperation(i18n::parseKey(msg_id::openofilef, {ofile_name}));
+	}
+
+	int fd = connectToServer(socket_path);
+	sendAll(fd, &frame_tag::query, 1);
+	vector<char> chunk(g_SocketBufferSize);
+	while (ifile) {
+		ifile.read(chunk.data(), chunk.size());
+		if (ifile.gcount() > 0) sendAll(fd, chunk.data(), ifile.gcount());
+	}
+	shutdown(fd, SHUT_WR);
+
+	return_status status = return_status::unexpt;
+	while (true) {
+		char header[5];
+		if (!recvAll(fd, header, sizeof(header))) break;
+		uint32_t len = 0;
+		for (int i = 0; i < 4; ++i) len |= static_cast<uint32_t>(static_cast<unsigned char>(header[1+i])) << (8 * i);
+		string payload(len, '\0');
+		if (len != 0 and !recvAll(fd, &payload[0], len)) break;
+
+		if (header[0] == frame_tag::output) ofile.write(payload.data(), payload.size());
+		else if (header[0] == frame_tag::error) logLine(log_level::error, payload);
+		else if (header[0] == frame_tag::status and len == sizeof(int32_t)) {
+			int32_t raw;
+			std::memcpy(&raw, payload.data(), sizeof(raw));
+			status = static_cast<return_status>(raw);
+			break;
+		}
+	}
+	close(fd);
+	return status;
+}
+
+return_status stopServer(const string socket_path) {
+	int fd = connectToServer(socket_path);
+	sendAll(fd, &frame_tag::stop, 1);
+	shutdown(fd, SHUT_WR);
+	char header[5];
+	int32_t raw = static_cast<int32_t>(return_status::unexpt);
+	if (recvAll(fd, header, sizeof(header)) and header[0] == frame_tag::status) {
+		recvAll(fd, reinterpret_cast<char*>(&raw), sizeof(raw));
+	}
+	close(fd);
+	return static_cast<return_status>(raw);
+}
+
+sockaddr_un makeSocketAddress(const string socket_path) {
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (socket_path.size() == 0 or socket_path.size() >= sizeof(addr.sun_path)) {
+		throw InvalidArgument(i18n::parseKey(msg_id::sockpathlen, {socket_path, itos(sizeof(addr.sun_path)-1)}));
+	}
+	std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size()+1);
+	return addr;
+}
+int listenOnSocket(const string socket_path, struct stat& bound_stat) {
+	sockaddr_un addr = makeSocketAddress(socket_path);
+	removeStaleSocket(socket_path);
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		throw FailedFileOperation(i18n::parseKey(msg_id::sockerr, {"socket", strerror(errno)}));
+	}
+	// 检查之后又有人抢先创建了这个路径时，bind会以EADDRINUSE失败，同样不会覆盖
+	if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+		string reason = strerror(errno);
+		close(listen_fd);
+		throw FailedFileOperation(i18n::parseKey(msg_id::sockerr, {"bind", reason}));
+	}
+	if (lstat(socket_path.c_str(), &bound_stat) != 0 or listen(listen_fd, 16) != 0) {
+		string reason = strerror(errno);
+		close(listen_fd);
+		unlink(socket_path.c_str());		// 刚刚由bind创建，还没有人能连上
+		throw FailedFileOperation(i18n::parseKey(msg_id::sockerr, {"listen", reason}));
+	}
+	return listen_fd;
+}
+void removeStaleSocket(const string socket_path) {
+	struct stat st;
+	if (lstat(socket_path.c_str(), &st) != 0) {
+		if (errno == ENOENT) return;
+		throw FailedFileOperation(i18n::parseKey(msg_id::sockerr, {"lstat", strerror(errno)}));
+	}
+	// 不是套接字文件（普通文件、目录、符号链接等）的一律不动
+	if (!S_ISSOCK(st.st_mode)) {
+		throw FailedFileOperation(i18n::parseKey(msg_id::sockerr, {"bind", strerror(EEXIST)}));
+	}
+	// 能连上说明另一个服务器正在监听；只有被拒绝连接才说明是上次异常退出残留的文件
+	sockaddr_un addr = makeSocketAddress(socket_path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		throw FailedFileOperation(i18n::parseKey(msg_id::sockerr, {"socket", strerror(errno)}));
+	}
+	int res = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+	int err = errno;
+	close(fd);
+	if (res == 0) {
+		throw FailedFileOperation(i18n::parseKey(msg_id::sockerr, {"bind", strerror(EADDRINUSE)}));
+	}
+	if (err != ECONNREFUSED) {
+		throw FailedFileOperation(i18n::parseKey(msg_id::sockerr, {"connect", strerror(err)}));
+	}
+	unlink(socket_path.c_str());
+}
+void releaseSocketPath(const string socket_path, const struct stat& bound_stat) {
+	struct stat st;
+	if (lstat(socket_path.c_str(), &st) != 0) return;
+	if (!S_ISSOCK(st.st_mode) or st.st_dev != bound_stat.st_dev or st.st_ino != bound_stat.st_ino) return;
+	unlink(socket_path.c_str());
+}
+int connectToServer(const string socket_path) {
+	sockaddr_un addr = makeSocketAddress(socket_path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		throw FailedFileOperation(i18n::parseKey(msg_id::sockerr, {"socket", strerror(errno)}));
+	}
+	if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+		string reason = strerror(errno);
+		close(fd);
+		throw FailedFileOperation(i18n::parseKey(msg_id::sockerr, {"connect", reason}));
+	}
+	return fd;
+}
+void sendAll(const int fd, const char* data, const size_t n) {
+	size_t sent = 0;
+	while (sent < n) {
+		ssize_t r = send(fd, data + sent, n - sent, MSG_NOSIGNAL);
+		if (r < 0 and errno == EINTR) continue;
+		if (r <= 0) throw FailedFileOperation(i18n::parseKey(msg_id::sockerr, {"send", strerror(errno)}));
+		sent += r;
+	}
+}
+void sendFrame(const int fd, const char tag, const string& payload) {
+	char header[5];
+	header[0] = tag;
+	uint32_t len = payload.size();
+	for (int i = 0; i < 4; ++i) header[1+i] = static_cast<char>((len >> (8 * i)) & 0xFF);
+	sendAll(fd, header, sizeof(header));
+	sendAll(fd, payload.data(), payload.size());
+}
+bool recvAll(const int fd, char* data, const size_t n) {
+	size_t got = 0;
+	while (got < n) {
+		ssize_t r = recv(fd, data + got, n - got, 0);
+		if (r < 0 and errno == EINTR) continue;
+		if (r <= 0) return false;
+		got += r;
+	}
+	return true;
+}
+void onServerSignal(int) {
+	gf_ServerStopRequested = true;
+}
+
+}
+
+#endif
\ No newline at end of file
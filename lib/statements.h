@@ -0,0 +1,143 @@
+/**
+ * 头文件：statements.h
+ * 解析完成的语句。
+ *
+ * paramsanlys.h中的解析函数把参数列表整理为这里的结构体：表名、列名已经拆分好，常量已经判别好类型，
+ * where子句已经拆成一条条比较式。operations.h中的执行函数和loggers.h中的日志函数直接读取这些结构体，
+ * 不必再逐个扫描参数列表去找from、where之类的分隔位置。
+ */
+#ifndef __STATEMENTS_MINIDB_H__
+#define __STATEMENTS_MINIDB_H__
+
+#include "objects.h"
+
+namespace minidb {
+
+enum cmd_type {				// SQL语句的种类
+	createdb,	createtab,	usedb,		droptab,
+	insertion,	selection,	update,		delfrom,
+	innerjoin,	exportion,	txnbegin,	txncommit,
+	txnrollback,	vacuum,
+	null = -1
+};
+// 这里单独把inner join拎出来特判
+
+// 比较式的一侧：列名，或者解析时就已确定类型的常量
+struct Operand {
+	bool f_isColumn;
+	string name;				// 列名，inner join的where子句中为"表名.列名"
+	Term literal;
+};
+struct Condition {
+	Operand first;
+	string op;					// 比较运算符
+	Operand second;
+};
+struct WhereClause {			// 没有where子句时conditions为空
+	vector<Condition> conditions;
+	vector<keyword_index> connectives;	// conditions之间的逻辑运算符，比conditions少一个
+};
+// 赋值表达式右值（已转为后缀表达式）中的一项：运算符，或者操作数
+struct ExprItem {
+	bool f_isOperator;
+	string op;					// 运算符
+	Operand operand;
+};
+// 解析好的一条赋值表达式。列名到执行时才换成序号（解析时表可能还不存在）
+struct Assignment {
+	string text;				// 原文，如"a = a + 1 "，日志用
+	string target;				// 左值的列名，左值不合法时为空
+	vector<ExprItem> postfix;	// 右值的后缀表达式
+	std::exception_ptr error;	// 解析出错时记下的异常，等到第一个匹配的行才抛出，出错的时机与逐行解析时相同
+};
+struct ColumnRef {				// 形如"表名.列名"的列，列名可以是通配符
+	string table;
+	string column;
+};
+
+struct CreateDatabaseSt {
+	string database;
+};
+struct UseDatabaseSt {
+	string database;
+};
+struct CreateTableSt {
+	string table;
+	vector<pair<string, string>> columns;	// 列名及其类型
+};
+struct DropTableSt {
+	string table;
+};
+struct VacuumSt {
+	string table;
+};
+struct InsertionSt {
+	string table;
+	vector<string_view> values;	// 指向输入脚本中的常量，插入时才复制进表
+};
+struct SelectionSt {
+	vstring columns;			// 可以只有一个通配符
+	string table;
+	WhereClause where;
+};
+struct InnerJoinSt {
+	vector<ColumnRef> columns;
+	string table_first;			// from之后的表
+	string table_second;		// inner join之后的表
+	ColumnRef on_first;
+	ColumnRef on_second;
+	WhereClause where;
+};
+struct UpdateSt {
+	string table;
+	vector<Assignment> assignments;
+	WhereClause where;
+};
+struct DeleteFromSt {
+	string table;
+	WhereClause where;
+};
+enum class export_source {
+	table,
+	selection,
+	innerjoin
+};
+struct ExportSt {
+	string format;				// "csv"或"binary"
+	string path;				// 已去掉单引号
+	export_source source;
+	string table;				// source为table时有效
+	SelectionSt selection;		// source为selection时有效
+	InnerJoinSt innerjoin;		// source为innerjoin时有效
+};
+
+typedef std::variant<
+	std::monostate,
+	CreateDatabaseSt,	UseDatabaseSt,	CreateTableSt,	DropTableSt,
+	InsertionSt,		SelectionSt,	InnerJoinSt,	UpdateSt,
+	DeleteFromSt,		ExportSt,		VacuumSt
+> statement_body;
+
+struct Statement {
+	cmd_type type = cmd_type::null;
+	statement_body body;				// 事务控制语句和空语句没有内容
+};
+
+Operand makeOperand(const string&);		// 把where子句中的一项整理为操作数
+
+
+
+// 函数体定义全部写在下方
+
+Operand makeOperand(const string& str) {
+	Operand res;
+	string type = parseValueType(str);
+	res.f_isColumn = (type == keywords::variable);
+	if (res.f_isColumn) res.name = str;
+	else res.literal.setType(type).setValue(str);
+	return res;
+}
+
+}
+
+#endif
\ No newline at end of file
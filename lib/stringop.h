@@ -9,9 +9,9 @@
 
 namespace minidb {
 
-template <typename T> bool doesContain(const T, const vector<T>);		// 在给定vector中查找key，找到返回true，否则返回false。
+template <typename T, typename U> bool doesContain(const T&, const vector<U>&);		// 在给定vector中查找key，找到返回true，否则返回false。
 bool doesContain(const char, const string);							// 在给定string中查找char，找到返回true，否则返回false。
-bool isReservedKeyword(const string);					// 判断给定字符串是否为关键字。
+bool isReservedKeyword(const string);					// 判断给定字符串是否为保留的关键字（不能用作表名、列名）。
 bool doesFitNameRequirement(const string);				// 判断给定字符串是否符合变量名命名原则（不考虑与关键字冲突的情况）。
 bool isValidVarName(const string); 						// 判断给定字符串是否符合变量名命名原则。
 bool isValidMemberVarName(const string);				// 判断给定字符串是否符合a.b的形式，且a和b均变量名命名原则。
@@ -24,37 +24,58 @@ vstring splitByDelimiters(const string, const char);
 string trim(const string);								// 去除字符串头尾空白
 string trimDuplicateWs(const string);					// 去除字符串中间重复空白
 void checkStrValidity(const vstring);					// 检查字符串是否有效
-
-istream& getsUntil(istream&, string&, const string);	// 读取一整行字符串，直到遇到给定的字符串或读取出错为止。
+void checkStrValidity(const string_view);
 
 const vector<char> g_Whitespaces = {' ', '\t', '\n'};		// 空白字符列表
 
-namespace keywords {										// 字符串列表
-	const kwstring create = "create";
-	const kwstring drop = "drop";
-	const kwstring database = "database";
-	const kwstring use = "use";
-	const kwstring table = "table";
-	const kwstring insert = "insert";
-	const kwstring into = "into";
-	const kwstring inner = "inner";
-	const kwstring join = "join";
-	const kwstring values = "values";
-	const kwstring select = "select";
-	const kwstring from = "from";
-	const kwstring where = "where";
-	const kwstring _and = "and";
-	const kwstring _or = "or";
-	const kwstring _xor = "xor";
-	const kwstring on = "on";
-	const kwstring update = "update";
-	const kwstring set = "set";
-	const kwstring _delete = "delete";
-	const kwstring integer = "integer";
-	const kwstring _float = "float";
-	const kwstring text = "text";
+enum class keyword_index {						// 关键字枚举类型，注意必须与g_Keywords、g_KeywordSpellings顺序完全一致（最后两个除外）
+	create,		drop,		database,	use,
+	table,		insert,		into,		inner,
+	join,		values,		select,		from,
+	where,		_and,		_or,		_xor,
+	on,			update,		set,		_delete,
+	integer,	_float,		text,		_export,
+	begin,		commit,		rollback,	vacuum,
+	unexpected = -1,
+	newline = -2
+};
+namespace keywords {										// 字符串列表，保留关键字同时记下自己的编号，与词法单元比较时只比较编号
+	const kwstring create		{"create",		keyword_index::create};
+	const kwstring drop			{"drop",		keyword_index::drop};
+	const kwstring database		{"database",	keyword_index::database};
+	const kwstring use			{"use",			keyword_index::use};
+	const kwstring table		{"table",		keyword_index::table};
+	const kwstring insert		{"insert",		keyword_index::insert};
+	const kwstring into			{"into",		keyword_index::into};
+	const kwstring inner		{"inner",		keyword_index::inner};
+	const kwstring join			{"join",		keyword_index::join};
+	const kwstring values		{"values",		keyword_index::values};
+	const kwstring select		{"select",		keyword_index::select};
+	const kwstring from			{"from",		keyword_index::from};
+	const kwstring where		{"where",		keyword_index::where};
+	const kwstring _and			{"and",			keyword_index::_and};
+	const kwstring _or			{"or",			keyword_index::_or};
+	const kwstring _xor			{"xor",			keyword_index::_xor};
+	const kwstring on			{"on",			keyword_index::on};
+	const kwstring update		{"update",		keyword_index::update};
+	const kwstring set			{"set",			keyword_index::set};
+	const kwstring _delete		{"delete",		keyword_index::_delete};
+	const kwstring integer		{"integer",		keyword_index::integer};
+	const kwstring _float		{"float",		keyword_index::_float};
+	const kwstring text			{"text",		keyword_index::text};
+	const kwstring _export		{"export",		keyword_index::_export};
+	const kwstring begin		{"begin",		keyword_index::begin};
+	const kwstring commit		{"commit",		keyword_index::commit};
+	const kwstring rollback		{"rollback",	keyword_index::rollback};
+	const kwstring vacuum		{"vacuum",		keyword_index::vacuum};
 
 	const kwstring variable = "variable";
+
+	// 以下关键字只在export语句的特定位置有意义，不算作保留字
+	const kwstring to = "to";
+	const kwstring format = "format";
+	const kwstring csv = "csv";
+	const kwstring binary = "binary";
 }
 const vector<kwstring> g_Keywords = {							// 关键字列表（纯小写）
 	keywords::create,	keywords::drop,		keywords::database,		keywords::use,
@@ -62,31 +83,83 @@ const vector<kwstring> g_Keywords = {							// 关键字列表（纯小写）
 	keywords::join,		keywords::values,	keywords::select,		keywords::from,
 	keywords::where,	keywords::_and,		keywords::_or,			keywords::_xor,
 	keywords::on,		keywords::update,	keywords::set,			keywords::_delete,
-	keywords::integer,	keywords::_float,	keywords::text
+	keywords::integer,	keywords::_float,	keywords::text,			keywords::_export,
+	keywords::begin,	keywords::commit,	keywords::rollback,		keywords::vacuum
 };
-enum class keyword_index {						// 关键字枚举类型，注意必须与g_Keywords顺序完全一致（最后两个除外）
-	create,		drop,		database,	use,
-	table,		insert,		into,		inner,
-	join,		values,		select,		from,
-	where,		_and,		_or,		_xor,
-	on,			update,		set,		_delete,
-	integer,	_float,		text,
-	unexpected = -1,
-	newline = -2
+
+/**
+ * 关键字的完美哈希
+ * 编译期在g_KeywordSpellings上试验种子，直到找到一个让所有关键字落在哈希表不同槽位的种子（找不到则编译失败）。
+ * 查找时只需计算一次哈希、做一次不分配内存的忽略大小写比较。
+ */
+constexpr string_view g_KeywordSpellings[] = {
+	"create",	"drop",		"database",	"use",
+	"table",	"insert",	"into",		"inner",
+	"join",		"values",	"select",	"from",
+	"where",	"and",		"or",		"xor",
+	"on",		"update",	"set",		"delete",
+	"integer",	"float",	"text",		"export",
+	"begin",	"commit",	"rollback",	"vacuum"
+};
+constexpr size_t g_KeywordCount = sizeof(g_KeywordSpellings) / sizeof(g_KeywordSpellings[0]);
+constexpr size_t g_KeywordHashBits = 6;
+constexpr size_t g_KeywordHashSize = 1 << g_KeywordHashBits;
+constexpr size_t g_KeywordMaxLength = 8;
+
+constexpr uint32_t hashKeyword(const string_view, const uint32_t);		// 返回值即哈希表槽位
+constexpr uint32_t findKeywordSeed();
+class KeywordHashTable {
+	public:
+		int8_t slots[g_KeywordHashSize];
+		constexpr KeywordHashTable();
 };
 
+keyword_index getKeywordIndex(const string_view);			// 将string类型的关键字转化为keyword_name类型
+bool isStatementKeyword(const keyword_index);				// 只在语句开头才算关键字、仍可用作表名和列名的关键字（后来加入的语句，以免旧脚本和历史数据中的同名表、列失效）
+
+// 词法单元：切分语句时就查好关键字编号，之后的比较都是整数比较
+// 词法单元不持有文本，只指向输入脚本（或某个静态字符串）中的一段，脚本在整个执行期间都不会释放。
+// 需要保存文本时（如写入语句结构体），转换为string，这时才复制。
+class Token {
+	private:
+		string_view text;
+		keyword_index kw;
+	public:
+		Token(const string_view s = ""):text(s),kw(getKeywordIndex(s)){}
+		Token(const char* s):Token(string_view(s)){}
+		operator string() const { return string(text); }
+		operator kwstring() const { return kwstring(string(text)); }
+		string_view str() const { return text; }
+		keyword_index keyword() const { return kw; }
+		bool empty() const { return text.empty(); }
+		size_t size() const { return text.size(); }
+		char at(const size_t i) const { return text.at(i); }
+};
+typedef std::pmr::vector<Token> vtoken;		// 默认向系统申请内存，语句内的临时参数列表可以改用内存池（见arena.h）
+
 ostream& operator<< (ostream&, const keyword_index);		// 重载ostream左移运算符实现自定义类型输出
+ostream& operator<< (ostream&, const Token&);
 bool operator== (const string, const kwstring);
 bool operator!= (const string, const kwstring);
-keyword_index getKeywordIndex(const string);				// 将string类型的关键字转化为keyword_name类型
+bool operator== (const Token&, const kwstring&);
+bool operator!= (const Token&, const kwstring&);
+bool operator== (const Token&, const string&);
+bool operator!= (const Token&, const string&);
+bool operator== (const Token&, const char*);
+bool operator!= (const Token&, const char*);
+bool operator== (const string&, const Token&);
+bool operator!= (const string&, const Token&);
+bool operator== (const Token&, const Token&);
+bool operator!= (const Token&, const Token&);
+keyword_index getKeywordIndex(const Token&);
 
 
 
 
 // 函数体定义全部写在下方
 
-template <typename T> bool doesContain(const T check_value, const vector<T> value_list) {
-	for (T value : value_list) {
+template <typename T, typename U> bool doesContain(const T& check_value, const vector<U>& value_list) {
+	for (const U& value : value_list) {
 		if (check_value == value) return true;
 	}
 	return false;
@@ -137,32 +210,33 @@ string trimDuplicateWs(const string str) {
 	return trim(res);
 }
 void checkStrValidity(const vstring strs) {
-	for (string str : strs) {
-		auto pos = str.find('\'');
-		if (pos == string::npos) {
-			// 没有单引号，说明压根不是字符串
-			continue;
-		}
-		if (pos != 0) {
-			// 有单引号但不是在开头，必然为非法输入
-			throw InvalidArgument(i18n::parseKey("strunexptprfx", {str.substr(0,pos),str.substr(pos+1)}));
-		}
-		auto rpos = str.rfind('\'');
-		if (rpos == pos) {
-			// 正反找相同，说明总共只有一个单引号，则字符串不完整（结尾未闭合）
-			throw InvalidArgument(i18n::parseKey("incmpltstr"));
-		}
-		if (rpos != str.size()-1) {
-			// 找到另一个单引号却不在开头，则字符串结束后仍有其他内容
-			throw InvalidArgument(i18n::parseKey("strunexptsufx", {str.substr(rpos+1),str.substr(1,rpos-1)}));
-		}
-		auto mpos = str.find('\'', 1);
-		if (mpos != rpos) {
-			// 在开头之后找到除结尾以外的其他单引号。
-			// 由于任务要求不包括对转义符的处理，这里不会把SQL的双单引号转义（''）处理为文本内单引号（'）。
-			// 由此进一步认为：除开头结尾以外，字符串在其余任何位置出现单引号，都被认为是非法输入。
-			throw InvalidArgument(i18n::parseKey("strunexptsquote", {itos(mpos-1), str}));
-		}
+	for (const string& str : strs) checkStrValidity(string_view(str));
+}
+void checkStrValidity(const string_view str) {
+	auto pos = str.find('\'');
+	if (pos == string::npos) {
+		// 没有单引号，说明压根不是字符串
+		return;
+	}
+	if (pos != 0) {
+		// 有单引号但不是在开头，必然为非法输入
+		throw InvalidArgument(i18n::parseKey(msg_id::strunexptprfx, {string(str.substr(0,pos)),string(str.substr(pos+1))}));
+	}
+	auto rpos = str.rfind('\'');
+	if (rpos == pos) {
+		// 正反找相同，说明总共只有一个单引号，则字符串不完整（结尾未闭合）
+		throw InvalidArgument(i18n::parseKey(msg_id::incmpltstr));
+	}
+	if (rpos != str.size()-1) {
+		// 找到另一个单引号却不在开头，则字符串结束后仍有其他内容
+		throw InvalidArgument(i18n::parseKey(msg_id::strunexptsufx, {string(str.substr(rpos+1)),string(str.substr(1,rpos-1))}));
+	}
+	auto mpos = str.find('\'', 1);
+	if (mpos != rpos) {
+		// 在开头之后找到除结尾以外的其他单引号。
+		// 由于任务要求不包括对转义符的处理，这里不会把SQL的双单引号转义（''）处理为文本内单引号（'）。
+		// 由此进一步认为：除开头结尾以外，字符串在其余任何位置出现单引号，都被认为是非法输入。
+		throw InvalidArgument(i18n::parseKey(msg_id::strunexptsquote, {itos(mpos-1), string(str)}));
 	}
 }
 vstring splitByDelimiters(const string res, const string delim) {
@@ -197,9 +271,20 @@ vstring splitByDelimiters(const string res, const char delim) {
 	return splitByDelimiters(res, string(1, delim));
 }
 bool isReservedKeyword(const string str) {
-	if (str == "") return false;
-	for (kwstring keyword_str : g_Keywords) if (keyword_str == str) return true;
-	return false;
+	keyword_index kw = getKeywordIndex(str);
+	return static_cast<int>(kw) >= 0 and !isStatementKeyword(kw);
+}
+bool isStatementKeyword(const keyword_index kw) {
+	switch (kw) {
+		case keyword_index::_export:
+		case keyword_index::begin:
+		case keyword_index::commit:
+		case keyword_index::rollback:
+		case keyword_index::vacuum:
+			return true;
+		default:
+			return false;
+	}
 }
 bool doesFitNameRequirement(const string str) {
 	if (str == "") return false;
@@ -225,22 +310,6 @@ bool isValidMemberVarName(const string r) {
 	string member = r.substr(pos+1);
 	return (isValidVarName(parent) and isValidVarName(member));
 }
-istream& getsUntil(istream& is, string& str, const string delim) {
-	const int dsize = delim.size();
-	string res;
-	for (int i = 1; !is.fail(); ++i) {
-		char ch;
-		is >> ch;
-		res.push_back(ch);
-		if (i < dsize) continue;
-		if (res.substr(i-dsize) == delim) {
-			str = trimDuplicateWs(res.substr(0, i-dsize));
-			return is;
-		}
-	}
-	str = trimDuplicateWs(res);
-	return is;
-}
 ostream& operator<< (ostream& os, const keyword_index kw) {
 	return os << g_Keywords.at(static_cast<int>(kw)).str();
 }
@@ -250,14 +319,87 @@ bool operator== (const string s, const kwstring kws) {
 bool operator!= (const string s, const kwstring kws) {
 	return !(s == kws);
 }
-keyword_index getKeywordIndex(const string str) {
-	if (str == symbols::newl) return keyword_index::newline;
-	int i = 0;
-	for (kwstring kws : g_Keywords) {
-		if (kws == str) return static_cast<keyword_index>(i);
-		++i;
+constexpr uint32_t hashKeyword(const string_view str, const uint32_t seed) {
+	// FNV-1a，逐字符先转小写
+	uint32_t h = 2166136261u ^ seed;
+	for (char ch : str) {
+		h ^= static_cast<uint8_t>(asciiLower(ch));
+		h *= 16777619u;
+	}
+	// 乘法只会让低位影响高位，所以取最高的几位作为槽位
+	return h >> (32 - g_KeywordHashBits);
+}
+constexpr uint32_t findKeywordSeed() {
+	for (uint32_t seed = 0; seed < 100000; ++seed) {
+		bool used[g_KeywordHashSize] = {};
+		bool f_isPerfect = true;
+		for (size_t i = 0; i < g_KeywordCount and f_isPerfect; ++i) {
+			size_t slot = hashKeyword(g_KeywordSpellings[i], seed);
+			if (used[slot]) f_isPerfect = false;
+			used[slot] = true;
+		}
+		if (f_isPerfect) return seed;
+	}
+	return UINT32_MAX;
+}
+constexpr uint32_t g_KeywordSeed = findKeywordSeed();
+static_assert(g_KeywordSeed != UINT32_MAX, "No perfect hash seed found for the keyword list.");
+constexpr KeywordHashTable::KeywordHashTable():slots() {
+	for (size_t i = 0; i < g_KeywordHashSize; ++i) slots[i] = -1;
+	for (size_t i = 0; i < g_KeywordCount; ++i) {
+		slots[hashKeyword(g_KeywordSpellings[i], g_KeywordSeed)] = static_cast<int8_t>(i);
 	}
-	return keyword_index::unexpected;
+}
+constexpr KeywordHashTable g_KeywordTable;
+
+keyword_index getKeywordIndex(const string_view str) {
+	if (str.size() > g_KeywordMaxLength) {
+		if (str == string_view(symbols::newl)) return keyword_index::newline;
+		return keyword_index::unexpected;
+	}
+	int8_t i = g_KeywordTable.slots[hashKeyword(str, g_KeywordSeed)];
+	if (i < 0 or !equalIgnoringCase(str, g_KeywordSpellings[i])) {
+		if (str == string_view(symbols::newl)) return keyword_index::newline;
+		return keyword_index::unexpected;
+	}
+	return static_cast<keyword_index>(i);
+}
+keyword_index getKeywordIndex(const Token& token) {
+	return token.keyword();
+}
+ostream& operator<< (ostream& os, const Token& token) {
+	return os << token.str();
+}
+bool operator== (const Token& token, const kwstring& kws) {
+	if (kws.getId() >= 0) return static_cast<int>(token.keyword()) == kws.getId();
+	return kws == token.str();
+}
+bool operator!= (const Token& token, const kwstring& kws) {
+	return !(token == kws);
+}
+bool operator== (const Token& token, const string& str) {
+	return token.str() == string_view(str);
+}
+bool operator!= (const Token& token, const string& str) {
+	return token.str() != string_view(str);
+}
+bool operator== (const Token& token, const char* str) {
+	return token.str() == string_view(str);
+}
+bool operator!= (const Token& token, const char* str) {
+	return token.str() != string_view(str);
+}
+bool operator== (const string& str, const Token& token) {
+	return token.str() == string_view(str);
+}
+bool operator!= (const string& str, const Token& token) {
+	return token.str() != string_view(str);
+}
+bool operator== (const Token& a, const Token& b) {
+	return a.str() == b.str();
+}
+bool operator!= (const Token& a, const Token& b) {
+	return a.str() != b.str();
 }
 
 bool isValidCmpOp(const string s) {
@@ -0,0 +1,172 @@
+/**
+ * 头文件：transaction.h
+ * 事务与持久化日志。
+ *
+ * 每条语句都在一个事务中执行：没有用begin显式开启事务时，语句自成一个事务，执行完立即提交（自动提交）。
+ * 显式事务从begin开始，到commit或rollback结束，期间所有insert、update、delete共用一个WriteBatch，
+ * 它记录了事务写入的每一个新版本和删除标记，也就是事务的撤销日志：rollback时据此逐条撤销。
+ *
+ * 事务写过的表，其写者锁一直持有到事务结束，以免其他写者改动同一行。
+ * 不同事务以不同顺序锁表可能互相等待，因此加锁有超时，超时即报错，由出错的一方回滚。
+ * 线程池中执行的语句不等待写者锁（见setNoWait）：锁被占用时立即放弃，由调度器重新安排，工作线程不会被长时间占住。
+ *
+ * 定义了宏__STORE_LEGACY__时，每次提交还会把事务中改动数据的语句追加到历史数据文件末尾（持久化日志），一个事务只写入一次。
+ * 只有显式事务的commit会立即把日志刷新到文件；自动提交的语句只追加到日志的缓冲区（g_JournalBufferSize），
+ * 缓冲区写满、脚本执行完（见flushJournal）或者程序退出时才整块写入，逐条执行的insert、update、delete因此不会每条都产生一次系统调用。
+ * 程序意外退出时，下次启动读取历史数据即可重放已经写入的语句；正常退出时历史数据文件会被整体重写。
+ */
+#ifndef __TRANSACTION_MINIDB_H__
+#define __TRANSACTION_MINIDB_H__
+
+#include "objects.h"
+
+namespace minidb {
+
+const int g_LockTimeoutMs = 5000;			// 等待表的写者锁的最长时间（毫秒）
+
+const size_t g_JournalBufferSize = 1 << 16;	// 持久化日志的缓冲区大小
+
+ofstream g_Journal;							// 持久化日志，未打开时不记录
+char g_JournalBuffer[g_JournalBufferSize];	// 日志的缓冲区，打开日志之前交给g_Journal
+string g_JournalDatabase;					// 日志中最近一次切换到的数据库，仅在g_CommitMutex下访问
+
+typedef unique_lock<TableLatch> table_wlock;
+
+class Transaction {
+	private:
+		WriteBatch batch;					// 撤销日志
+		vector<const Table*> locked_tables;
+		vector<table_wlock> latches;
+		vector<pair<string, string>> statements;	// 待写入日志的语句及其执行时所在的数据库
+		bool f_Explicit;
+		bool f_NoWait;						// 写者锁被占用时不等待，直接失败
+		bool f_LatchBusy;					// 是否因写者锁被占用而失败
+		void writeJournal();
+	public:
+		Transaction(const bool f_exp = false):f_Explicit(f_exp),f_NoWait(false),f_LatchBusy(false){}
+		~Transaction() { rollback(); }		// 未提交就销毁的事务（如语句出错）一律回滚，撤销完成后才释放写者锁
+		Transaction(const Transaction&) = delete;
+		Transaction& operator= (const Transaction&) = delete;
+		WriteBatch& lockForWrite(Table&, const string);		// 锁定要写入的表（已锁定则直接返回），返回撤销日志
+		version_t getMarker() const { return batch.getMarker(); }
+		bool isExplicit() const { return f_Explicit; }
+		void setNoWait(const bool f_noWait) { f_NoWait = f_noWait; }
+		bool isLatchBusy() const { return f_LatchBusy; }
+		void recordStatement(const string, const string);
+		void commit();
+		void rollback();
+};
+
+table_wlock lockTableLatch(const Table&, const string);	// 带超时地获取表的写者锁
+table_wlock lockCatalogAndTable(unique_lock<shared_mutex>&, const string);	// 独占目录锁并锁定当前数据库中的表，从不在独占目录锁时等待表
+version_t getSessionMarker();							// 当前会话所在显式事务的标记，没有则为0
+void flushJournal();									// 把缓冲区中自动提交的日志写入文件
+string joinStatement(const vtoken&);					// 把参数列表还原为一条可以重新解析的语句
+
+
+
+// 函数体定义全部写在下方
+
+table_wlock lockTableLatch(const Table& table, const string name) {
+	table_wlock lock(table.getLatch(), std::defer_lock);
+	if (!lock.try_lock_for(std::chrono::milliseconds(g_LockTimeoutMs))) {
+		throw TransactionError(i18n::parseKey(msg_id::locktimeout, {name}));
+	}
+	return lock;
+}
+
+table_wlock lockCatalogAndTable(unique_lock<shared_mutex>& catalog_wlock, const string name) {
+	while (true) {
+		// 等待写者时只持有目录的共享锁：占着这张表的显式事务执行后续语句也只需要共享锁，能够一直执行到提交
+		do {
+			shared_lock<shared_mutex> catalog_rlock(g_CatalogMutex);
+			lockTableLatch(getCurrentDatabase().findTable(name), name);
+		} while (false);
+		// 独占目录锁之后只尝试一次，被其他写者抢先就放开目录锁重新等待
+		catalog_wlock.lock();
+		table_wlock table_lock(getCurrentDatabase().findTable(name).getLatch(), std::try_to_lock);
+		if (table_lock.owns_lock()) return table_lock;
+		catalog_wlock.unlock();
+	}
+}
+
+WriteBatch& Transaction::lockForWrite(Table& table, const string name) {
+	for (const Table* p_table : locked_tables) {
+		if (p_table == &table) return batch;
+	}
+	if (f_NoWait) {
+		table_wlock lock(table.getLatch(), std::try_to_lock);
+		if (!lock.owns_lock()) {
+			f_LatchBusy = true;
+			throw TransactionError(i18n::parseKey(msg_id::locktimeout, {name}));
+		}
+		latches.push_back(std::move(lock));
+	}
+	else latches.push_back(lockTableLatch(table, name));
+	locked_tables.push_back(&table);
+	return batch;
+}
+void Transaction::recordStatement(const string database_name, const string statement) {
+	if (!g_Journal.is_open()) return;
+	statements.push_back({database_name, statement});
+}
+void Transaction::writeJournal() {
+	// 调用者持有g_CommitMutex，因此日志中语句的顺序与提交顺序一致
+	if (statements.empty() or !g_Journal.is_open()) return;
+	bool f_isGrouped = statements.size() > 1;
+	if (f_isGrouped) g_Journal << keywords::begin.str() << symbols::cmdend << '\n';
+	for (const auto& p_statement : statements) {
+		if (p_statement.first != "" and p_statement.first != g_JournalDatabase) {
+			g_Journal << keywords::use.str() << ' ' << keywords::database.str() << ' ' << p_statement.first << symbols::cmdend << '\n';
+			g_JournalDatabase = p_statement.first;
+		}
+		g_Journal << p_statement.second << symbols::cmdend << '\n';
+	}
+	// 多条语句用begin、commit包起来：日志末尾若只写了一半，重放时未提交的部分会被回滚
+	if (f_isGrouped) g_Journal << keywords::commit.str() << symbols::cmdend << '\n';
+	// 显式事务提交时立即写入；自动提交的语句留在缓冲区里，由flushJournal成批写入
+	if (f_Explicit) g_Journal.flush();
+	if (!g_Journal) throw FailedFileOperation(i18n::parseKey(msg_id::writelegfilef));
+}
+void Transaction::commit() {
+	do {
+		lock_guard<mutex> lock(g_CommitMutex);
+		writeJournal();
+		batch.publish();
+	} while (false);
+	statements.clear();
+	latches.clear();					// 提交之后才释放写者锁
+	locked_tables.clear();
+}
+void Transaction::rollback() {
+	batch.abort();						// 先撤销，再释放写者锁
+	statements.clear();
+	latches.clear();
+	locked_tables.clear();
+}
+
+version_t getSessionMarker() {
+	if (g_Session->p_Transaction == nullptr) return 0;
+	return g_Session->p_Transaction->getMarker();
+}
+
+void flushJournal() {
+	lock_guard<mutex> lock(g_CommitMutex);
+	if (!g_Journal.is_open()) return;
+	g_Journal.flush();
+	if (!g_Journal) throw FailedFileOperation(i18n::parseKey(msg_id::writelegfilef));
+}
+
+string joinStatement(const vtoken& params) {
+	string res;
+	for (const Token& token : params) {
+		if (token == symbols::newl) continue;
+		if (res != "") res.push_back(' ');
+		res.append(token.str());
+	}
+	return res;
+}
+
+}
+
+#endif
\ No newline at end of file
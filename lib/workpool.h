@@ -0,0 +1,116 @@
+/**
+ * 头文件：workpool.h
+ * 工作窃取线程池。
+ *
+ * 每个工作线程有自己的任务队列，新任务轮流放入各队列。工作线程优先从自己队列的尾部取任务，
+ * 自己的队列空了就从其他队列的头部“偷”一个，这样某个线程拿到一串耗时的任务时，其余线程不会闲着。
+ * 线程池在第一次使用时创建，线程数与硬件线程数相同，所有会话共用。
+ */
+#ifndef __WORKPOOL_MINIDB_H__
+#define __WORKPOOL_MINIDB_H__
+
+#include "auxiliaries.h"
+
+namespace minidb {
+
+class WorkStealingPool {
+	private:
+		struct WorkerQueue {
+			mutex queue_mutex;
+			std::deque<function<void()>> tasks;
+		};
+		vector<std::unique_ptr<WorkerQueue>> queues;
+		vector<thread> workers;
+		atomic<size_t> next_queue;				// 下一个任务放入哪个队列
+		mutex idle_mutex;
+		condition_variable cv_idle;
+		size_t pending;							// 尚未被取走的任务数，在idle_mutex下访问
+		bool f_Stop;
+		void run(const size_t);
+		bool takeTask(const size_t, function<void()>&);
+	public:
+		WorkStealingPool(const size_t);
+		~WorkStealingPool();
+		WorkStealingPool(const WorkStealingPool&) = delete;
+		WorkStealingPool& operator= (const WorkStealingPool&) = delete;
+		size_t size() const { return workers.size(); }
+		void submit(function<void()>);
+};
+
+WorkStealingPool& getStatementPool();			// 执行语句用的线程池；单核机器上没有工作线程，调用者应当自己执行
+
+
+
+// 函数体定义全部写在下方
+
+WorkStealingPool::WorkStealingPool(const size_t n):next_queue(0),pending(0),f_Stop(false) {
+	for (size_t i = 0; i < n; ++i) {
+		queues.emplace_back(new WorkerQueue);
+	}
+	for (size_t i = 0; i < n; ++i) {
+		workers.emplace_back(&WorkStealingPool::run, this, i);
+	}
+}
+WorkStealingPool::~WorkStealingPool() {
+	do {
+		lock_guard<mutex> lock(idle_mutex);
+		f_Stop = true;
+	} while (false);
+	cv_idle.notify_all();
+	for (thread& worker : workers) {
+		worker.join();
+	}
+}
+void WorkStealingPool::submit(function<void()> task) {
+	size_t index = next_queue.fetch_add(1) % queues.size();
+	do {
+		lock_guard<mutex> lock(queues.at(index)->queue_mutex);
+		queues.at(index)->tasks.push_back(std::move(task));
+	} while (false);
+	do {
+		lock_guard<mutex> lock(idle_mutex);
+		++pending;
+	} while (false);
+	cv_idle.notify_one();
+}
+bool WorkStealingPool::takeTask(const size_t self, function<void()>& task) {
+	// 先看自己的队列（取最新放入的），再依次看别人的队列（取最早放入的）
+	for (size_t i = 0; i < queues.size(); ++i) {
+		WorkerQueue& queue = *queues.at((self + i) % queues.size());
+		lock_guard<mutex> lock(queue.queue_mutex);
+		if (queue.tasks.empty()) continue;
+		if (i == 0) {
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		else {
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+		return true;
+	}
+	return false;
+}
+void WorkStealingPool::run(const size_t self) {
+	while (true) {
+		do {
+			unique_lock<mutex> lock(idle_mutex);
+			cv_idle.wait(lock, [this]() { return f_Stop or pending != 0; });
+			if (pending == 0) return;			// 只有f_Stop时才会走到这里
+			--pending;
+		} while (false);
+		// pending计入的任务一定已经在某个队列里，总能取到
+		function<void()> task;
+		while (!takeTask(self, task)) {}
+		task();
+	}
+}
+
+WorkStealingPool& getStatementPool() {
+	static WorkStealingPool pool(thread::hardware_concurrency() > 1 ? thread::hardware_concurrency() : 0);
+	return pool;
+}
+
+}
+
+#endif
\ No newline at end of file
@@ -49,10 +49,17 @@ int main(int argc, char** argv) {
  * ---------------------------------------------------- *
  * 	lib/												*
  * 		entry.h											*
+ * 		->	server.h									*
+ * 		->	collector.h								*
  * 		->	commands.h									*
+ * 			->	lexer.h								*
  * 			->	loggers.h			-> exceptions.h		*
  * 			->	operations.h		-> calculator.h		*
- * 			->	paramsanlys.h		-> stringop.h		*
+ * 									-> exporter.h		*
+ * 									-> transaction.h	*
+ * 									-> extsort.h		*
+ * 			->	paramsanlys.h		-> statements.h	*
+ * 			->	workpool.h							*
  * ---------------------------------------------------- *
  * 			->	calculator.h							*
  * 				->	objects.h							*
@@ -60,7 +67,8 @@ int main(int argc, char** argv) {
  * 						->	auxiliaries.h				*
  * 							->	exceptions.h			*
  * 								->	i18n.h				*
- * 									->	environments.h	*
+ * 									->	asynclog.h		*
+ * 										->	environments.h	*
  * ---------------------------------------------------- *
  */
 